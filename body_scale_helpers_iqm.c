@@ -1,230 +1,754 @@
 #define BONE_NAME_LENGTH 32
-// Load IQM animation data
-static ModelAnimation *LoadModelAnimationsIQMParents(const char *fileName, int *animCount)
+
+#define IQM_MAGIC       "INTERQUAKEMODEL"   // IQM file magic number
+#define IQM_VERSION     2                   // only IQM version 2 supported
+#define IQM_POSE_CHANNELS 10                // translation xyz, rotation xyzw, scale xyz
+#define IQM_POSE_MAX    (0xFFFF/IQM_POSE_CHANNELS) // channel plan targets are 16-bit
+
+// Read IQM files in place from a read-only mapping instead of copying
+// them to the heap, where mmap is available
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #define IQM_USE_MMAP
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Decode channels with SSE2 or NEON where available. Multiplies and adds are
+// kept separate, not fused, so that every path gives the same result.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define IQM_SIMD_SSE2
+    #include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define IQM_SIMD_NEON
+    #include <arm_neon.h>
+#endif
+
+// Decode the frames of animations on several threads where pthreads are available,
+// see LoadModelAnimationsIQMParentsFromMemory. Long animations are split into
+// jobs of IQM_DECODE_JOB_FRAMES frames so that they are shared out too.
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #define IQM_USE_THREADS
+    #include <pthread.h>
+#endif
+#define IQM_DECODE_THREAD_MAX 16
+#define IQM_DECODE_JOB_FRAMES 64
+#ifndef IQM_DECODE_THREAD_COUNT
+    #define IQM_DECODE_THREAD_COUNT 1   // threads that LoadModelAnimationsIQMParents decodes on
+#endif
+
+typedef struct IQMHeader {
+    char magic[16];
+    unsigned int version;
+    unsigned int dataSize;
+    unsigned int flags;
+    unsigned int num_text, ofs_text;
+    unsigned int num_meshes, ofs_meshes;
+    unsigned int num_vertexarrays, num_vertexes, ofs_vertexarrays;
+    unsigned int num_triangles, ofs_triangles, ofs_adjacency;
+    unsigned int num_joints, ofs_joints;
+    unsigned int num_poses, ofs_poses;
+    unsigned int num_anims, ofs_anims;
+    unsigned int num_frames, num_framechannels, ofs_frames, ofs_bounds;
+    unsigned int num_comment, ofs_comment;
+    unsigned int num_extensions, ofs_extensions;
+} IQMHeader;
+
+typedef struct IQMJoint {
+    unsigned int name;
+    int parent;
+    float translate[3], rotate[4], scale[3];
+} IQMJoint;
+
+typedef struct IQMPose {
+    int parent;
+    unsigned int mask;
+    float channeloffset[10];
+    float channelscale[10];
+} IQMPose;
+
+typedef struct IQMAnim {
+    unsigned int name;
+    unsigned int first_frame, num_frames;
+    float framerate;
+    unsigned int flags;
+} IQMAnim;
+
+// Frame poses of one animation, at the start of the one allocation that holds them.
+// The translations, rotations and scales of every bone are each stored frame after
+// frame, indexed by frame*boneCount + bone, so sampling a frame reads three linear
+// runs. bones of the ModelAnimation points into the same allocation, right after
+// this. These are the only copy of the poses: framePoses of the ModelAnimation is
+// NULL, so raylib's UpdateModelAnimation leaves it alone, see GetIQMFramePose.
+typedef struct IQMFramePoses {
+    unsigned int magic;             // IQM_FRAME_POSES_MAGIC
+    int frameCount;
+    int boneCount;
+    Vector3 *translations;
+    Quaternion *rotations;
+    Vector3 *scales;
+} IQMFramePoses;
+
+#define IQM_FRAME_POSES_MAGIC 0x53505149 // "IQPS"
+
+// Allocate the frame poses and bones of anim in one block, and point anim->bones into it
+static IQMFramePoses *LoadIQMFramePoses(ModelAnimation *anim, int frameCount, int boneCount)
 {
-    #define IQM_MAGIC       "INTERQUAKEMODEL"   // IQM file magic number
-    #define IQM_VERSION     2                   // only IQM version 2 supported
-
-    int dataSize = 0;
-    unsigned char *fileData = LoadFileData(fileName, &dataSize);
-    unsigned char *fileDataPtr = fileData;
-
-    typedef struct IQMHeader {
-        char magic[16];
-        unsigned int version;
-        unsigned int dataSize;
-        unsigned int flags;
-        unsigned int num_text, ofs_text;
-        unsigned int num_meshes, ofs_meshes;
-        unsigned int num_vertexarrays, num_vertexes, ofs_vertexarrays;
-        unsigned int num_triangles, ofs_triangles, ofs_adjacency;
-        unsigned int num_joints, ofs_joints;
-        unsigned int num_poses, ofs_poses;
-        unsigned int num_anims, ofs_anims;
-        unsigned int num_frames, num_framechannels, ofs_frames, ofs_bounds;
-        unsigned int num_comment, ofs_comment;
-        unsigned int num_extensions, ofs_extensions;
-    } IQMHeader;
-
-    typedef struct IQMJoint {
-        unsigned int name;
-        int parent;
-        float translate[3], rotate[4], scale[3];
-    } IQMJoint;
-
-    typedef struct IQMPose {
-        int parent;
-        unsigned int mask;
-        float channeloffset[10];
-        float channelscale[10];
-    } IQMPose;
-
-    typedef struct IQMAnim {
-        unsigned int name;
-        unsigned int first_frame, num_frames;
-        float framerate;
-        unsigned int flags;
-    } IQMAnim;
+    const size_t poseCount = (size_t)frameCount*boneCount;
+    const size_t size = sizeof(IQMFramePoses) + boneCount*sizeof(BoneInfo)
+        + poseCount*(2*sizeof(Vector3) + sizeof(Quaternion));
+    IQMFramePoses *framePoses = (IQMFramePoses *)RL_MALLOC(size);
+    framePoses->magic = IQM_FRAME_POSES_MAGIC;
+    framePoses->frameCount = frameCount;
+    framePoses->boneCount = boneCount;
+
+    // Everything after the header has 4 byte alignment
+    anim->bones = (BoneInfo *)(framePoses + 1);
+    framePoses->translations = (Vector3 *)(anim->bones + boneCount);
+    framePoses->rotations = (Quaternion *)(framePoses->translations + poseCount);
+    framePoses->scales = (Vector3 *)(framePoses->rotations + poseCount);
+
+    anim->framePoses = NULL;
+    anim->frameCount = frameCount;
+    anim->boneCount = boneCount;
+    return framePoses;
+}
 
-    // In case file can not be read, return an empty model
-    if (fileDataPtr == NULL) return NULL;
+// Frame poses of an animation from LoadModelAnimationsIQMParents
+static const IQMFramePoses *GetIQMFramePoses(const ModelAnimation *anim)
+{
+    const IQMFramePoses *framePoses = (const IQMFramePoses *)anim->bones - 1;
+    assert(framePoses->magic == IQM_FRAME_POSES_MAGIC); // not from LoadModelAnimationsIQMParents
+    return framePoses;
+}
+
+// Local pose of a bone in a frame, as raylib would keep it in framePoses[frame][bone]
+static Transform GetIQMFramePose(const IQMFramePoses *framePoses, int frame, int bone)
+{
+    const size_t p = (size_t)frame*framePoses->boneCount + bone;
+    return (Transform){ framePoses->translations[p], framePoses->rotations[p], framePoses->scales[p] };
+}
+
+// Unload animations from LoadModelAnimationsIQMParents, UnloadModelAnimations
+// would free every frame on its own
+static void UnloadModelAnimationsIQMParents(ModelAnimation *animations, int animCount)
+{
+    for (int a = 0; a < animCount; a++) RL_FREE((IQMFramePoses *)animations[a].bones - 1);
+    RL_FREE(animations);
+}
+
+// Map a file read-only, or load it where mmap is not available. Returns NULL if it can not be read.
+static const unsigned char *MapIQMFile(const char *fileName, unsigned int *dataSize)
+{
+#ifdef IQM_USE_MMAP
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1)
+    {
+        TRACELOG(LOG_WARNING, "FILEIO: [%s] Failed to open file", fileName);
+        return NULL;
+    }
+    struct stat fileStat;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0 && fileStat.st_size <= 0xFFFFFFFF)
+        mapping = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (mapping == MAP_FAILED)
+    {
+        TRACELOG(LOG_WARNING, "FILEIO: [%s] Failed to map file", fileName);
+        return NULL;
+    }
+    *dataSize = (unsigned int)fileStat.st_size;
+    return (const unsigned char *)mapping;
+#else
+    int size = 0;
+    unsigned char *fileData = LoadFileData(fileName, &size);
+    *dataSize = (unsigned int)size;
+    return fileData;
+#endif
+}
+
+static void UnmapIQMFile(const unsigned char *fileData, unsigned int dataSize)
+{
+#ifdef IQM_USE_MMAP
+    munmap((void *)fileData, dataSize);
+#else
+    UnloadFileData((unsigned char *)fileData);
+#endif
+}
+
+// Whether count elements at offset are inside the file and aligned for reading them in place
+static bool IsIQMRangeValid(unsigned int dataSize, unsigned int offset, unsigned long long count,
+    unsigned int elementSize, unsigned int alignment)
+{
+    return offset%alignment == 0 && offset <= dataSize && count*elementSize <= dataSize - offset;
+}
+
+// Copy a name from the text section, which may not be terminated at its end
+static void CopyIQMName(char *name, const unsigned char *text, unsigned int textSize, unsigned int offset)
+{
+    unsigned int length = 0;
+    while (offset + length < textSize && length < BONE_NAME_LENGTH - 1 && text[offset + length] != '\0') length++;
+    if (offset < textSize) memcpy(name, text + offset, length);
+    name[length] = '\0';
+}
+
+// How the stored channels of a frame are decoded, made once from the pose masks:
+// for each stored channel, in the order of the frame data, the channel of which
+// bone it is added to and its offset and scale.
+typedef struct IQMChannelPlan {
+    int boneCount;
+    int channelCount;               // stored channels per frame
+    float *constants;               // boneCount*IQM_POSE_CHANNELS, the offsets of every channel
+    float *offsets;                 // channelCount
+    float *scales;                  // channelCount
+    unsigned short *targets;        // channelCount, bone*IQM_POSE_CHANNELS + channel
+} IQMChannelPlan;
+
+static int CountIQMChannels(const IQMPose *poses, int boneCount)
+{
+    int channelCount = 0;
+    for (int i = 0; i < boneCount; i++)
+    {
+        for (int c = 0; c < IQM_POSE_CHANNELS; c++) channelCount += (poses[i].mask >> c) & 1;
+    }
+    return channelCount;
+}
+
+// Bytes that InitIQMChannelPlan needs, a multiple of 2
+static size_t GetIQMChannelPlanSize(int boneCount, int channelCount)
+{
+    return (boneCount*IQM_POSE_CHANNELS + 2*channelCount)*sizeof(float) + channelCount*sizeof(unsigned short);
+}
+
+// Make the plan in memory, GetIQMChannelPlanSize bytes with 4 byte alignment.
+// Targets are 16-bit, so boneCount must be at most IQM_POSE_MAX, which CheckIQMAnimations checks.
+static void InitIQMChannelPlan(IQMChannelPlan *plan, const IQMPose *poses, int boneCount, void *memory)
+{
+    plan->boneCount = boneCount;
+    plan->channelCount = CountIQMChannels(poses, boneCount);
+    plan->constants = (float *)memory;
+    plan->offsets = plan->constants + boneCount*IQM_POSE_CHANNELS;
+    plan->scales = plan->offsets + plan->channelCount;
+    plan->targets = (unsigned short *)(plan->scales + plan->channelCount);
+
+    int k = 0;
+    for (int i = 0; i < boneCount; i++)
+    {
+        for (int c = 0; c < IQM_POSE_CHANNELS; c++)
+        {
+            plan->constants[i*IQM_POSE_CHANNELS + c] = poses[i].channeloffset[c];
+            if (!(poses[i].mask & (1 << c))) continue;
+            plan->offsets[k] = poses[i].channeloffset[c];
+            plan->scales[k] = poses[i].channelscale[c];
+            plan->targets[k] = (unsigned short)(i*IQM_POSE_CHANNELS + c);
+            k++;
+        }
+    }
+}
+
+static void ScatterIQMChannels(const IQMChannelPlan *plan, const float *values, float *channels)
+{
+    memcpy(channels, plan->constants, plan->boneCount*IQM_POSE_CHANNELS*sizeof(float));
+    for (int k = 0; k < plan->channelCount; k++) channels[plan->targets[k]] = values[k];
+}
 
+// Decode the stored channels of one frame, data, into channels, boneCount*IQM_POSE_CHANNELS
+// floats with the rotations not normalized. values holds channelCount floats.
+static void DecodeIQMChannelsScalar(const IQMChannelPlan *plan, const unsigned short *data, float *channels, float *values)
+{
+    for (int k = 0; k < plan->channelCount; k++) values[k] = plan->offsets[k] + data[k]*plan->scales[k];
+    ScatterIQMChannels(plan, values, channels);
+}
+
+// Same, eight channels at a time
+static void DecodeIQMChannels(const IQMChannelPlan *plan, const unsigned short *data, float *channels, float *values)
+{
+    const float *offsets = plan->offsets;
+    const float *scales = plan->scales;
+    int k = 0;
+#if defined(IQM_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; k + 8 <= plan->channelCount; k += 8)
+    {
+        const __m128i raw = _mm_loadu_si128((const __m128i *)(data + k));
+        const __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+        const __m128 high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+        _mm_storeu_ps(values + k, _mm_add_ps(_mm_loadu_ps(offsets + k), _mm_mul_ps(low, _mm_loadu_ps(scales + k))));
+        _mm_storeu_ps(values + k + 4, _mm_add_ps(_mm_loadu_ps(offsets + k + 4), _mm_mul_ps(high, _mm_loadu_ps(scales + k + 4))));
+    }
+#elif defined(IQM_SIMD_NEON)
+    for (; k + 8 <= plan->channelCount; k += 8)
+    {
+        const uint16x8_t raw = vld1q_u16(data + k);
+        const float32x4_t low = vcvtq_f32_u32(vmovl_u16(vget_low_u16(raw)));
+        const float32x4_t high = vcvtq_f32_u32(vmovl_u16(vget_high_u16(raw)));
+        vst1q_f32(values + k, vaddq_f32(vld1q_f32(offsets + k), vmulq_f32(low, vld1q_f32(scales + k))));
+        vst1q_f32(values + k + 4, vaddq_f32(vld1q_f32(offsets + k + 4), vmulq_f32(high, vld1q_f32(scales + k + 4))));
+    }
+#endif
+    for (; k < plan->channelCount; k++) values[k] = offsets[k] + data[k]*scales[k];
+    ScatterIQMChannels(plan, values, channels);
+}
+
+// Normalize the rotation of each bone in channels, like QuaternionNormalize
+static void NormalizeIQMRotationsScalar(float *channels, int boneCount)
+{
+    for (int i = 0; i < boneCount; i++)
+    {
+        float *r = channels + i*IQM_POSE_CHANNELS + 3;
+        const Quaternion q = QuaternionNormalize((Quaternion){ r[0], r[1], r[2], r[3] });
+        r[0] = q.x; r[1] = q.y; r[2] = q.z; r[3] = q.w;
+    }
+}
+
+// Same, four bones at a time with their rotations transposed to x, y, z and w
+static void NormalizeIQMRotations(float *channels, int boneCount)
+{
+    int i = 0;
+#if defined(IQM_SIMD_SSE2)
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= boneCount; i += 4)
+    {
+        float *r = channels + i*IQM_POSE_CHANNELS + 3;
+        __m128 x = _mm_loadu_ps(r), y = _mm_loadu_ps(r + IQM_POSE_CHANNELS);
+        __m128 z = _mm_loadu_ps(r + 2*IQM_POSE_CHANNELS), w = _mm_loadu_ps(r + 3*IQM_POSE_CHANNELS);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), _mm_mul_ps(w, w)));
+        length = _mm_or_ps(_mm_andnot_ps(_mm_cmpeq_ps(length, _mm_setzero_ps()), length),
+            _mm_and_ps(_mm_cmpeq_ps(length, _mm_setzero_ps()), one)); // 1 where 0
+        const __m128 inverse = _mm_div_ps(one, length);
+        x = _mm_mul_ps(x, inverse); y = _mm_mul_ps(y, inverse);
+        z = _mm_mul_ps(z, inverse); w = _mm_mul_ps(w, inverse);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_ps(r, x); _mm_storeu_ps(r + IQM_POSE_CHANNELS, y);
+        _mm_storeu_ps(r + 2*IQM_POSE_CHANNELS, z); _mm_storeu_ps(r + 3*IQM_POSE_CHANNELS, w);
+    }
+#elif defined(IQM_SIMD_NEON)
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    for (; i + 4 <= boneCount; i += 4)
+    {
+        float *r = channels + i*IQM_POSE_CHANNELS + 3;
+        // Transposing is its own inverse
+        float32x4x2_t t01 = vtrnq_f32(vld1q_f32(r), vld1q_f32(r + IQM_POSE_CHANNELS));
+        float32x4x2_t t23 = vtrnq_f32(vld1q_f32(r + 2*IQM_POSE_CHANNELS), vld1q_f32(r + 3*IQM_POSE_CHANNELS));
+        float32x4_t x = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+        float32x4_t y = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+        float32x4_t z = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+        float32x4_t w = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+        float32x4_t length = vsqrtq_f32(vaddq_f32(vaddq_f32(vaddq_f32(
+            vmulq_f32(x, x), vmulq_f32(y, y)), vmulq_f32(z, z)), vmulq_f32(w, w)));
+        length = vbslq_f32(vceqq_f32(length, vdupq_n_f32(0.0f)), one, length); // 1 where 0
+        const float32x4_t inverse = vdivq_f32(one, length);
+        x = vmulq_f32(x, inverse); y = vmulq_f32(y, inverse);
+        z = vmulq_f32(z, inverse); w = vmulq_f32(w, inverse);
+        t01 = vtrnq_f32(x, y);
+        t23 = vtrnq_f32(z, w);
+        vst1q_f32(r, vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+        vst1q_f32(r + IQM_POSE_CHANNELS, vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+        vst1q_f32(r + 2*IQM_POSE_CHANNELS, vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+        vst1q_f32(r + 3*IQM_POSE_CHANNELS, vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+    }
+#endif
+    NormalizeIQMRotationsScalar(channels + i*IQM_POSE_CHANNELS, boneCount - i);
+}
+
+// Check every section of an IQM file that animations are read from in place.
+// fileDataPtr must have 4 byte alignment. Returns the header at its start, or NULL.
+static const IQMHeader *CheckIQMAnimations(const unsigned char *fileDataPtr, unsigned int dataSize, const char *fileName)
+{
     // Read IQM header
-    IQMHeader *iqmHeader = (IQMHeader *)fileDataPtr;
+    const IQMHeader *iqmHeader = (const IQMHeader *)fileDataPtr;
 
-    if (memcmp(iqmHeader->magic, IQM_MAGIC, sizeof(IQM_MAGIC)) != 0)
+    if (dataSize < sizeof(IQMHeader) || memcmp(iqmHeader->magic, IQM_MAGIC, sizeof(IQM_MAGIC)) != 0)
     {
         TRACELOG(LOG_WARNING, "MODEL: [%s] IQM file is not a valid model", fileName);
-        UnloadFileData(fileData);
         return NULL;
     }
 
     if (iqmHeader->version != IQM_VERSION)
     {
         TRACELOG(LOG_WARNING, "MODEL: [%s] IQM file version not supported (%i)", fileName, iqmHeader->version);
-        UnloadFileData(fileData);
         return NULL;
     }
 
+    if (iqmHeader->num_poses > IQM_POSE_MAX)
+    {
+        TRACELOG(LOG_WARNING, "MODEL: [%s] IQM file has too many poses (%u, at most %i)", fileName, iqmHeader->num_poses, IQM_POSE_MAX);
+        return NULL;
+    }
+
+    // Every section is read in place, so check that each one is inside the file
+    bool isValid = IsIQMRangeValid(dataSize, iqmHeader->ofs_text, iqmHeader->num_text, 1, 1)
+        && IsIQMRangeValid(dataSize, iqmHeader->ofs_poses, iqmHeader->num_poses, sizeof(IQMPose), 4)
+        && IsIQMRangeValid(dataSize, iqmHeader->ofs_anims, iqmHeader->num_anims, sizeof(IQMAnim), 4)
+        && IsIQMRangeValid(dataSize, iqmHeader->ofs_frames,
+            (unsigned long long)iqmHeader->num_frames*iqmHeader->num_framechannels, sizeof(unsigned short), 2)
+        && (iqmHeader->num_joints == 0 || (iqmHeader->num_joints >= iqmHeader->num_poses
+            && IsIQMRangeValid(dataSize, iqmHeader->ofs_joints, iqmHeader->num_joints, sizeof(IQMJoint), 4)));
+
+    const IQMPose *poses = (const IQMPose *)(fileDataPtr + iqmHeader->ofs_poses);
+
+    // Channels that each frame reads from the frame data
+    isValid = isValid && (unsigned int)CountIQMChannels(poses, iqmHeader->num_poses) <= iqmHeader->num_framechannels;
+
+    const IQMAnim *anim = (const IQMAnim *)(fileDataPtr + iqmHeader->ofs_anims);
+    for (unsigned int a = 0; isValid && a < iqmHeader->num_anims; a++)
+    {
+        isValid = anim[a].first_frame <= iqmHeader->num_frames
+            && anim[a].num_frames <= iqmHeader->num_frames - anim[a].first_frame;
+    }
+
+    if (!isValid)
+    {
+        TRACELOG(LOG_WARNING, "MODEL: [%s] IQM file has sections outside of the file", fileName);
+        return NULL;
+    }
+
+    return iqmHeader;
+}
+
+// Map an IQM file and check it with CheckIQMAnimations.
+// Returns the header at the start of the mapping, or NULL.
+static const IQMHeader *MapIQMAnimations(const char *fileName, unsigned int *dataSize)
+{
+    const unsigned char *fileDataPtr = MapIQMFile(fileName, dataSize);
+    if (fileDataPtr == NULL) return NULL;
+
+    const IQMHeader *iqmHeader = CheckIQMAnimations(fileDataPtr, *dataSize, fileName);
+    if (iqmHeader == NULL) UnmapIQMFile(fileDataPtr, *dataSize);
+    return iqmHeader;
+}
+
+// Frames [firstFrame, firstFrame + frameCount) of one animation
+typedef struct IQMDecodeJob {
+    int anim;
+    int firstFrame;
+    int frameCount;
+} IQMDecodeJob;
+
+// What the threads decoding the animations of a file share. Jobs are taken
+// in order, and each one writes only its own frames, so the result does not
+// depend on which thread decodes which job or on how many there are.
+typedef struct IQMDecodeJobs {
+    const IQMChannelPlan *plan;
+    const IQMAnim *anims;
+    const unsigned short *framedata;
+    unsigned int frameChannelCount; // num_framechannels
+    ModelAnimation *animations;
+    IQMDecodeJob *jobs;
+    int jobCount;
+    int nextJob;                    // next job to take
+#ifdef IQM_USE_THREADS
+    pthread_mutex_t mutex;          // guards nextJob
+#endif
+} IQMDecodeJobs;
+
+// Decode the frames of a job into the frame poses of its animation
+static void DecodeIQMFrames(const IQMDecodeJobs *self, const IQMDecodeJob *job, float *channels, float *values)
+{
+    const IQMChannelPlan *plan = self->plan;
+    const IQMAnim *anim = &self->anims[job->anim];
+    ModelAnimation *animation = &self->animations[job->anim];
+    IQMFramePoses *framePoses = (IQMFramePoses *)animation->bones - 1;
+
+    for (int frame = job->firstFrame; frame < job->firstFrame + job->frameCount; frame++)
+    {
+        // Translation xyz, rotation xyzw, scale xyz for each bone
+        DecodeIQMChannels(plan, self->framedata + (size_t)(anim->first_frame + frame)*self->frameChannelCount, channels, values);
+        NormalizeIQMRotations(channels, plan->boneCount);
+
+        for (int i = 0; i < plan->boneCount; i++)
+        {
+            const float *c = channels + i*IQM_POSE_CHANNELS;
+            const size_t p = (size_t)frame*plan->boneCount + i;
+            framePoses->translations[p] = (Vector3){ c[0], c[1], c[2] };
+            framePoses->rotations[p] = (Quaternion){ c[3], c[4], c[5], c[6] };
+            framePoses->scales[p] = (Vector3){ c[7], c[8], c[9] };
+        }
+    }
+}
+
+// Decode jobs until there are none left, on any thread
+static void *RunIQMDecodeJobs(void *arg)
+{
+    IQMDecodeJobs *self = (IQMDecodeJobs *)arg;
+    float *channels = (float *)RL_MALLOC((self->plan->boneCount*IQM_POSE_CHANNELS + self->plan->channelCount)*sizeof(float));
+    float *values = channels + self->plan->boneCount*IQM_POSE_CHANNELS;
+
+    for (;;)
+    {
+#ifdef IQM_USE_THREADS
+        pthread_mutex_lock(&self->mutex);
+#endif
+        const int index = self->nextJob < self->jobCount ? self->nextJob++ : -1;
+#ifdef IQM_USE_THREADS
+        pthread_mutex_unlock(&self->mutex);
+#endif
+        if (index < 0) break;
+        DecodeIQMFrames(self, &self->jobs[index], channels, values);
+    }
+
+    RL_FREE(channels);
+    return NULL;
+}
+
+// Decode all jobs on this thread and up to threadCount - 1 others
+static void RunIQMDecodeJobsOnThreads(IQMDecodeJobs *self, int threadCount)
+{
+    if (threadCount > self->jobCount) threadCount = self->jobCount;
+    if (threadCount > IQM_DECODE_THREAD_MAX) threadCount = IQM_DECODE_THREAD_MAX;
+#ifdef IQM_USE_THREADS
+    pthread_t threads[IQM_DECODE_THREAD_MAX];
+    int startedCount = 0;
+    pthread_mutex_init(&self->mutex, NULL);
+    // If a thread cannot be started, the ones that are take its jobs
+    while (startedCount < threadCount - 1
+        && pthread_create(&threads[startedCount], NULL, RunIQMDecodeJobs, self) == 0) startedCount++;
+    RunIQMDecodeJobs(self);
+    for (int i = 0; i < startedCount; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&self->mutex);
+#else
+    (void)threadCount;
+    RunIQMDecodeJobs(self);
+#endif
+}
+
+// Load the animations of an IQM file checked by CheckIQMAnimations, decoding on threadCount threads
+static ModelAnimation *DecodeModelAnimationsIQMParents(const IQMHeader *iqmHeader, int *animCount, int threadCount)
+{
+    const unsigned char *fileDataPtr = (const unsigned char *)iqmHeader;
+
     // Get bones data
-    IQMPose *poses = (IQMPose *)RL_MALLOC(iqmHeader->num_poses*sizeof(IQMPose));
-    //fseek(iqmFile, iqmHeader->ofs_poses, SEEK_SET);
-    //fread(poses, sizeof(IQMPose), iqmHeader->num_poses, iqmFile);
-    memcpy(poses, fileDataPtr + iqmHeader->ofs_poses, iqmHeader->num_poses*sizeof(IQMPose));
+    const IQMPose *poses = (const IQMPose *)(fileDataPtr + iqmHeader->ofs_poses);
 
     // Get animations data
-    *animCount = iqmHeader->num_anims;
-    IQMAnim *anim = (IQMAnim *)RL_MALLOC(iqmHeader->num_anims*sizeof(IQMAnim));
-    //fseek(iqmFile, iqmHeader->ofs_anims, SEEK_SET);
-    //fread(anim, sizeof(IQMAnim), iqmHeader->num_anims, iqmFile);
-    memcpy(anim, fileDataPtr + iqmHeader->ofs_anims, iqmHeader->num_anims*sizeof(IQMAnim));
+    const IQMAnim *anim = (const IQMAnim *)(fileDataPtr + iqmHeader->ofs_anims);
 
+    *animCount = iqmHeader->num_anims;
     ModelAnimation *animations = (ModelAnimation *)RL_MALLOC(iqmHeader->num_anims*sizeof(ModelAnimation));
 
-    // frameposes
-    unsigned short *framedata = (unsigned short *)RL_MALLOC(iqmHeader->num_frames*iqmHeader->num_framechannels*sizeof(unsigned short));
-    //fseek(iqmFile, iqmHeader->ofs_frames, SEEK_SET);
-    //fread(framedata, sizeof(unsigned short), iqmHeader->num_frames*iqmHeader->num_framechannels, iqmFile);
-    memcpy(framedata, fileDataPtr + iqmHeader->ofs_frames, iqmHeader->num_frames*iqmHeader->num_framechannels*sizeof(unsigned short));
-
     // joints
-    IQMJoint *joints = (IQMJoint *)RL_MALLOC(iqmHeader->num_joints*sizeof(IQMJoint));
-    memcpy(joints, fileDataPtr + iqmHeader->ofs_joints, iqmHeader->num_joints*sizeof(IQMJoint));
+    const IQMJoint *joints = (const IQMJoint *)(fileDataPtr + iqmHeader->ofs_joints);
+    const unsigned char *text = fileDataPtr + iqmHeader->ofs_text;
+
+    // The plan is shared by all animations
+    const int boneCount = iqmHeader->num_poses;
+    IQMChannelPlan plan;
+    void *planMemory = RL_MALLOC(GetIQMChannelPlanSize(boneCount, CountIQMChannels(poses, boneCount)));
+    InitIQMChannelPlan(&plan, poses, boneCount, planMemory);
+
+    IQMDecodeJobs decodeJobs = { 0 };
+    decodeJobs.plan = &plan;
+    decodeJobs.anims = anim;
+    decodeJobs.framedata = (const unsigned short *)(fileDataPtr + iqmHeader->ofs_frames);
+    decodeJobs.frameChannelCount = iqmHeader->num_framechannels;
+    decodeJobs.animations = animations;
+    for (unsigned int a = 0; a < iqmHeader->num_anims; a++)
+        decodeJobs.jobCount += (anim[a].num_frames + IQM_DECODE_JOB_FRAMES - 1)/IQM_DECODE_JOB_FRAMES;
+    decodeJobs.jobs = (IQMDecodeJob *)RL_MALLOC(decodeJobs.jobCount*sizeof(IQMDecodeJob));
 
+    int jobCount = 0;
     for (unsigned int a = 0; a < iqmHeader->num_anims; a++)
     {
-        animations[a].frameCount = anim[a].num_frames;
-        animations[a].boneCount = iqmHeader->num_poses;
-        animations[a].bones = (BoneInfo *)RL_MALLOC(iqmHeader->num_poses*sizeof(BoneInfo));
-        animations[a].framePoses = (Transform **)RL_MALLOC(anim[a].num_frames*sizeof(Transform *));
-        memcpy(animations[a].name, fileDataPtr + iqmHeader->ofs_text + anim[a].name, 32);
+        LoadIQMFramePoses(&animations[a], anim[a].num_frames, iqmHeader->num_poses);
+        CopyIQMName(animations[a].name, text, iqmHeader->num_text, anim[a].name);
         TRACELOG(LOG_INFO, "IQM Anim %s", animations[a].name);
         //animations[a].framerate = anim.framerate; // TODO: Use animation framerate data?
 
         for (unsigned int j = 0; j < iqmHeader->num_poses; j++)
         {
             // If animations and skeleton are in the same file, copy bone names to anim
-            if (iqmHeader->num_joints > 0) memcpy(animations[a].bones[j].name, fileDataPtr + iqmHeader->ofs_text + joints[j].name, BONE_NAME_LENGTH*sizeof(char));
-            else memcpy(animations[a].bones[j].name, "ANIMJOINTNAME", 13); // Default bone name otherwise
+            if (iqmHeader->num_joints > 0) CopyIQMName(animations[a].bones[j].name, text, iqmHeader->num_text, joints[j].name);
+            else memcpy(animations[a].bones[j].name, "ANIMJOINTNAME", 14); // Default bone name otherwise
             animations[a].bones[j].parent = poses[j].parent;
         }
 
-        for (unsigned int j = 0; j < anim[a].num_frames; j++) animations[a].framePoses[j] = (Transform *)RL_MALLOC(iqmHeader->num_poses*sizeof(Transform));
-
-        int dcounter = anim[a].first_frame*iqmHeader->num_framechannels;
+        for (unsigned int frame = 0; frame < anim[a].num_frames; frame += IQM_DECODE_JOB_FRAMES)
+        {
+            const unsigned int frameCount = anim[a].num_frames - frame;
+            decodeJobs.jobs[jobCount++] = (IQMDecodeJob){ (int)a, (int)frame,
+                (int)(frameCount < IQM_DECODE_JOB_FRAMES ? frameCount : IQM_DECODE_JOB_FRAMES) };
+        }
 
+        // Build frameposes
+        /*
         for (unsigned int frame = 0; frame < anim[a].num_frames; frame++)
         {
-            for (unsigned int i = 0; i < iqmHeader->num_poses; i++)
+            for (int i = 0; i < animations[a].boneCount; i++)
             {
-                animations[a].framePoses[frame][i].translation.x = poses[i].channeloffset[0];
-
-                if (poses[i].mask & 0x01)
+                if (animations[a].bones[i].parent >= 0)
                 {
-                    animations[a].framePoses[frame][i].translation.x += framedata[dcounter]*poses[i].channelscale[0];
-                    dcounter++;
+                    animations[a].framePoses[frame][i].rotation = QuaternionMultiply(animations[a].framePoses[frame][animations[a].bones[i].parent].rotation, animations[a].framePoses[frame][i].rotation);
+                    animations[a].framePoses[frame][i].translation = Vector3RotateByQuaternion(animations[a].framePoses[frame][i].translation, animations[a].framePoses[frame][animations[a].bones[i].parent].rotation);
+                    animations[a].framePoses[frame][i].translation = Vector3Add(animations[a].framePoses[frame][i].translation, animations[a].framePoses[frame][animations[a].bones[i].parent].translation);
+                    animations[a].framePoses[frame][i].scale = Vector3Multiply(animations[a].framePoses[frame][i].scale, animations[a].framePoses[frame][animations[a].bones[i].parent].scale);
                 }
+            }
+        }
+        */
+    }
 
-                animations[a].framePoses[frame][i].translation.y = poses[i].channeloffset[1];
+    RunIQMDecodeJobsOnThreads(&decodeJobs, threadCount);
 
-                if (poses[i].mask & 0x02)
-                {
-                    animations[a].framePoses[frame][i].translation.y += framedata[dcounter]*poses[i].channelscale[1];
-                    dcounter++;
-                }
+    RL_FREE(decodeJobs.jobs);
+    RL_FREE(planMemory);
 
-                animations[a].framePoses[frame][i].translation.z = poses[i].channeloffset[2];
+    return animations;
+}
 
-                if (poses[i].mask & 0x04)
-                {
-                    animations[a].framePoses[frame][i].translation.z += framedata[dcounter]*poses[i].channelscale[2];
-                    dcounter++;
-                }
+// Load IQM animation data
+static ModelAnimation *LoadModelAnimationsIQMParents(const char *fileName, int *animCount)
+{
+    unsigned int dataSize = 0;
+    const IQMHeader *iqmHeader = MapIQMAnimations(fileName, &dataSize);
 
-                animations[a].framePoses[frame][i].rotation.x = poses[i].channeloffset[3];
+    // In case file can not be read, return an empty model
+    if (iqmHeader == NULL) return NULL;
 
-                if (poses[i].mask & 0x08)
-                {
-                    animations[a].framePoses[frame][i].rotation.x += framedata[dcounter]*poses[i].channelscale[3];
-                    dcounter++;
-                }
+    ModelAnimation *animations = DecodeModelAnimationsIQMParents(iqmHeader, animCount, IQM_DECODE_THREAD_COUNT);
+    UnmapIQMFile((const unsigned char *)iqmHeader, dataSize);
 
-                animations[a].framePoses[frame][i].rotation.y = poses[i].channeloffset[4];
+    return animations;
+}
 
-                if (poses[i].mask & 0x10)
-                {
-                    animations[a].framePoses[frame][i].rotation.y += framedata[dcounter]*poses[i].channelscale[4];
-                    dcounter++;
-                }
+// Load IQM animation data from an IQM file in memory, with 4 byte alignment,
+// decoding their frames on up to threadCount threads. The result is the same
+// for any threadCount.
+static ModelAnimation *LoadModelAnimationsIQMParentsFromMemory(const unsigned char *fileData, unsigned int dataSize,
+    int *animCount, int threadCount)
+{
+    assert(((size_t)fileData & 3) == 0);
+    const IQMHeader *iqmHeader = CheckIQMAnimations(fileData, dataSize, "memory");
+    if (iqmHeader == NULL) return NULL;
 
-                animations[a].framePoses[frame][i].rotation.z = poses[i].channeloffset[5];
+    return DecodeModelAnimationsIQMParents(iqmHeader, animCount, threadCount);
+}
 
-                if (poses[i].mask & 0x20)
-                {
-                    animations[a].framePoses[frame][i].rotation.z += framedata[dcounter]*poses[i].channelscale[5];
-                    dcounter++;
-                }
+// An animation kept as IQM stores it, the 16-bit channels of each frame,
+// decoded only for the frames that are sampled.
+typedef struct IQMQuantizedAnimation {
+    char name[32];
+    int frameCount;
+    int boneCount;
+    float framerate;
+    BoneInfo *bones;                // start of the one allocation that holds the plan and frames too
+    IQMChannelPlan plan;
+    unsigned short *frames;         // frameCount*plan.channelCount
+} IQMQuantizedAnimation;
+
+// Floats of scratch that SampleIQMQuantizedAnimation needs
+#define IQM_QUANTIZED_SCRATCH_SIZE(boneCount) ((boneCount)*IQM_POSE_CHANNELS*3)
+
+// Load IQM animations without decoding their frames
+static IQMQuantizedAnimation *LoadModelAnimationsIQMQuantized(const char *fileName, int *animCount)
+{
+    unsigned int dataSize = 0;
+    const IQMHeader *iqmHeader = MapIQMAnimations(fileName, &dataSize);
+    if (iqmHeader == NULL) return NULL;
+    const unsigned char *fileDataPtr = (const unsigned char *)iqmHeader;
 
-                animations[a].framePoses[frame][i].rotation.w = poses[i].channeloffset[6];
+    const IQMPose *poses = (const IQMPose *)(fileDataPtr + iqmHeader->ofs_poses);
+    const IQMAnim *anim = (const IQMAnim *)(fileDataPtr + iqmHeader->ofs_anims);
+    const unsigned short *framedata = (const unsigned short *)(fileDataPtr + iqmHeader->ofs_frames);
+    const IQMJoint *joints = (const IQMJoint *)(fileDataPtr + iqmHeader->ofs_joints);
+    const unsigned char *text = fileDataPtr + iqmHeader->ofs_text;
 
-                if (poses[i].mask & 0x40)
-                {
-                    animations[a].framePoses[frame][i].rotation.w += framedata[dcounter]*poses[i].channelscale[6];
-                    dcounter++;
-                }
+    const int boneCount = iqmHeader->num_poses;
+    const int channelCount = CountIQMChannels(poses, boneCount);
 
-                animations[a].framePoses[frame][i].scale.x = poses[i].channeloffset[7];
+    *animCount = iqmHeader->num_anims;
+    IQMQuantizedAnimation *animations = (IQMQuantizedAnimation *)RL_MALLOC(iqmHeader->num_anims*sizeof(IQMQuantizedAnimation));
 
-                if (poses[i].mask & 0x80)
-                {
-                    animations[a].framePoses[frame][i].scale.x += framedata[dcounter]*poses[i].channelscale[7];
-                    dcounter++;
-                }
+    for (unsigned int a = 0; a < iqmHeader->num_anims; a++)
+    {
+        IQMQuantizedAnimation *animation = &animations[a];
+        animation->frameCount = anim[a].num_frames;
+        animation->boneCount = boneCount;
+        animation->framerate = anim[a].framerate;
+        CopyIQMName(animation->name, text, iqmHeader->num_text, anim[a].name);
+        TRACELOG(LOG_INFO, "IQM Anim %s, %i frames kept quantized", animation->name, animation->frameCount);
+
+        // The bones and the plan, which ends 2 byte aligned, then the frames
+        const size_t frameDataCount = (size_t)animation->frameCount*channelCount;
+        animation->bones = (BoneInfo *)RL_MALLOC(boneCount*sizeof(BoneInfo)
+            + GetIQMChannelPlanSize(boneCount, channelCount) + frameDataCount*sizeof(unsigned short));
+        InitIQMChannelPlan(&animation->plan, poses, boneCount, animation->bones + boneCount);
+        animation->frames = animation->plan.targets + channelCount;
+
+        for (int i = 0; i < boneCount; i++)
+        {
+            if (iqmHeader->num_joints > 0) CopyIQMName(animation->bones[i].name, text, iqmHeader->num_text, joints[i].name);
+            else memcpy(animation->bones[i].name, "ANIMJOINTNAME", 14);
+            animation->bones[i].parent = poses[i].parent;
+        }
 
-                animations[a].framePoses[frame][i].scale.y = poses[i].channeloffset[8];
+        // Only the channels that are used, frames may have more
+        for (int frame = 0; frame < animation->frameCount; frame++)
+        {
+            memcpy(animation->frames + (size_t)frame*channelCount,
+                framedata + (size_t)(anim[a].first_frame + frame)*iqmHeader->num_framechannels,
+                channelCount*sizeof(unsigned short));
+        }
+    }
 
-                if (poses[i].mask & 0x100)
-                {
-                    animations[a].framePoses[frame][i].scale.y += framedata[dcounter]*poses[i].channelscale[8];
-                    dcounter++;
-                }
+    UnmapIQMFile(fileDataPtr, dataSize);
 
-                animations[a].framePoses[frame][i].scale.z = poses[i].channeloffset[9];
+    return animations;
+}
 
-                if (poses[i].mask & 0x200)
-                {
-                    animations[a].framePoses[frame][i].scale.z += framedata[dcounter]*poses[i].channelscale[9];
-                    dcounter++;
-                }
+static void UnloadModelAnimationsIQMQuantized(IQMQuantizedAnimation *animations, int animCount)
+{
+    for (int a = 0; a < animCount; a++) RL_FREE(animations[a].bones);
+    RL_FREE(animations);
+}
 
-                animations[a].framePoses[frame][i].rotation = QuaternionNormalize(animations[a].framePoses[frame][i].rotation);
-            }
-        }
+// Dequantize one frame into channels, boneCount*IQM_POSE_CHANNELS floats with
+// the rotations not normalized. values holds plan.channelCount floats.
+static void DecodeIQMQuantizedFrame(const IQMQuantizedAnimation *animation, int frame, float *channels, float *values)
+{
+    DecodeIQMChannels(&animation->plan, animation->frames + (size_t)frame*animation->plan.channelCount, channels, values);
+}
 
-        // Build frameposes
-        /*
-        for (unsigned int frame = 0; frame < anim[a].num_frames; frame++)
+// Sample an animation at a frame, which may be between two frames to blend them,
+// into pose, boneCount Transforms. scratch holds IQM_QUANTIZED_SCRATCH_SIZE(boneCount) floats.
+static void SampleIQMQuantizedAnimation(const IQMQuantizedAnimation *animation, float frame, float *scratch, Transform *pose)
+{
+    const int channelsSize = animation->boneCount*IQM_POSE_CHANNELS;
+    float *channels = scratch;
+    float *nextChannels = scratch + channelsSize;
+    float *values = scratch + 2*channelsSize;
+    assert(animation->frameCount > 0);
+
+    const float whole = floorf(frame);
+    const float t = frame - whole;
+    int frame0 = (int)whole%animation->frameCount;
+    if (frame0 < 0) frame0 += animation->frameCount;
+    DecodeIQMQuantizedFrame(animation, frame0, channels, values);
+    if (t > 0.0f)
+    {
+        DecodeIQMQuantizedFrame(animation, (frame0 + 1)%animation->frameCount, nextChannels, values);
+        for (int i = 0; i < animation->boneCount; i++)
         {
-            for (int i = 0; i < animations[a].boneCount; i++)
+            float *a = channels + i*IQM_POSE_CHANNELS;
+            float *b = nextChannels + i*IQM_POSE_CHANNELS;
+
+            // Take the shorter way between the rotations
+            if (a[3]*b[3] + a[4]*b[4] + a[5]*b[5] + a[6]*b[6] < 0.0f)
             {
-                if (animations[a].bones[i].parent >= 0)
-                {
-                    animations[a].framePoses[frame][i].rotation = QuaternionMultiply(animations[a].framePoses[frame][animations[a].bones[i].parent].rotation, animations[a].framePoses[frame][i].rotation);
-                    animations[a].framePoses[frame][i].translation = Vector3RotateByQuaternion(animations[a].framePoses[frame][i].translation, animations[a].framePoses[frame][animations[a].bones[i].parent].rotation);
-                    animations[a].framePoses[frame][i].translation = Vector3Add(animations[a].framePoses[frame][i].translation, animations[a].framePoses[frame][animations[a].bones[i].parent].translation);
-                    animations[a].framePoses[frame][i].scale = Vector3Multiply(animations[a].framePoses[frame][i].scale, animations[a].framePoses[frame][animations[a].bones[i].parent].scale);
-                }
+                for (int c = 3; c < 7; c++) b[c] = -b[c];
             }
+            for (int c = 0; c < IQM_POSE_CHANNELS; c++) a[c] += (b[c] - a[c])*t;
         }
-        */
     }
 
-    UnloadFileData(fileData);
-
-    RL_FREE(joints);
-    RL_FREE(framedata);
-    RL_FREE(poses);
-    RL_FREE(anim);
-
-    return animations;
+    NormalizeIQMRotations(channels, animation->boneCount);
+    for (int i = 0; i < animation->boneCount; i++)
+    {
+        const float *c = channels + i*IQM_POSE_CHANNELS;
+        pose[i].translation = (Vector3){ c[0], c[1], c[2] };
+        pose[i].rotation = (Quaternion){ c[3], c[4], c[5], c[6] };
+        pose[i].scale = (Vector3){ c[7], c[8], c[9] };
+    }
 }
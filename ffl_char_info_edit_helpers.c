@@ -0,0 +1,151 @@
+//
+// Tracking edits to a CharInfo, for editors.
+//
+// Include this after <nn/ffl/detail/FFLiCharInfo.h>.
+//
+// Instead of comparing the whole CharInfo with the last one every frame
+// to find out whether it was edited, every change goes through
+// FFLCharInfoEdit_Set, which marks the field in a dirty mask. The editor
+// consumes the mask once per frame and only rebuilds when it is not 0,
+// so a model nobody touched costs one test. The fields in the mask also
+// decide what the rebuild refreshes (shapes, faceline, masks), see
+// GetCharInfoEditFlags in the sample.
+//
+
+#include <stddef.h>
+#include <string.h>
+
+// Fields of FFLiCharInfoParts that can be edited, in the same order
+typedef enum FFLCharInfoField
+{
+    FFL_CHAR_INFO_FIELD_FACE_TYPE,
+    FFL_CHAR_INFO_FIELD_FACELINE_COLOR,
+    FFL_CHAR_INFO_FIELD_FACE_LINE,
+    FFL_CHAR_INFO_FIELD_FACE_MAKEUP,
+    FFL_CHAR_INFO_FIELD_HAIR_TYPE,
+    FFL_CHAR_INFO_FIELD_HAIR_COLOR,
+    FFL_CHAR_INFO_FIELD_HAIR_DIR,
+    FFL_CHAR_INFO_FIELD_EYE_TYPE,
+    FFL_CHAR_INFO_FIELD_EYE_COLOR,
+    FFL_CHAR_INFO_FIELD_EYE_SCALE,
+    FFL_CHAR_INFO_FIELD_EYE_SCALE_Y,
+    FFL_CHAR_INFO_FIELD_EYE_ROTATE,
+    FFL_CHAR_INFO_FIELD_EYE_SPACING_X,
+    FFL_CHAR_INFO_FIELD_EYE_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_EYEBROW_TYPE,
+    FFL_CHAR_INFO_FIELD_EYEBROW_COLOR,
+    FFL_CHAR_INFO_FIELD_EYEBROW_SCALE,
+    FFL_CHAR_INFO_FIELD_EYEBROW_SCALE_Y,
+    FFL_CHAR_INFO_FIELD_EYEBROW_ROTATE,
+    FFL_CHAR_INFO_FIELD_EYEBROW_SPACING_X,
+    FFL_CHAR_INFO_FIELD_EYEBROW_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_NOSE_TYPE,
+    FFL_CHAR_INFO_FIELD_NOSE_SCALE,
+    FFL_CHAR_INFO_FIELD_NOSE_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_MOUTH_TYPE,
+    FFL_CHAR_INFO_FIELD_MOUTH_COLOR,
+    FFL_CHAR_INFO_FIELD_MOUTH_SCALE,
+    FFL_CHAR_INFO_FIELD_MOUTH_SCALE_Y,
+    FFL_CHAR_INFO_FIELD_MOUTH_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_MUSTACHE_TYPE,
+    FFL_CHAR_INFO_FIELD_BEARD_TYPE,
+    FFL_CHAR_INFO_FIELD_BEARD_COLOR,
+    FFL_CHAR_INFO_FIELD_MUSTACHE_SCALE,
+    FFL_CHAR_INFO_FIELD_MUSTACHE_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_GLASS_TYPE,
+    FFL_CHAR_INFO_FIELD_GLASS_COLOR,
+    FFL_CHAR_INFO_FIELD_GLASS_SCALE,
+    FFL_CHAR_INFO_FIELD_GLASS_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_MOLE_TYPE,
+    FFL_CHAR_INFO_FIELD_MOLE_SCALE,
+    FFL_CHAR_INFO_FIELD_MOLE_POSITION_X,
+    FFL_CHAR_INFO_FIELD_MOLE_POSITION_Y,
+    FFL_CHAR_INFO_FIELD_MAX
+} FFLCharInfoField;
+
+// Bit for a field in the dirty mask
+#define FFL_CHAR_INFO_FIELD_BIT(field) (1ull << (field))
+
+typedef struct FFLCharInfoEdit
+{
+    FFLiCharInfo charInfo; // edited, read it directly
+    u64 dirtyMask; // FFL_CHAR_INFO_FIELD_BIT of fields changed since FFLCharInfoEdit_Consume
+} FFLCharInfoEdit;
+
+static const u16 cFFLCharInfoFieldOffsets[FFL_CHAR_INFO_FIELD_MAX] = {
+    offsetof(FFLiCharInfoParts, faceType),
+    offsetof(FFLiCharInfoParts, facelineColor),
+    offsetof(FFLiCharInfoParts, faceLine),
+    offsetof(FFLiCharInfoParts, faceMakeup),
+    offsetof(FFLiCharInfoParts, hairType),
+    offsetof(FFLiCharInfoParts, hairColor),
+    offsetof(FFLiCharInfoParts, hairDir),
+    offsetof(FFLiCharInfoParts, eyeType),
+    offsetof(FFLiCharInfoParts, eyeColor),
+    offsetof(FFLiCharInfoParts, eyeScale),
+    offsetof(FFLiCharInfoParts, eyeScaleY),
+    offsetof(FFLiCharInfoParts, eyeRotate),
+    offsetof(FFLiCharInfoParts, eyeSpacingX),
+    offsetof(FFLiCharInfoParts, eyePositionY),
+    offsetof(FFLiCharInfoParts, eyebrowType),
+    offsetof(FFLiCharInfoParts, eyebrowColor),
+    offsetof(FFLiCharInfoParts, eyebrowScale),
+    offsetof(FFLiCharInfoParts, eyebrowScaleY),
+    offsetof(FFLiCharInfoParts, eyebrowRotate),
+    offsetof(FFLiCharInfoParts, eyebrowSpacingX),
+    offsetof(FFLiCharInfoParts, eyebrowPositionY),
+    offsetof(FFLiCharInfoParts, noseType),
+    offsetof(FFLiCharInfoParts, noseScale),
+    offsetof(FFLiCharInfoParts, nosePositionY),
+    offsetof(FFLiCharInfoParts, mouthType),
+    offsetof(FFLiCharInfoParts, mouthColor),
+    offsetof(FFLiCharInfoParts, mouthScale),
+    offsetof(FFLiCharInfoParts, mouthScaleY),
+    offsetof(FFLiCharInfoParts, mouthPositionY),
+    offsetof(FFLiCharInfoParts, mustacheType),
+    offsetof(FFLiCharInfoParts, beardType),
+    offsetof(FFLiCharInfoParts, beardColor),
+    offsetof(FFLiCharInfoParts, mustacheScale),
+    offsetof(FFLiCharInfoParts, mustachePositionY),
+    offsetof(FFLiCharInfoParts, glassType),
+    offsetof(FFLiCharInfoParts, glassColor),
+    offsetof(FFLiCharInfoParts, glassScale),
+    offsetof(FFLiCharInfoParts, glassPositionY),
+    offsetof(FFLiCharInfoParts, moleType),
+    offsetof(FFLiCharInfoParts, moleScale),
+    offsetof(FFLiCharInfoParts, molePositionX),
+    offsetof(FFLiCharInfoParts, molePositionY),
+};
+
+// Start editing a copy of pCharInfo, nothing is dirty
+void FFLCharInfoEdit_Initialize(FFLCharInfoEdit* self, const FFLiCharInfo* pCharInfo)
+{
+    memcpy(&self->charInfo, pCharInfo, sizeof(FFLiCharInfo));
+    self->dirtyMask = 0;
+}
+
+s32 FFLCharInfoEdit_Get(const FFLCharInfoEdit* self, FFLCharInfoField field)
+{
+    assert(field < FFL_CHAR_INFO_FIELD_MAX);
+    return *(const s32*)((const u8*)&self->charInfo.parts + cFFLCharInfoFieldOffsets[field]);
+}
+
+// Set a field, and mark it dirty if the value changed. Returns whether it did.
+bool FFLCharInfoEdit_Set(FFLCharInfoEdit* self, FFLCharInfoField field, s32 value)
+{
+    assert(field < FFL_CHAR_INFO_FIELD_MAX);
+    s32* pValue = (s32*)((u8*)&self->charInfo.parts + cFFLCharInfoFieldOffsets[field]);
+    if (*pValue == value)
+        return false;
+    *pValue = value;
+    self->dirtyMask |= FFL_CHAR_INFO_FIELD_BIT(field);
+    return true;
+}
+
+// Get the fields changed since the last call and clear them, 0 if none
+u64 FFLCharInfoEdit_Consume(FFLCharInfoEdit* self)
+{
+    const u64 dirtyMask = self->dirtyMask;
+    self->dirtyMask = 0;
+    return dirtyMask;
+}
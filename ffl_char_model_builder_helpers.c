@@ -0,0 +1,489 @@
+//
+// Building CharModels on a worker thread, for editors.
+//
+// Include this after <nn/ffl.h>, <nn/ffl/detail/FFLiCharInfo.h> and raylib.h.
+//
+// FFLInitCharModelCPUStep decodes the shapes and textures of every part,
+// which takes long enough to drop a frame when it runs each time a value
+// is edited. FFLCharModelBuilder runs it on a worker thread into a staging
+// CharModel, and the main thread only picks up the finished model to create
+// its textures, draw its faceline and masks and swap it in.
+//
+// One model is built at a time. Requests made while one is being built
+// replace each other, so only the latest is built next.
+//
+// FFLCharModelPipeline does the same for a list of StoreData, for batch
+// rendering: the worker builds up to FFL_CHAR_MODEL_PIPELINE_DEPTH
+// models ahead of the one the main thread is drawing. There is a single
+// worker since FFL keeps shared state while loading parts, so two
+// CharModels cannot be built at the same time. FFL does not say which of
+// that state drawing and deleting CharModels use, so the worker builds
+// with the pipeline's FFL lock held, and the main thread takes it around
+// its own FFL calls, see FFLCharModelPipeline_LockFFL. Only the work
+// outside of FFL overlaps with building: creating textures, GL and
+// reading back and encoding images.
+//
+// The worker has no GL context, so the textures that FFL creates while
+// building are recorded along with a copy of their images, and created on
+// the main thread when the model is picked up. That needs FFL to create
+// textures through the texture callback (FFL_USE_TEXTURE_CALLBACK), and
+// pthreads. Otherwise FFL_CHAR_MODEL_BUILDER_USE_THREAD is not defined
+// and CharModels have to be built on the main thread as before.
+//
+// The texture callback finds the list to record them in with
+// FFLDeferredTextureList_GetCurrent, which is only set on the worker.
+//
+// While FFLCharModelBuilder builds a model, the main thread must not call
+// FFL functions that load resources, like FFLInitCharModelCPUStep. It
+// keeps drawing and deleting the models it already has, since waiting
+// for the worker would drop the frames that the builder is there to keep.
+//
+
+#if defined(FFL_USE_TEXTURE_CALLBACK) && !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #define FFL_CHAR_MODEL_BUILDER_USE_THREAD
+#endif
+
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+
+#include <pthread.h>
+#include <string.h>
+
+#include <nn/ffl/FFLiCharModel.h> // pTextureTempObject, for models that are not picked up
+#include <nn/ffl/FFLiFacelineTexture.h> // FFLiDeleteTempObjectFacelineTexture
+#include <nn/ffl/FFLiMaskTextures.h> // FFLiDeleteTempObjectMaskTextures
+
+// A texture that FFL created on the worker thread
+typedef struct FFLDeferredTexture
+{
+    FFLTextureInfo info; // imagePtr and mipPtr point to copies
+    FFLTexture* pTexture; // where the texture callback writes the texture
+    bool isDeleted; // deleted by FFL before it was created
+} FFLDeferredTexture;
+
+// Textures created while building one CharModel
+typedef struct FFLDeferredTextureList
+{
+    FFLDeferredTexture* textures;
+    int count;
+    int capacity;
+} FFLDeferredTextureList;
+
+// Set on the worker thread while it builds a model
+static _Thread_local FFLDeferredTextureList* sCurrentDeferredTextureList = NULL;
+
+// For the texture callback: the list to record textures in instead of
+// creating them, or NULL when they can be created on this thread
+FFLDeferredTextureList* FFLDeferredTextureList_GetCurrent(void)
+{
+    return sCurrentDeferredTextureList;
+}
+
+// Record a texture that FFL creates, from the texture callback
+void FFLDeferredTextureList_PushCreate(FFLDeferredTextureList* self,
+    const FFLTextureInfo* pTextureInfo, FFLTexture* pTexture)
+{
+    if (self->count == self->capacity)
+    {
+        self->capacity = self->capacity ? self->capacity * 2 : 16;
+        self->textures = (FFLDeferredTexture*)RL_REALLOC(self->textures,
+            self->capacity * sizeof(FFLDeferredTexture));
+    }
+    FFLDeferredTexture* pDeferred = &self->textures[self->count++];
+    pDeferred->info = *pTextureInfo;
+    pDeferred->pTexture = pTexture;
+    pDeferred->isDeleted = false;
+
+    // The images may be freed or reused before the main thread creates
+    // the texture, so copy them, mips after the image in one allocation
+    const u32 mipSize = pTextureInfo->mipPtr != NULL ? pTextureInfo->mipSize : 0;
+    u8* pCopy = (u8*)RL_MALLOC(pTextureInfo->imageSize + mipSize);
+    memcpy(pCopy, pTextureInfo->imagePtr, pTextureInfo->imageSize);
+    if (mipSize != 0)
+        memcpy(pCopy + pTextureInfo->imageSize, pTextureInfo->mipPtr, mipSize);
+    pDeferred->info.imagePtr = pCopy;
+    pDeferred->info.mipPtr = mipSize != 0 ? pCopy + pTextureInfo->imageSize : NULL;
+}
+
+// Record that FFL deleted a texture, which only happens when building
+// fails. Returns false if it was not recorded in this list.
+bool FFLDeferredTextureList_PushDelete(FFLDeferredTextureList* self, FFLTexture* pTexture)
+{
+    for (int i = 0; i < self->count; i++)
+    {
+        if (self->textures[i].pTexture == pTexture && !self->textures[i].isDeleted)
+        {
+            self->textures[i].isDeleted = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Create the recorded textures with the texture callback on the main thread, and clear the list
+void FFLDeferredTextureList_Create(FFLDeferredTextureList* self, const FFLTextureCallback* pCallback)
+{
+    for (int i = 0; i < self->count; i++)
+    {
+        FFLDeferredTexture* pDeferred = &self->textures[i];
+        if (!pDeferred->isDeleted)
+            pCallback->pCreateFunc(pCallback->pObj, &pDeferred->info, pDeferred->pTexture);
+        RL_FREE(pDeferred->info.imagePtr); // mips are in the same allocation
+    }
+    TraceLog(LOG_DEBUG, "Created %d deferred textures", self->count);
+    self->count = 0;
+}
+
+// Free the recorded images without creating the textures, and clear the list
+void FFLDeferredTextureList_Drop(FFLDeferredTextureList* self)
+{
+    for (int i = 0; i < self->count; i++)
+        RL_FREE(self->textures[i].info.imagePtr); // mips are in the same allocation
+    TraceLog(LOG_DEBUG, "Dropped %d deferred textures", self->count);
+    self->count = 0;
+}
+
+// Free the list, after FFLDeferredTextureList_Create or _Drop
+void FFLDeferredTextureList_Destroy(FFLDeferredTextureList* self)
+{
+    assert(self->count == 0); // not created or dropped
+    RL_FREE(self->textures);
+    self->textures = NULL;
+    self->capacity = 0;
+}
+
+// Build a CharModel on the worker, recording its textures in pTextures
+static FFLResult FFLDeferredTextureList_InitCharModelCPUStep(FFLDeferredTextureList* pTextures,
+    FFLCharModel* pModel, const FFLCharModelSource* pSource, const FFLCharModelDesc* pDesc)
+{
+    sCurrentDeferredTextureList = pTextures;
+    const FFLResult result = FFLInitCharModelCPUStep(pModel, pSource, pDesc);
+    sCurrentDeferredTextureList = NULL;
+    return result;
+}
+
+// Delete a model that was built on the worker and never picked up, on the main thread.
+// Like InitCharModelTextures and DeleteCharModelMaskDrawParams, the temp objects
+// for the faceline and masks are deleted before the model. None of its textures
+// were created, so deleting them is recorded in pTextures, which is then dropped.
+static void FFLDeferredTextureList_DeleteCharModel(FFLDeferredTextureList* pTextures, FFLCharModel* pModel)
+{
+    FFLiCharModel* piCharModel = (FFLiCharModel*)pModel;
+    sCurrentDeferredTextureList = pTextures;
+    if (piCharModel->pTextureTempObject != NULL)
+    {
+        void** ppFacelineTexture2D = (void*)&piCharModel->facelineRenderTexture; // HACK: FFLiRenderTexture = FFLTexture**
+        if (*ppFacelineTexture2D != NULL)
+            FFLiDeleteTempObjectFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture, &piCharModel->charInfo, piCharModel->charModelDesc.resourceType);
+        FFLiDeleteTempObjectMaskTextures(&piCharModel->pTextureTempObject->maskTextures, piCharModel->charModelDesc.allExpressionFlag, piCharModel->charModelDesc.resourceType);
+        FFLiDeleteTextureTempObject(piCharModel);
+        piCharModel->pTextureTempObject = NULL;
+    }
+    FFLDeleteCharModel(pModel);
+    sCurrentDeferredTextureList = NULL;
+    FFLDeferredTextureList_Drop(pTextures);
+}
+
+// ------------------------------------------------------------------
+// Builder, for editors
+// ------------------------------------------------------------------
+
+typedef struct FFLCharModelBuilder
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signaled when any of the flags below change
+
+    // Protected by mutex
+    FFLiCharInfo pendingCharInfo;
+    FFLCharModelDesc pendingDesc;
+    bool hasPending; // requested and not started
+    bool isBuilding;
+    bool isBuilt; // stagingModel is waiting for FFLCharModelBuilder_Poll
+    bool shouldExit;
+    FFLResult result; // of the model that was built
+
+    // Only used by the worker while building,
+    // and by the main thread while isBuilt is set
+    FFLCharModel stagingModel;
+    FFLDeferredTextureList textures;
+} FFLCharModelBuilder;
+
+static void* FFLCharModelBuilder_Run(void* pArg)
+{
+    FFLCharModelBuilder* self = (FFLCharModelBuilder*)pArg;
+    pthread_mutex_lock(&self->mutex);
+    for (;;)
+    {
+        // Wait until the last model was picked up, so there is one staging model
+        while (!self->shouldExit && !(self->hasPending && !self->isBuilt))
+            pthread_cond_wait(&self->cond, &self->mutex);
+        if (self->shouldExit)
+            break;
+
+        FFLiCharInfo charInfo;
+        memcpy(&charInfo, &self->pendingCharInfo, sizeof(FFLiCharInfo));
+        const FFLCharModelDesc desc = self->pendingDesc;
+        self->hasPending = false;
+        self->isBuilding = true;
+        pthread_mutex_unlock(&self->mutex);
+
+        FFLCharModelSource source = {
+            .dataSource = FFL_DATA_SOURCE_BUFFER,
+            .pBuffer = &charInfo,
+            .index = 0
+        };
+        const FFLResult result = FFLDeferredTextureList_InitCharModelCPUStep(&self->textures,
+            &self->stagingModel, &source, &desc);
+
+        pthread_mutex_lock(&self->mutex);
+        self->result = result;
+        self->isBuilding = false;
+        self->isBuilt = true;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+// Starts the worker thread, returns false if it could not be started
+bool FFLCharModelBuilder_Initialize(FFLCharModelBuilder* self)
+{
+    memset(self, 0, sizeof(FFLCharModelBuilder));
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    if (pthread_create(&self->thread, NULL, FFLCharModelBuilder_Run, self) != 0)
+    {
+        TraceLog(LOG_ERROR, "Cannot start the CharModel builder thread");
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->mutex);
+        return false;
+    }
+    return true;
+}
+
+// Build a CharModel from pCharInfo, replacing the request that has not started yet
+void FFLCharModelBuilder_Request(FFLCharModelBuilder* self, const FFLiCharInfo* pCharInfo, const FFLCharModelDesc* pDesc)
+{
+    pthread_mutex_lock(&self->mutex);
+    if (self->hasPending)
+        TraceLog(LOG_DEBUG, "CharModel builder: replacing the pending request");
+    memcpy(&self->pendingCharInfo, pCharInfo, sizeof(FFLiCharInfo));
+    self->pendingDesc = *pDesc;
+    self->hasPending = true;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+// Whether a request is waiting, being built or has not been picked up
+bool FFLCharModelBuilder_IsBusy(FFLCharModelBuilder* self)
+{
+    pthread_mutex_lock(&self->mutex);
+    const bool isBusy = self->hasPending || self->isBuilding || self->isBuilt;
+    pthread_mutex_unlock(&self->mutex);
+    return isBusy;
+}
+
+// Call on the main thread, each frame. If a model was built, creates its
+// textures with pCallback, moves it to pOutModel and returns true. It is
+// only valid if *pResult is FFL_RESULT_OK, then the caller owns it.
+bool FFLCharModelBuilder_Poll(FFLCharModelBuilder* self, const FFLTextureCallback* pCallback,
+    FFLCharModel* pOutModel, FFLResult* pResult)
+{
+    pthread_mutex_lock(&self->mutex);
+    const bool isBuilt = self->isBuilt;
+    pthread_mutex_unlock(&self->mutex);
+    if (!isBuilt)
+        return false;
+
+    // The worker waits for isBuilt to be cleared, so this is not shared
+    FFLDeferredTextureList_Create(&self->textures, pCallback);
+    memcpy(pOutModel, &self->stagingModel, sizeof(FFLCharModel));
+
+    pthread_mutex_lock(&self->mutex);
+    *pResult = self->result;
+    self->isBuilt = false;
+    pthread_cond_broadcast(&self->cond); // the next request can start
+    pthread_mutex_unlock(&self->mutex);
+    return true;
+}
+
+// Stop the worker thread after the model it is building, and delete a model
+// that was built and not picked up, without creating its textures
+void FFLCharModelBuilder_Finalize(FFLCharModelBuilder* self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->shouldExit = true;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->thread, NULL);
+
+    // The worker has stopped, so the staging model is not shared
+    if (self->isBuilt)
+    {
+        if (self->result == FFL_RESULT_OK)
+            FFLDeferredTextureList_DeleteCharModel(&self->textures, &self->stagingModel);
+        else
+            FFLDeferredTextureList_Drop(&self->textures);
+        self->isBuilt = false;
+    }
+
+    FFLDeferredTextureList_Destroy(&self->textures);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+    memset(self, 0, sizeof(FFLCharModelBuilder));
+}
+
+// ------------------------------------------------------------------
+// Pipeline, for batches
+// ------------------------------------------------------------------
+
+#define FFL_CHAR_MODEL_PIPELINE_DEPTH 4 // models built ahead
+
+typedef struct FFLCharModelPipelineSlot
+{
+    FFLCharModel model;
+    FFLResult result;
+    FFLDeferredTextureList textures;
+} FFLCharModelPipelineSlot;
+
+typedef struct FFLCharModelPipeline
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signaled when builtCount changes or on exit
+    pthread_mutex_t fflMutex; // held around FFL calls on either thread
+
+    const u8* pStoreData; // count StoreData of storeDataSize bytes each
+    u32 storeDataSize;
+    u32 count;
+    FFLCharModelDesc desc;
+
+    FFLCharModelPipelineSlot slots[FFL_CHAR_MODEL_PIPELINE_DEPTH];
+    u32 readIndex; // next one for FFLCharModelPipeline_Next, in slot readIndex % depth
+    u32 builtCount; // built after readIndex, protected by mutex
+    bool shouldExit; // protected by mutex
+} FFLCharModelPipeline;
+
+static void* FFLCharModelPipeline_Run(void* pArg)
+{
+    FFLCharModelPipeline* self = (FFLCharModelPipeline*)pArg;
+    for (u32 index = 0; index < self->count; index++)
+    {
+        pthread_mutex_lock(&self->mutex);
+        while (!self->shouldExit && self->builtCount == FFL_CHAR_MODEL_PIPELINE_DEPTH)
+            pthread_cond_wait(&self->cond, &self->mutex);
+        const bool shouldExit = self->shouldExit;
+        pthread_mutex_unlock(&self->mutex);
+        if (shouldExit)
+            break;
+
+        // Not used by the main thread until builtCount includes it
+        FFLCharModelPipelineSlot* pSlot = &self->slots[index % FFL_CHAR_MODEL_PIPELINE_DEPTH];
+        FFLCharModelSource source = {
+            .dataSource = FFL_DATA_SOURCE_STORE_DATA,
+            .pBuffer = self->pStoreData + (size_t)index * self->storeDataSize,
+            .index = 0
+        };
+        pthread_mutex_lock(&self->fflMutex);
+        pSlot->result = FFLDeferredTextureList_InitCharModelCPUStep(&pSlot->textures,
+            &pSlot->model, &source, &self->desc);
+        pthread_mutex_unlock(&self->fflMutex);
+
+        pthread_mutex_lock(&self->mutex);
+        self->builtCount++;
+        pthread_cond_broadcast(&self->cond);
+        pthread_mutex_unlock(&self->mutex);
+    }
+    return NULL;
+}
+
+// Start building count CharModels from pStoreData, which must stay valid
+// until FFLCharModelPipeline_Finalize. Returns false if the worker could not start.
+bool FFLCharModelPipeline_Initialize(FFLCharModelPipeline* self, const void* pStoreData,
+    u32 storeDataSize, u32 count, const FFLCharModelDesc* pDesc)
+{
+    memset(self, 0, sizeof(FFLCharModelPipeline));
+    self->pStoreData = (const u8*)pStoreData;
+    self->storeDataSize = storeDataSize;
+    self->count = count;
+    self->desc = *pDesc;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    pthread_mutex_init(&self->fflMutex, NULL);
+    if (pthread_create(&self->thread, NULL, FFLCharModelPipeline_Run, self) != 0)
+    {
+        TraceLog(LOG_ERROR, "Cannot start the CharModel pipeline thread");
+        pthread_mutex_destroy(&self->fflMutex);
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->mutex);
+        return false;
+    }
+    return true;
+}
+
+// Wait for the next CharModel, create its textures with pCallback and move it
+// to pOutModel. Returns false after the last one. pOutModel is only valid,
+// and owned by the caller, if *pResult is FFL_RESULT_OK.
+bool FFLCharModelPipeline_Next(FFLCharModelPipeline* self, const FFLTextureCallback* pCallback,
+    FFLCharModel* pOutModel, FFLResult* pResult, u32* pIndex)
+{
+    if (self->readIndex == self->count)
+        return false;
+
+    pthread_mutex_lock(&self->mutex);
+    while (self->builtCount == 0)
+        pthread_cond_wait(&self->cond, &self->mutex);
+    pthread_mutex_unlock(&self->mutex);
+
+    FFLCharModelPipelineSlot* pSlot = &self->slots[self->readIndex % FFL_CHAR_MODEL_PIPELINE_DEPTH];
+    FFLDeferredTextureList_Create(&pSlot->textures, pCallback);
+    memcpy(pOutModel, &pSlot->model, sizeof(FFLCharModel));
+    *pResult = pSlot->result;
+    *pIndex = self->readIndex++;
+
+    pthread_mutex_lock(&self->mutex);
+    self->builtCount--; // the worker can build into this slot again
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    return true;
+}
+
+// Hold while the main thread calls FFL, drawing or deleting CharModels
+// included, so that it does not run while the worker is building
+void FFLCharModelPipeline_LockFFL(FFLCharModelPipeline* self)
+{
+    pthread_mutex_lock(&self->fflMutex);
+}
+
+void FFLCharModelPipeline_UnlockFFL(FFLCharModelPipeline* self)
+{
+    pthread_mutex_unlock(&self->fflMutex);
+}
+
+// Stop the worker, and delete the models that were built and not picked up,
+// without creating their textures
+void FFLCharModelPipeline_Finalize(FFLCharModelPipeline* self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->shouldExit = true;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->thread, NULL);
+
+    // Nothing else is built now
+    for (; self->builtCount != 0; self->builtCount--)
+    {
+        FFLCharModelPipelineSlot* pSlot = &self->slots[self->readIndex++ % FFL_CHAR_MODEL_PIPELINE_DEPTH];
+        if (pSlot->result == FFL_RESULT_OK)
+            FFLDeferredTextureList_DeleteCharModel(&pSlot->textures, &pSlot->model);
+        else
+            FFLDeferredTextureList_Drop(&pSlot->textures);
+    }
+    for (int i = 0; i < FFL_CHAR_MODEL_PIPELINE_DEPTH; i++)
+        FFLDeferredTextureList_Destroy(&self->slots[i].textures);
+    pthread_mutex_destroy(&self->fflMutex);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+}
+
+#endif // FFL_CHAR_MODEL_BUILDER_USE_THREAD
@@ -0,0 +1,274 @@
+//
+// Faceline and mask textures shared between CharModels.
+//
+// Include this after ffl_texture_atlas_helpers.c and
+// <nn/ffl/detail/FFLiCharInfo.h>.
+//
+// A faceline texture only depends on a few parts of the CharInfo
+// (faceline, makeup, wrinkles, beard and their colors), and a mask only
+// on the eye, eyebrow, mouth, mustache and mole parts and the expression.
+// Many Miis share those, so each texture is looked up by a key made of
+// just those fields before it is drawn, and drawn once for all of them.
+//
+// Textures are counted by the CharModels that use them. Ones that are
+// not used by any are kept in least recently used order until the
+// textures take more than the budget, so that a mask drawn for one
+// expression can be used again without drawing it.
+//
+
+#include <string.h>
+
+// Bytes of textures kept before unused ones are freed.
+// Textures that are used are never freed, so this can be exceeded.
+#define FFL_CHAR_MODEL_TEXTURE_CACHE_BUDGET_DEFAULT (8 * 1024 * 1024) // 8 masks at 512x512
+#define FFL_CHAR_MODEL_TEXTURE_CACHE_BUCKET_COUNT 256 // power of two
+
+// Kind in FFLCharModelTextureKey for the faceline,
+// masks use their FFLExpression instead
+#define FFL_CHAR_MODEL_TEXTURE_KIND_FACELINE -1
+
+// Every field that the texture depends on, compared as a whole.
+typedef struct FFLCharModelTextureKey
+{
+    s32 kind; // FFL_CHAR_MODEL_TEXTURE_KIND_FACELINE or FFLExpression
+    s32 resolution;
+    s32 resourceType;
+    s32 parts[27]; // unused ones are 0
+} FFLCharModelTextureKey;
+
+typedef struct FFLCharModelTexture
+{
+    FFLCharModelTextureKey key;
+    u32 hash;
+    FFLTextureAtlasRegion region;
+    int refCount; // CharModels using this, in the unused list when 0
+    struct FFLCharModelTexture* pNextInBucket;
+    // Unused list, only linked while refCount is 0
+    struct FFLCharModelTexture* pPrev; // more recently used
+    struct FFLCharModelTexture* pNext; // less recently used
+} FFLCharModelTexture;
+
+// Textures shared or drawn since the cache was initialized
+typedef struct FFLCharModelTextureCacheStats
+{
+    int shared;
+    int drawn;
+} FFLCharModelTextureCacheStats;
+
+typedef struct FFLCharModelTextureCache
+{
+    FFLTextureAtlas* pAtlas; // regions are allocated here
+    FFLCharModelTexture* buckets[FFL_CHAR_MODEL_TEXTURE_CACHE_BUCKET_COUNT];
+    FFLCharModelTexture* pUnusedHead; // most recently used
+    FFLCharModelTexture* pUnusedTail; // least recently used
+    u32 usedSize; // bytes of every texture, used or not
+    u32 budget; // in bytes
+    FFLCharModelTextureCacheStats stats;
+} FFLCharModelTextureCache;
+
+void FFLCharModelTextureKey_InitFaceline(FFLCharModelTextureKey* self, const FFLiCharInfo* pCharInfo,
+    int resolution, FFLResourceType resourceType)
+{
+    memset(self, 0, sizeof(FFLCharModelTextureKey));
+    self->kind = FFL_CHAR_MODEL_TEXTURE_KIND_FACELINE;
+    self->resolution = resolution;
+    self->resourceType = resourceType;
+
+    const FFLiCharInfoParts* pParts = &pCharInfo->parts;
+    s32* pValue = self->parts;
+    *pValue++ = pParts->faceType;
+    *pValue++ = pParts->facelineColor;
+    *pValue++ = pParts->faceLine;
+    *pValue++ = pParts->faceMakeup;
+    *pValue++ = pParts->beardType;
+    *pValue++ = pParts->beardColor;
+}
+
+void FFLCharModelTextureKey_InitMask(FFLCharModelTextureKey* self, const FFLiCharInfo* pCharInfo,
+    FFLExpression expression, int resolution, FFLResourceType resourceType)
+{
+    memset(self, 0, sizeof(FFLCharModelTextureKey));
+    self->kind = (s32)expression;
+    self->resolution = resolution;
+    self->resourceType = resourceType;
+
+    const FFLiCharInfoParts* pParts = &pCharInfo->parts;
+    s32* pValue = self->parts;
+    *pValue++ = pParts->eyeType;
+    *pValue++ = pParts->eyeColor;
+    *pValue++ = pParts->eyeScale;
+    *pValue++ = pParts->eyeScaleY;
+    *pValue++ = pParts->eyeRotate;
+    *pValue++ = pParts->eyeSpacingX;
+    *pValue++ = pParts->eyePositionY;
+    *pValue++ = pParts->eyebrowType;
+    *pValue++ = pParts->eyebrowColor;
+    *pValue++ = pParts->eyebrowScale;
+    *pValue++ = pParts->eyebrowScaleY;
+    *pValue++ = pParts->eyebrowRotate;
+    *pValue++ = pParts->eyebrowSpacingX;
+    *pValue++ = pParts->eyebrowPositionY;
+    *pValue++ = pParts->mouthType;
+    *pValue++ = pParts->mouthColor;
+    *pValue++ = pParts->mouthScale;
+    *pValue++ = pParts->mouthScaleY;
+    *pValue++ = pParts->mouthPositionY;
+    *pValue++ = pParts->mustacheType;
+    *pValue++ = pParts->beardColor; // of the mustache too
+    *pValue++ = pParts->mustacheScale;
+    *pValue++ = pParts->mustachePositionY;
+    *pValue++ = pParts->moleType;
+    *pValue++ = pParts->moleScale;
+    *pValue++ = pParts->molePositionX;
+    *pValue++ = pParts->molePositionY;
+}
+
+// FNV-1a
+static u32 FFLCharModelTextureKey_Hash(const FFLCharModelTextureKey* self)
+{
+    const u8* pBytes = (const u8*)self;
+    u32 hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(FFLCharModelTextureKey); i++)
+    {
+        hash ^= pBytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static u32 FFLCharModelTexture_GetSize(const FFLCharModelTexture* self)
+{
+    return (u32)(self->region.width * self->region.height) * 4; // RGBA8
+}
+
+// Region of a texture, or one with texture 0 for NULL
+const FFLTextureAtlasRegion* FFLCharModelTexture_GetRegion(const FFLCharModelTexture* self)
+{
+    static const FFLTextureAtlasRegion cEmptyRegion = { .texCoordTransform = { 1.0f, 1.0f, 0.0f, 0.0f } };
+    return self != NULL ? &self->region : &cEmptyRegion;
+}
+
+void FFLCharModelTextureCache_Initialize(FFLCharModelTextureCache* self, FFLTextureAtlas* pAtlas, u32 budget)
+{
+    memset(self, 0, sizeof(FFLCharModelTextureCache));
+    self->pAtlas = pAtlas;
+    self->budget = budget;
+}
+
+static void FFLCharModelTextureCache_RemoveUnused(FFLCharModelTextureCache* self, FFLCharModelTexture* pTexture)
+{
+    if (pTexture->pPrev != NULL)
+        pTexture->pPrev->pNext = pTexture->pNext;
+    else
+        self->pUnusedHead = pTexture->pNext;
+    if (pTexture->pNext != NULL)
+        pTexture->pNext->pPrev = pTexture->pPrev;
+    else
+        self->pUnusedTail = pTexture->pPrev;
+    pTexture->pPrev = NULL;
+    pTexture->pNext = NULL;
+}
+
+// Free an unused texture and remove it from its bucket
+static void FFLCharModelTextureCache_Delete(FFLCharModelTextureCache* self, FFLCharModelTexture* pTexture)
+{
+    FFLCharModelTexture** ppLink = &self->buckets[pTexture->hash & (FFL_CHAR_MODEL_TEXTURE_CACHE_BUCKET_COUNT - 1)];
+    while (*ppLink != pTexture)
+        ppLink = &(*ppLink)->pNextInBucket;
+    *ppLink = pTexture->pNextInBucket;
+
+    self->usedSize -= FFLCharModelTexture_GetSize(pTexture);
+    FFLTextureAtlas_Free(self->pAtlas, &pTexture->region);
+    RL_FREE(pTexture);
+}
+
+// Free the least recently used unused textures until size more bytes fit
+static void FFLCharModelTextureCache_Evict(FFLCharModelTextureCache* self, u32 size)
+{
+    while (self->pUnusedTail != NULL && self->usedSize + size > self->budget)
+    {
+        FFLCharModelTexture* pTexture = self->pUnusedTail;
+        TraceLog(LOG_DEBUG, "Evicting CharModel texture of kind %d at %d, %d in texture ID %d",
+            pTexture->key.kind, pTexture->region.x, pTexture->region.y, pTexture->region.texture);
+        FFLCharModelTextureCache_RemoveUnused(self, pTexture);
+        FFLCharModelTextureCache_Delete(self, pTexture);
+    }
+}
+
+// Use a texture that was already drawn for the same key,
+// returns NULL if there is none and it has to be added and drawn
+FFLCharModelTexture* FFLCharModelTextureCache_Acquire(FFLCharModelTextureCache* self, const FFLCharModelTextureKey* pKey)
+{
+    const u32 hash = FFLCharModelTextureKey_Hash(pKey);
+    FFLCharModelTexture* pTexture = self->buckets[hash & (FFL_CHAR_MODEL_TEXTURE_CACHE_BUCKET_COUNT - 1)];
+    for (; pTexture != NULL; pTexture = pTexture->pNextInBucket)
+    {
+        if (pTexture->hash == hash && memcmp(&pTexture->key, pKey, sizeof(FFLCharModelTextureKey)) == 0)
+            break;
+    }
+    if (pTexture == NULL)
+        return NULL;
+
+    if (pTexture->refCount++ == 0)
+        FFLCharModelTextureCache_RemoveUnused(self, pTexture);
+    self->stats.shared++;
+    return pTexture;
+}
+
+// Add a texture of width by height pixels for a key that Acquire did not
+// find, the caller draws it into its region. Returns NULL if it does not fit.
+FFLCharModelTexture* FFLCharModelTextureCache_Add(FFLCharModelTextureCache* self, const FFLCharModelTextureKey* pKey,
+    int width, int height)
+{
+    FFLCharModelTextureCache_Evict(self, (u32)(width * height) * 4);
+
+    FFLCharModelTexture* pTexture = (FFLCharModelTexture*)RL_MALLOC(sizeof(FFLCharModelTexture));
+    memset(pTexture, 0, sizeof(FFLCharModelTexture));
+    if (!FFLTextureAtlas_Allocate(self->pAtlas, width, height, &pTexture->region))
+    {
+        RL_FREE(pTexture);
+        return NULL;
+    }
+    memcpy(&pTexture->key, pKey, sizeof(FFLCharModelTextureKey));
+    pTexture->hash = FFLCharModelTextureKey_Hash(pKey);
+    pTexture->refCount = 1;
+
+    FFLCharModelTexture** ppBucket = &self->buckets[pTexture->hash & (FFL_CHAR_MODEL_TEXTURE_CACHE_BUCKET_COUNT - 1)];
+    pTexture->pNextInBucket = *ppBucket;
+    *ppBucket = pTexture;
+    self->usedSize += FFLCharModelTexture_GetSize(pTexture);
+    self->stats.drawn++;
+    return pTexture;
+}
+
+// Stop using a texture from Acquire or Add, pTexture can be NULL.
+// It is kept until it is evicted, in case it is used again.
+void FFLCharModelTextureCache_Release(FFLCharModelTextureCache* self, FFLCharModelTexture* pTexture)
+{
+    if (pTexture == NULL)
+        return;
+    assert(pTexture->refCount > 0);
+    if (--pTexture->refCount != 0)
+        return;
+
+    pTexture->pPrev = NULL;
+    pTexture->pNext = self->pUnusedHead;
+    if (self->pUnusedHead != NULL)
+        self->pUnusedHead->pPrev = pTexture;
+    else
+        self->pUnusedTail = pTexture;
+    self->pUnusedHead = pTexture;
+    FFLCharModelTextureCache_Evict(self, 0);
+}
+
+// Free every texture, all of them must have been released
+void FFLCharModelTextureCache_Destroy(FFLCharModelTextureCache* self)
+{
+    while (self->pUnusedTail != NULL)
+    {
+        FFLCharModelTexture* pTexture = self->pUnusedTail;
+        FFLCharModelTextureCache_RemoveUnused(self, pTexture);
+        FFLCharModelTextureCache_Delete(self, pTexture);
+    }
+    assert(self->usedSize == 0); // not released
+}
@@ -0,0 +1,499 @@
+//
+// GPU object caches for the FFL shader callback.
+//
+// Include this after the OpenGL headers and <nn/ffl.h>,
+// the same way body_scale_helpers_iqm.c is included.
+//
+
+#include <stdint.h>
+#include <string.h>
+
+// ------------------------------------------------------------------
+// Buffer cache
+// ------------------------------------------------------------------
+
+//
+// FFL hands the draw callback CPU pointers for each attribute buffer.
+// The buffers for a CharModel's shapes never change after
+// FFLInitCharModelCPUStep, so they are uploaded once and the buffer
+// object is reused for every later draw of that shape.
+//
+// Entries are keyed on (owner, pointer, size, stride), where owner is
+// the FFLCharModel the data belongs to. Index buffers use a stride of 0. The owner's entries MUST be
+// invalidated (or rekeyed, see FFLGLBufferCache_RekeyOwner) before its buffers
+// are freed or replaced (UpdateCharModel, FFLDeleteCharModel), since the same
+// pointer may be handed out again.
+//
+
+#define FFL_GL_BUFFER_CACHE_INITIAL_CAPACITY 256 // must be a power of two
+
+typedef enum FFLGLBufferCacheSlotState
+{
+    FFL_GL_BUFFER_CACHE_SLOT_EMPTY = 0,
+    FFL_GL_BUFFER_CACHE_SLOT_USED,
+    FFL_GL_BUFFER_CACHE_SLOT_DELETED // tombstone, keeps probe chains intact
+} FFLGLBufferCacheSlotState;
+
+struct FFLGLShape; // see below
+
+typedef struct FFLGLBufferCacheEntry
+{
+    const void* owner;
+    const void* ptr;
+    u32 size;
+    u32 stride;
+    GLuint handle;
+    u8 state; // FFLGLBufferCacheSlotState
+    struct FFLGLShape* pShape; // only for index buffers, NULL until baked
+} FFLGLBufferCacheEntry;
+
+// Counted since the last FFLGLBufferCache_ResetStats, usually once per frame.
+typedef struct FFLGLBufferCacheStats
+{
+    int created; // glGenBuffers calls
+    int reused;  // binds that would have created a buffer before
+} FFLGLBufferCacheStats;
+
+typedef struct FFLGLBufferCache
+{
+    FFLGLBufferCacheEntry* entries;
+    int capacity; // power of two, 0 if not allocated
+    int usedCount;
+    int deletedCount;
+    FFLGLBufferCacheStats stats;
+} FFLGLBufferCache;
+
+static u32 FFLGLBufferCache_Hash(const void* owner, const void* ptr, u32 size, u32 stride)
+{
+    // murmur3 finalizer over the folded key
+    uint64_t k = (uint64_t)(uintptr_t)ptr ^ ((uint64_t)(uintptr_t)owner << 1);
+    u32 h = (u32)k ^ (u32)(k >> 32) ^ (size * 0x9E3779B1u) ^ stride;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h;
+}
+
+void FFLGLBufferCache_Initialize(FFLGLBufferCache* self)
+{
+    memset(self, 0, sizeof(FFLGLBufferCache));
+}
+
+// Inserts without checking for an existing entry, used when rehashing.
+static FFLGLBufferCacheEntry* FFLGLBufferCache_InsertSlot(FFLGLBufferCacheEntry* entries, int capacity,
+    const void* owner, const void* ptr, u32 size, u32 stride)
+{
+    const u32 mask = (u32)capacity - 1;
+    u32 i = FFLGLBufferCache_Hash(owner, ptr, size, stride) & mask;
+    while (entries[i].state == FFL_GL_BUFFER_CACHE_SLOT_USED)
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+static void FFLGLBufferCache_Rehash(FFLGLBufferCache* self, int newCapacity)
+{
+    FFLGLBufferCacheEntry* newEntries = (FFLGLBufferCacheEntry*)RL_CALLOC(newCapacity, sizeof(FFLGLBufferCacheEntry));
+    for (int i = 0; i < self->capacity; i++)
+    {
+        const FFLGLBufferCacheEntry* pEntry = &self->entries[i];
+        if (pEntry->state != FFL_GL_BUFFER_CACHE_SLOT_USED)
+            continue;
+        *FFLGLBufferCache_InsertSlot(newEntries, newCapacity, pEntry->owner, pEntry->ptr, pEntry->size, pEntry->stride) = *pEntry;
+    }
+    RL_FREE(self->entries);
+    self->entries = newEntries;
+    self->capacity = newCapacity;
+    self->deletedCount = 0;
+}
+
+// Returns the entry for the key, or NULL if there is none.
+static FFLGLBufferCacheEntry* FFLGLBufferCache_Find(FFLGLBufferCache* self,
+    const void* owner, const void* ptr, u32 size, u32 stride)
+{
+    if (self->capacity == 0)
+        return NULL;
+    const u32 mask = (u32)self->capacity - 1;
+    u32 i = FFLGLBufferCache_Hash(owner, ptr, size, stride) & mask;
+    for (;;)
+    {
+        FFLGLBufferCacheEntry* pEntry = &self->entries[i];
+        if (pEntry->state == FFL_GL_BUFFER_CACHE_SLOT_EMPTY)
+            return NULL;
+        if (pEntry->state == FFL_GL_BUFFER_CACHE_SLOT_USED
+            && pEntry->ptr == ptr && pEntry->owner == owner
+            && pEntry->size == size && pEntry->stride == stride)
+            return pEntry;
+        i = (i + 1) & mask;
+    }
+}
+
+// Returns the entry for the key, inserting an empty one if it is missing.
+static FFLGLBufferCacheEntry* FFLGLBufferCache_FindOrInsert(FFLGLBufferCache* self,
+    const void* owner, const void* ptr, u32 size, u32 stride, bool* pInserted)
+{
+    // Keep the load factor (including tombstones) under 1/2
+    if ((self->usedCount + self->deletedCount + 1) * 2 > self->capacity)
+    {
+        // Grow if live entries fill it, otherwise just clear tombstones
+        int newCapacity = self->capacity ? self->capacity : FFL_GL_BUFFER_CACHE_INITIAL_CAPACITY;
+        while ((self->usedCount + 1) * 4 > newCapacity)
+            newCapacity *= 2;
+        FFLGLBufferCache_Rehash(self, newCapacity);
+    }
+
+    const u32 mask = (u32)self->capacity - 1;
+    u32 i = FFLGLBufferCache_Hash(owner, ptr, size, stride) & mask;
+    FFLGLBufferCacheEntry* pInsert = NULL;
+    for (;;)
+    {
+        FFLGLBufferCacheEntry* pEntry = &self->entries[i];
+        if (pEntry->state == FFL_GL_BUFFER_CACHE_SLOT_EMPTY)
+        {
+            if (pInsert == NULL)
+                pInsert = pEntry;
+            break;
+        }
+        if (pEntry->state == FFL_GL_BUFFER_CACHE_SLOT_DELETED)
+        {
+            if (pInsert == NULL)
+                pInsert = pEntry;
+        }
+        else if (pEntry->ptr == ptr && pEntry->owner == owner
+                 && pEntry->size == size && pEntry->stride == stride)
+        {
+            *pInserted = false;
+            return pEntry;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (pInsert->state == FFL_GL_BUFFER_CACHE_SLOT_DELETED)
+        self->deletedCount--;
+    pInsert->owner = owner;
+    pInsert->ptr = ptr;
+    pInsert->size = size;
+    pInsert->stride = stride;
+    pInsert->handle = 0;
+    pInsert->state = FFL_GL_BUFFER_CACHE_SLOT_USED;
+    pInsert->pShape = NULL;
+    self->usedCount++;
+    *pInserted = true;
+    return pInsert;
+}
+
+// Binds the buffer object holding (ptr, size) to target,
+// creating and uploading it the first time the key is seen.
+GLuint FFLGLBufferCache_Bind(FFLGLBufferCache* self, GLenum target,
+    const void* owner, const void* ptr, u32 size, u32 stride)
+{
+    bool inserted;
+    FFLGLBufferCacheEntry* pEntry = FFLGLBufferCache_FindOrInsert(self, owner, ptr, size, stride, &inserted);
+    if (!inserted)
+    {
+        // Hit: the data is already on the GPU
+        glBindBuffer(target, pEntry->handle);
+        self->stats.reused++;
+        return pEntry->handle;
+    }
+
+    // Miss: upload once
+    glGenBuffers(1, &pEntry->handle);
+    self->stats.created++;
+    glBindBuffer(target, pEntry->handle);
+    glBufferData(target, size, ptr, GL_STATIC_DRAW);
+    TraceLog(LOG_TRACE, "Buffer cache: uploaded %p (%u bytes) for owner %p to buffer %u",
+        ptr, size, owner, pEntry->handle);
+    return pEntry->handle;
+}
+
+// Uploads data without an owner (only drawn once) into *pHandle,
+// which is created the first time and kept to be reused for the next call.
+void FFLGLBufferCache_Stream(FFLGLBufferCache* self, GLenum target,
+    GLuint* pHandle, const void* ptr, u32 size)
+{
+    if (*pHandle == 0)
+    {
+        glGenBuffers(1, pHandle);
+        self->stats.created++;
+    }
+    else
+        self->stats.reused++;
+
+    glBindBuffer(target, *pHandle);
+    glBufferData(target, size, ptr, GL_STREAM_DRAW);
+}
+
+void FFLGLBufferCache_ResetStats(FFLGLBufferCache* self)
+{
+    self->stats.created = 0;
+    self->stats.reused = 0;
+}
+
+// ------------------------------------------------------------------
+// Rekeying
+// ------------------------------------------------------------------
+
+//
+// Rebuilding a CharModel (FFLInitCharModelCPUStep) allocates new
+// buffers for all of its shapes, even when an edit did not change them.
+// Instead of uploading those again, the buffers handed to the draw
+// callback are recorded for the old and the new model, and the old
+// entries are moved to the new pointers at the same position.
+//
+
+#define FFL_GL_BUFFER_RECORD_MAX 256
+
+// Buffers handed to the draw callback, in the order they were drawn.
+typedef struct FFLGLBufferRecord
+{
+    const void* ptrs[FFL_GL_BUFFER_RECORD_MAX];
+    u32 sizes[FFL_GL_BUFFER_RECORD_MAX];
+    u32 strides[FFL_GL_BUFFER_RECORD_MAX];
+    int count;
+    bool isOverflowed; // more than FFL_GL_BUFFER_RECORD_MAX, cannot be used
+} FFLGLBufferRecord;
+
+void FFLGLBufferRecord_Add(FFLGLBufferRecord* self, const void* ptr, u32 size, u32 stride)
+{
+    if (self->count == FFL_GL_BUFFER_RECORD_MAX)
+    {
+        self->isOverflowed = true;
+        return;
+    }
+    self->ptrs[self->count] = ptr;
+    self->sizes[self->count] = size;
+    self->strides[self->count] = stride;
+    self->count++;
+}
+
+// Moves owner's entries for the buffers in pOld to the buffers at the same
+// position in pNew, which the caller knows have the same contents.
+// Returns false without changing anything if the records do not line up,
+// then the owner has to be invalidated instead.
+bool FFLGLBufferCache_RekeyOwner(FFLGLBufferCache* self, const void* owner,
+    const FFLGLBufferRecord* pOld, const FFLGLBufferRecord* pNew)
+{
+    if (pOld->isOverflowed || pNew->isOverflowed || pOld->count != pNew->count)
+        return false;
+    for (int i = 0; i < pOld->count; i++)
+    {
+        if (pOld->sizes[i] != pNew->sizes[i] || pOld->strides[i] != pNew->strides[i])
+            return false;
+    }
+
+    int moved = 0;
+    for (int i = 0; i < pOld->count; i++)
+    {
+        // Missing if it was never uploaded, or already moved
+        // because the same buffer was drawn twice
+        FFLGLBufferCacheEntry* pEntry = FFLGLBufferCache_Find(self, owner, pOld->ptrs[i], pOld->sizes[i], pOld->strides[i]);
+        if (pEntry == NULL)
+            continue;
+        const GLuint handle = pEntry->handle;
+        struct FFLGLShape* pShape = pEntry->pShape;
+        pEntry->state = FFL_GL_BUFFER_CACHE_SLOT_DELETED;
+        self->usedCount--;
+        self->deletedCount++;
+
+        bool inserted;
+        pEntry = FFLGLBufferCache_FindOrInsert(self, owner, pNew->ptrs[i], pNew->sizes[i], pNew->strides[i], &inserted);
+        assert(inserted); // the old buffers are still allocated, so these are all new
+        pEntry->handle = handle;
+        pEntry->pShape = pShape;
+        moved++;
+    }
+    TraceLog(LOG_DEBUG, "Buffer cache: moved %d buffers for owner %p", moved, owner);
+    return true;
+}
+
+// ------------------------------------------------------------------
+// Baked shapes
+// ------------------------------------------------------------------
+
+//
+// A shape is everything a draw needs besides uniforms and textures:
+// the attribute buffers with their formats and the index buffer.
+// It is baked once from the first FFLDrawParam seen for the shape and
+// stored on the cache entry of its index buffer, so it is freed along
+// with the rest of the owner's buffers.
+//
+// With VAOs (GL 3.3) the shape is a VAO and binding it is one call.
+// Without them (ES 2.0, GL 2.1) the attribute setup is kept as a list
+// of records and only applied again when a different shape is drawn.
+//
+
+typedef struct FFLGLShapeAttrib
+{
+    GLuint location;
+    GLuint buffer;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLsizei stride;
+} FFLGLShapeAttrib;
+
+typedef struct FFLGLShape
+{
+#ifndef VAO_NOT_SUPPORTED
+    GLuint vaoHandle;
+#else
+    FFLGLShapeAttrib attribs[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
+    int attribCount;
+    u32 enabledMask; // bit per attribute location
+#endif
+    GLuint indexBuffer;
+} FFLGLShape;
+
+// Attribute state last applied by FFLGLShape_Bind, for the ES 2.0 path.
+typedef struct FFLGLAttribState
+{
+    const FFLGLShape* pLastShape; // NULL if unknown
+    u32 enabledMask; // locations that may still be enabled
+} FFLGLAttribState;
+
+// Call when anything else may have changed attribute state.
+// locationMask has a bit for each attribute location the shader uses.
+void FFLGLAttribState_Invalidate(FFLGLAttribState* self, u32 locationMask)
+{
+    self->pLastShape = NULL;
+    self->enabledMask = locationMask;
+}
+
+static void FFLGLShape_Delete(FFLGLShape* pShape)
+{
+    if (pShape == NULL)
+        return;
+#ifndef VAO_NOT_SUPPORTED
+    glDeleteVertexArrays(1, &pShape->vaoHandle);
+#endif
+    RL_FREE(pShape);
+}
+
+// Returns the baked shape for an index buffer, or NULL if it has not been baked.
+FFLGLShape* FFLGLBufferCache_FindShape(FFLGLBufferCache* self,
+    const void* owner, const void* pIndexBuffer, u32 indexBufferSize)
+{
+    FFLGLBufferCacheEntry* pEntry = FFLGLBufferCache_Find(self, owner, pIndexBuffer, indexBufferSize, 0);
+    if (pEntry == NULL || pEntry->pShape == NULL)
+        return NULL;
+    self->stats.reused++; // the index buffer is not recreated
+    return pEntry->pShape;
+}
+
+// Bakes a shape from attribute records whose buffers were
+// bound with FFLGLBufferCache_Bind, plus its index buffer.
+FFLGLShape* FFLGLBufferCache_BakeShape(FFLGLBufferCache* self,
+    const void* owner, const void* pIndexBuffer, u32 indexBufferSize,
+    const FFLGLShapeAttrib* pAttribs, int attribCount)
+{
+    FFLGLShape* pShape = (FFLGLShape*)RL_CALLOC(1, sizeof(FFLGLShape));
+#ifndef VAO_NOT_SUPPORTED
+    // Bind the new VAO first: binding the index buffer is recorded
+    // in whichever VAO is bound, which is still the last shape drawn
+    glGenVertexArrays(1, &pShape->vaoHandle);
+    glBindVertexArray(pShape->vaoHandle);
+#endif
+    pShape->indexBuffer = FFLGLBufferCache_Bind(self, GL_ELEMENT_ARRAY_BUFFER,
+        owner, pIndexBuffer, indexBufferSize, 0);
+    FFLGLBufferCacheEntry* pEntry = FFLGLBufferCache_Find(self, owner, pIndexBuffer, indexBufferSize, 0);
+    assert(pEntry != NULL && pEntry->pShape == NULL);
+
+#ifndef VAO_NOT_SUPPORTED
+    for (int i = 0; i < attribCount; i++)
+    {
+        const FFLGLShapeAttrib* pAttrib = &pAttribs[i];
+        glBindBuffer(GL_ARRAY_BUFFER, pAttrib->buffer);
+        glEnableVertexAttribArray(pAttrib->location);
+        glVertexAttribPointer(pAttrib->location, pAttrib->size, pAttrib->type,
+            pAttrib->normalized, pAttrib->stride, (void*)0);
+    }
+    glBindVertexArray(0);
+#else
+    memcpy(pShape->attribs, pAttribs, attribCount * sizeof(FFLGLShapeAttrib));
+    pShape->attribCount = attribCount;
+    for (int i = 0; i < attribCount; i++)
+        pShape->enabledMask |= 1u << pAttribs[i].location;
+#endif
+    pEntry->pShape = pShape;
+    TraceLog(LOG_TRACE, "Buffer cache: baked shape %p with %d attributes for owner %p",
+        pIndexBuffer, attribCount, owner);
+    return pShape;
+}
+
+// Makes the shape's attributes and index buffer current.
+void FFLGLShape_Bind(const FFLGLShape* pShape, FFLGLAttribState* pState)
+{
+#ifndef VAO_NOT_SUPPORTED
+    (void)pState;
+    glBindVertexArray(pShape->vaoHandle);
+#ifndef NDEBUG
+    // Catches index buffers bound into another shape's VAO, which
+    // only shows once that shape is drawn again on a later frame
+    GLint indexBuffer = 0;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indexBuffer);
+    assert((GLuint)indexBuffer == pShape->indexBuffer);
+#endif
+#else
+    if (pState->pLastShape == pShape)
+        return; // already set up
+
+    // When the state is unknown nothing can be assumed enabled
+    const u32 enabledMask = pState->pLastShape != NULL ? pState->enabledMask : 0;
+    for (int i = 0; i < pShape->attribCount; i++)
+    {
+        const FFLGLShapeAttrib* pAttrib = &pShape->attribs[i];
+        glBindBuffer(GL_ARRAY_BUFFER, pAttrib->buffer);
+        glVertexAttribPointer(pAttrib->location, pAttrib->size, pAttrib->type,
+            pAttrib->normalized, pAttrib->stride, (void*)0);
+        if (!(enabledMask & (1u << pAttrib->location)))
+            glEnableVertexAttribArray(pAttrib->location);
+    }
+    // Disable what the previous shape used and this one does not
+    u32 disableMask = pState->enabledMask & ~pShape->enabledMask;
+    for (GLuint location = 0; disableMask != 0; location++, disableMask >>= 1)
+    {
+        if (disableMask & 1)
+            glDisableVertexAttribArray(location);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pShape->indexBuffer);
+
+    pState->pLastShape = pShape;
+    pState->enabledMask = pShape->enabledMask;
+#endif
+}
+
+// Deletes every buffer uploaded for owner.
+void FFLGLBufferCache_InvalidateOwner(FFLGLBufferCache* self, const void* owner)
+{
+    int deleted = 0;
+    for (int i = 0; i < self->capacity; i++)
+    {
+        FFLGLBufferCacheEntry* pEntry = &self->entries[i];
+        if (pEntry->state != FFL_GL_BUFFER_CACHE_SLOT_USED || pEntry->owner != owner)
+            continue;
+        FFLGLShape_Delete(pEntry->pShape);
+        pEntry->pShape = NULL;
+        glDeleteBuffers(1, &pEntry->handle);
+        pEntry->state = FFL_GL_BUFFER_CACHE_SLOT_DELETED;
+        self->usedCount--;
+        self->deletedCount++;
+        deleted++;
+    }
+    TraceLog(LOG_DEBUG, "Buffer cache: invalidated %d buffers for owner %p", deleted, owner);
+}
+
+// Deletes all buffers. The cache can still be used afterwards.
+void FFLGLBufferCache_Destroy(FFLGLBufferCache* self)
+{
+    for (int i = 0; i < self->capacity; i++)
+    {
+        if (self->entries[i].state != FFL_GL_BUFFER_CACHE_SLOT_USED)
+            continue;
+        FFLGLShape_Delete(self->entries[i].pShape);
+        glDeleteBuffers(1, &self->entries[i].handle);
+    }
+    RL_FREE(self->entries);
+    FFLGLBufferCache_Initialize(self);
+}
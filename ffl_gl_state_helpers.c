@@ -0,0 +1,322 @@
+//
+// Shadow copy of the GL state touched by the FFL shader callback.
+//
+// Include this after the OpenGL headers and <nn/ffl.h>,
+// the same way body_scale_helpers_iqm.c is included.
+//
+// FFL calls the draw callback once per shape, and most of the state
+// it sets (program, culling, texture unit, material uniforms) is the
+// same as the draw before it. Every setter here compares against the
+// last value it set and skips the GL call if nothing changed.
+//
+// The shadow only knows what went through it. Anything else that
+// touches GL (raylib's batch, DrawMesh, render textures) must be
+// followed by FFLGLState_Invalidate before the shadow is used again.
+//
+
+#include <string.h>
+
+// Calls made and skipped since the last FFLGLState_ResetStats.
+typedef struct FFLGLStateStats
+{
+    int issued;
+    int skipped;
+} FFLGLStateStats;
+
+// Sampling state used for FFL textures.
+// Shapes (faceline, mask, glass, noseline) use mirrored repeat
+// since those textures are NPOT, everything else clamps to edge.
+typedef enum FFLGLSampler
+{
+    FFL_GL_SAMPLER_NONE, // no sampler, use the texture's own parameters
+    FFL_GL_SAMPLER_CLAMP,
+    FFL_GL_SAMPLER_MIRROR,
+    FFL_GL_SAMPLER_MAX
+} FFLGLSampler;
+
+static FFLGLSampler FFLGLSampler_FromModulateType(FFLModulateType type)
+{
+    return type < FFL_MODULATE_TYPE_SHAPE_MAX
+        ? FFL_GL_SAMPLER_MIRROR : FFL_GL_SAMPLER_CLAMP;
+}
+
+static GLint FFLGLSampler_GetWrap(FFLGLSampler sampler)
+{
+    return sampler == FFL_GL_SAMPLER_MIRROR ? GL_MIRRORED_REPEAT : GL_CLAMP_TO_EDGE;
+}
+
+// Sets the parameters of a sampler on the bound texture,
+// for textures that are created with the sampling state they are drawn with.
+void FFLGLSampler_SetTextureParams(FFLGLSampler sampler)
+{
+    const GLint wrap = FFLGLSampler_GetWrap(sampler);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    // Do not use mipmaps
+    // TODO: ADD MIPMAP SUPPORT but NOT SUPPORTED FOR ES 2.0
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+typedef struct FFLGLState
+{
+    GLuint program;
+    int cullMode; // FFLCullMode, -1 if unknown
+    int depthMask; // GLboolean, -1 if unknown
+    GLenum activeTexture; // 0 if unknown
+    GLuint boundTexture; // on GL_TEXTURE0
+    bool isProgramKnown;
+    bool isTextureKnown;
+
+#ifndef VAO_NOT_SUPPORTED
+    // Sampler objects override the parameters of any texture bound to unit 0.
+    GLuint samplers[FFL_GL_SAMPLER_MAX]; // samplers[FFL_GL_SAMPLER_NONE] is 0
+    int boundSampler; // FFLGLSampler, -1 if unknown
+#else
+    // Without sampler objects, the wrap mode lives in the texture.
+    // Indexed by texture name, names are small and reused by GL.
+    GLint* textureWraps; // 0 if unknown
+    GLuint textureWrapsCount;
+#endif
+
+    FFLGLStateStats stats;
+} FFLGLState;
+
+// Uniform values last set on one program.
+// Locations at or above the maximum are always set.
+#define FFL_GL_UNIFORM_SHADOW_MAX 64
+
+typedef struct FFLGLUniformShadow
+{
+    u8 values[FFL_GL_UNIFORM_SHADOW_MAX][16]; // up to a vec4
+    u8 sizes[FFL_GL_UNIFORM_SHADOW_MAX]; // 0 if unknown
+} FFLGLUniformShadow;
+
+void FFLGLState_Invalidate(FFLGLState* self)
+{
+    self->isProgramKnown = false;
+    self->isTextureKnown = false;
+    self->cullMode = -1;
+    self->depthMask = -1;
+    self->activeTexture = 0;
+#ifndef VAO_NOT_SUPPORTED
+    self->boundSampler = -1;
+#endif
+}
+
+// Forgets all texture parameters, call when textures may have been
+// deleted so that a reused texture name is not mistaken for the old one.
+void FFLGLState_InvalidateTextures(FFLGLState* self)
+{
+#ifdef VAO_NOT_SUPPORTED
+    if (self->textureWraps != NULL)
+        memset(self->textureWraps, 0, self->textureWrapsCount * sizeof(GLint));
+#else
+    (void)self;
+#endif
+}
+
+// Needs a GL context, creates the sampler objects.
+void FFLGLState_Initialize(FFLGLState* self)
+{
+    memset(self, 0, sizeof(FFLGLState));
+    FFLGLState_Invalidate(self);
+
+#ifndef VAO_NOT_SUPPORTED
+    glGenSamplers(FFL_GL_SAMPLER_MAX - 1, &self->samplers[FFL_GL_SAMPLER_NONE + 1]);
+    for (int i = FFL_GL_SAMPLER_NONE + 1; i < FFL_GL_SAMPLER_MAX; i++)
+    {
+        const GLint wrap = FFLGLSampler_GetWrap((FFLGLSampler)i);
+        glSamplerParameteri(self->samplers[i], GL_TEXTURE_WRAP_S, wrap);
+        glSamplerParameteri(self->samplers[i], GL_TEXTURE_WRAP_T, wrap);
+        glSamplerParameteri(self->samplers[i], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(self->samplers[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    TraceLog(LOG_DEBUG, "Created sampler objects for FFL: clamp %d, mirror %d",
+        self->samplers[FFL_GL_SAMPLER_CLAMP], self->samplers[FFL_GL_SAMPLER_MIRROR]);
+#endif
+}
+
+void FFLGLState_Finalize(FFLGLState* self)
+{
+#ifndef VAO_NOT_SUPPORTED
+    glBindSampler(0, 0);
+    glDeleteSamplers(FFL_GL_SAMPLER_MAX - 1, &self->samplers[FFL_GL_SAMPLER_NONE + 1]);
+    memset(self, 0, sizeof(FFLGLState));
+    FFLGLState_Invalidate(self);
+#else
+    RL_FREE(self->textureWraps);
+    FFLGLState_Initialize(self);
+#endif
+}
+
+void FFLGLState_ResetStats(FFLGLState* self)
+{
+    self->stats.issued = 0;
+    self->stats.skipped = 0;
+}
+
+void FFLGLUniformShadow_Invalidate(FFLGLUniformShadow* self)
+{
+    memset(self->sizes, 0, sizeof(self->sizes));
+}
+
+void FFLGLState_UseProgram(FFLGLState* self, GLuint program)
+{
+    if (self->isProgramKnown && self->program == program)
+    {
+        self->stats.skipped++;
+        return;
+    }
+    glUseProgram(program);
+    self->program = program;
+    self->isProgramKnown = true;
+    self->stats.issued++;
+}
+
+void FFLGLState_SetCullMode(FFLGLState* self, FFLCullMode mode)
+{
+    if (self->cullMode == (int)mode)
+    {
+        self->stats.skipped++;
+        return;
+    }
+
+    switch (mode)
+    {
+    case FFL_CULL_MODE_NONE:
+        glDisable(GL_CULL_FACE);
+        break;
+    case FFL_CULL_MODE_BACK:
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_BACK);
+        break;
+    case FFL_CULL_MODE_FRONT:
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        break;
+    default:
+        return; // unknown, leave it
+    }
+    self->cullMode = (int)mode;
+    self->stats.issued++;
+}
+
+void FFLGLState_SetDepthMask(FFLGLState* self, GLboolean enable)
+{
+    if (self->depthMask == (int)enable)
+    {
+        self->stats.skipped++;
+        return;
+    }
+    glDepthMask(enable);
+    self->depthMask = (int)enable;
+    self->stats.issued++;
+}
+
+// Binds texture to GL_TEXTURE0.
+void FFLGLState_BindTexture(FFLGLState* self, GLuint texture)
+{
+    if (self->activeTexture != GL_TEXTURE0)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        self->activeTexture = GL_TEXTURE0;
+        self->stats.issued++;
+    }
+    else
+        self->stats.skipped++;
+
+    if (self->isTextureKnown && self->boundTexture == texture)
+    {
+        self->stats.skipped++;
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    self->boundTexture = texture;
+    self->isTextureKnown = true;
+    self->stats.issued++;
+}
+
+// Makes draws from texture unit 0 use this sampling state. With sampler
+// objects this only binds one, otherwise the texture bound with
+// FFLGLState_BindTexture gets the wrap mode the first time it is drawn
+// with a different one. Minification filter is set when textures are created.
+void FFLGLState_BindSampler(FFLGLState* self, FFLGLSampler sampler)
+{
+#ifndef VAO_NOT_SUPPORTED
+    if (self->boundSampler == (int)sampler)
+    {
+        self->stats.skipped++;
+        return;
+    }
+    glBindSampler(0, self->samplers[sampler]);
+    self->boundSampler = (int)sampler;
+    self->stats.issued++;
+#else
+    if (sampler == FFL_GL_SAMPLER_NONE)
+        return; // nothing is bound that could be unbound
+
+    const GLuint texture = self->boundTexture;
+    if (texture >= self->textureWrapsCount)
+    {
+        GLuint newCount = self->textureWrapsCount ? self->textureWrapsCount : 64;
+        while (newCount <= texture)
+            newCount *= 2;
+        self->textureWraps = (GLint*)RL_REALLOC(self->textureWraps, newCount * sizeof(GLint));
+        memset(&self->textureWraps[self->textureWrapsCount], 0,
+            (newCount - self->textureWrapsCount) * sizeof(GLint));
+        self->textureWrapsCount = newCount;
+    }
+
+    const GLint wrap = FFLGLSampler_GetWrap(sampler);
+    if (self->textureWraps[texture] == wrap)
+    {
+        self->stats.skipped++;
+        return;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    self->textureWraps[texture] = wrap;
+    self->stats.issued += 2;
+#endif
+}
+
+// Sets a uniform on the current program, uniformType is a raylib ShaderUniformDataType
+// (only FLOAT, VEC2, VEC3, VEC4, INT and SAMPLER2D are used for FFL).
+void FFLGLState_SetUniform(FFLGLState* self, FFLGLUniformShadow* pShadow,
+    int location, const void* pValue, int uniformType)
+{
+    if (location < 0)
+        return;
+
+    u8 size;
+    switch (uniformType)
+    {
+    case SHADER_UNIFORM_VEC2: size = 8; break;
+    case SHADER_UNIFORM_VEC3: size = 12; break;
+    case SHADER_UNIFORM_VEC4: size = 16; break;
+    default: size = 4; break; // float, int, sampler
+    }
+
+    if (location < FFL_GL_UNIFORM_SHADOW_MAX)
+    {
+        if (pShadow->sizes[location] == size
+            && memcmp(pShadow->values[location], pValue, size) == 0)
+        {
+            self->stats.skipped++;
+            return;
+        }
+        memcpy(pShadow->values[location], pValue, size);
+        pShadow->sizes[location] = size;
+    }
+
+    switch (uniformType)
+    {
+    case SHADER_UNIFORM_FLOAT: glUniform1fv(location, 1, (const GLfloat*)pValue); break;
+    case SHADER_UNIFORM_VEC2: glUniform2fv(location, 1, (const GLfloat*)pValue); break;
+    case SHADER_UNIFORM_VEC3: glUniform3fv(location, 1, (const GLfloat*)pValue); break;
+    case SHADER_UNIFORM_VEC4: glUniform4fv(location, 1, (const GLfloat*)pValue); break;
+    default: glUniform1iv(location, 1, (const GLint*)pValue); break;
+    }
+    self->stats.issued++;
+}
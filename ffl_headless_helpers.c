@@ -0,0 +1,462 @@
+//
+// Rendering without a window or display, for generating icons on servers.
+//
+// Include this after raylib.h, rlgl.h and the GL header, only when
+// FFL_HEADLESS_EGL is defined (CMake does that when it finds libEGL).
+//
+// InitWindow needs a display. Instead, an EGL context is made current
+// without any surface on the surfaceless platform (EGL_MESA_platform_surfaceless),
+// which also works on CPU-only Linux through Mesa's llvmpipe, and rlgl is
+// initialized on it directly. There is no default framebuffer, so
+// everything is drawn into render textures and read back from them.
+//
+// Only raylib functions that do not need a window can be used: rlgl,
+// shaders, textures, render textures, BeginMode3D and images. Not
+// BeginDrawing, GetTime, input or anything else from the platform.
+//
+// For batches, FFLHeadlessReadback reads render textures into a ring of
+// pixel pack buffers with a fence after each read. A buffer is only mapped
+// once its fence is signaled, or when it is needed again, so the GPU is
+// not waited on after every image. The flipped images go to an encoder
+// thread that writes the PNGs while the next ones are drawn. GL ES 2.0
+// has no pixel pack buffers or fences, there each image is read back
+// right away. Mesa's llvmpipe supports both, for testing without a GPU.
+//
+
+#ifdef FFL_HEADLESS_EGL
+
+#define EGL_NO_X11 // do not include X11 headers, which conflict with raylib
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+    #define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+#define FFL_HEADLESS_STORE_DATA_SIZE 96 // FFLStoreData
+#define FFL_HEADLESS_READBACK_DEPTH 3 // reads in flight before waiting for the oldest
+
+typedef struct FFLHeadlessContext
+{
+    EGLDisplay display;
+    EGLContext context;
+} FFLHeadlessContext;
+
+// Create an offscreen context for the GL version raylib was built for, make it
+// current and initialize rlgl. width and height are only the default viewport.
+bool FFLHeadlessContext_Initialize(FFLHeadlessContext* self, int width, int height)
+{
+    self->display = EGL_NO_DISPLAY;
+    self->context = EGL_NO_CONTEXT;
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC pGetPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (pGetPlatformDisplay != NULL)
+        self->display = pGetPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (self->display == EGL_NO_DISPLAY)
+    {
+        TraceLog(LOG_WARNING, "EGL: No surfaceless platform, using the default display");
+        self->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (self->display == EGL_NO_DISPLAY || !eglInitialize(self->display, &major, &minor))
+    {
+        TraceLog(LOG_ERROR, "EGL: Cannot initialize a display");
+        return false;
+    }
+    TraceLog(LOG_INFO, "EGL: Initialized EGL %d.%d, vendor: %s", major, minor,
+        eglQueryString(self->display, EGL_VENDOR));
+
+#ifdef GRAPHICS_API_OPENGL_ES2
+    const EGLenum api = EGL_OPENGL_ES_API;
+    const EGLint renderableType = EGL_OPENGL_ES2_BIT;
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+#else
+    const EGLenum api = EGL_OPENGL_API;
+    const EGLint renderableType = EGL_OPENGL_BIT;
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+#endif
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, renderableType,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglBindAPI(api) || !eglChooseConfig(self->display, configAttribs, &config, 1, &configCount)
+        || configCount == 0)
+    {
+        TraceLog(LOG_ERROR, "EGL: No config for the GL version raylib was built for");
+        eglTerminate(self->display);
+        return false;
+    }
+
+    self->context = eglCreateContext(self->display, config, EGL_NO_CONTEXT, contextAttribs);
+    // Without a surface, this needs EGL_KHR_surfaceless_context
+    if (self->context == EGL_NO_CONTEXT
+        || !eglMakeCurrent(self->display, EGL_NO_SURFACE, EGL_NO_SURFACE, self->context))
+    {
+        TraceLog(LOG_ERROR, "EGL: Cannot create a surfaceless context, error 0x%x", eglGetError());
+        if (self->context != EGL_NO_CONTEXT)
+            eglDestroyContext(self->display, self->context);
+        eglTerminate(self->display);
+        return false;
+    }
+
+    // What InitWindow does after creating its context
+    rlLoadExtensions((void*)eglGetProcAddress);
+    rlglInit(width, height);
+    return true;
+}
+
+void FFLHeadlessContext_Destroy(FFLHeadlessContext* self)
+{
+    rlglClose();
+    eglMakeCurrent(self->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(self->display, self->context);
+    eglTerminate(self->display);
+    self->display = EGL_NO_DISPLAY;
+    self->context = EGL_NO_CONTEXT;
+}
+
+// Decode hex digits, skipping whitespace. Returns the number of bytes or -1.
+static int FFLHeadless_DecodeHex(const char* pText, size_t length, u8* pOut, int outSize)
+{
+    int count = 0;
+    int high = -1;
+    for (size_t i = 0; i < length; i++)
+    {
+        const char c = pText[i];
+        int value;
+        if (c >= '0' && c <= '9')
+            value = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value = c - 'A' + 10;
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+            continue;
+        else
+            return -1;
+
+        if (high == -1)
+        {
+            high = value;
+            continue;
+        }
+        if (count == outSize)
+            return -1;
+        pOut[count++] = (u8)(high << 4 | value);
+        high = -1;
+    }
+    return high == -1 ? count : -1;
+}
+
+// Read StoreData from source: hex digits, "-" for stdin, or a file path.
+// Stdin and files may hold the 96 bytes or their hex digits.
+bool FFLHeadless_ReadStoreData(const char* source, u8 pStoreData[FFL_HEADLESS_STORE_DATA_SIZE])
+{
+    if (FFLHeadless_DecodeHex(source, strlen(source), pStoreData, FFL_HEADLESS_STORE_DATA_SIZE)
+        == FFL_HEADLESS_STORE_DATA_SIZE)
+        return true;
+
+    FILE* file = strcmp(source, "-") == 0 ? stdin : fopen(source, "rb");
+    if (file == NULL)
+    {
+        TraceLog(LOG_ERROR, "Cannot open StoreData file %s", source);
+        return false;
+    }
+    // Enough for the hex digits with some whitespace
+    char buffer[FFL_HEADLESS_STORE_DATA_SIZE * 4];
+    const size_t size = fread(buffer, 1, sizeof(buffer), file);
+    if (file != stdin)
+        fclose(file);
+
+    if (size == FFL_HEADLESS_STORE_DATA_SIZE)
+    {
+        memcpy(pStoreData, buffer, FFL_HEADLESS_STORE_DATA_SIZE);
+        return true;
+    }
+    if (FFLHeadless_DecodeHex(buffer, size, pStoreData, FFL_HEADLESS_STORE_DATA_SIZE)
+        == FFL_HEADLESS_STORE_DATA_SIZE)
+        return true;
+    TraceLog(LOG_ERROR, "StoreData from %s is not %d bytes or their hex digits",
+        source, FFL_HEADLESS_STORE_DATA_SIZE);
+    return false;
+}
+
+// Read back a render texture and write it as PNG to path, or stdout for "-"
+bool FFLHeadless_ExportRenderTexture(RenderTexture renderTexture, const char* path)
+{
+    Image image = LoadImageFromTexture(renderTexture.texture);
+    ImageFlipVertical(&image); // render textures are upside down
+    bool isExported;
+    if (strcmp(path, "-") == 0)
+    {
+        int size = 0;
+        unsigned char* pData = ExportImageToMemory(image, ".png", &size);
+        isExported = pData != NULL && fwrite(pData, 1, (size_t)size, stdout) == (size_t)size;
+        fflush(stdout);
+        MemFree(pData);
+    }
+    else
+        isExported = ExportImage(image, path);
+    UnloadImage(image);
+    return isExported;
+}
+
+// Seconds from a monotonic clock, for GetTime which needs a window
+double FFLHeadless_GetTime(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// An image waiting for the encoder thread, already flipped
+typedef struct FFLHeadlessImage
+{
+    u8* pPixels;
+    u32 index;
+    struct FFLHeadlessImage* pNext;
+} FFLHeadlessImage;
+
+typedef struct FFLHeadlessReadback
+{
+    int width;
+    int height;
+    const char* prefix; // images are written to <prefix><index>.png
+
+    // Encoder thread, writing PNGs while the GL thread draws
+    pthread_t encoder;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // signaled when the queue or pendingCount change
+    FFLHeadlessImage* pQueueHead; // protected by mutex, oldest first
+    FFLHeadlessImage* pQueueTail;
+    u32 pendingCount; // queued or being written, protected by mutex
+    u32 failedCount; // not written, protected by mutex
+    bool shouldExit; // protected by mutex
+
+#ifndef VAO_NOT_SUPPORTED
+    GLuint buffers[FFL_HEADLESS_READBACK_DEPTH];
+    GLsync fences[FFL_HEADLESS_READBACK_DEPTH]; // signaled when the read into each buffer is done
+    u32 indices[FFL_HEADLESS_READBACK_DEPTH]; // of the image read into each buffer
+    u32 readCount; // images read, the last FFL_HEADLESS_READBACK_DEPTH are in buffers
+    u32 queuedCount; // images handed to the encoder
+#else
+    u8* pPixels; // one image, read before it is flipped
+#endif
+} FFLHeadlessReadback;
+
+static void* FFLHeadlessReadback_RunEncoder(void* pArg)
+{
+    FFLHeadlessReadback* self = (FFLHeadlessReadback*)pArg;
+    char path[1024];
+    pthread_mutex_lock(&self->mutex);
+    for (;;)
+    {
+        while (!self->shouldExit && self->pQueueHead == NULL)
+            pthread_cond_wait(&self->cond, &self->mutex);
+        FFLHeadlessImage* pImage = self->pQueueHead;
+        if (pImage == NULL)
+            break; // exiting with nothing queued
+        self->pQueueHead = pImage->pNext;
+        if (self->pQueueHead == NULL)
+            self->pQueueTail = NULL;
+        pthread_mutex_unlock(&self->mutex);
+
+        // TextFormat is not thread safe
+        snprintf(path, sizeof(path), "%s%u.png", self->prefix, pImage->index);
+        Image image = {
+            .data = pImage->pPixels,
+            .width = self->width,
+            .height = self->height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+        };
+        const bool isWritten = ExportImage(image, path);
+        if (!isWritten)
+            TraceLog(LOG_ERROR, "Cannot write %s", path);
+        RL_FREE(pImage->pPixels);
+        RL_FREE(pImage);
+
+        pthread_mutex_lock(&self->mutex);
+        if (!isWritten)
+            self->failedCount++;
+        self->pendingCount--;
+        pthread_cond_broadcast(&self->cond);
+    }
+    pthread_mutex_unlock(&self->mutex);
+    return NULL;
+}
+
+// Starts the encoder thread, returns false if it could not be started
+bool FFLHeadlessReadback_Initialize(FFLHeadlessReadback* self, int width, int height, const char* prefix)
+{
+    memset(self, 0, sizeof(FFLHeadlessReadback));
+    self->width = width;
+    self->height = height;
+    self->prefix = prefix;
+    pthread_mutex_init(&self->mutex, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    if (pthread_create(&self->encoder, NULL, FFLHeadlessReadback_RunEncoder, self) != 0)
+    {
+        TraceLog(LOG_ERROR, "Cannot start the image encoder thread");
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->mutex);
+        return false;
+    }
+#ifndef VAO_NOT_SUPPORTED
+    glGenBuffers(FFL_HEADLESS_READBACK_DEPTH, self->buffers);
+    for (int i = 0; i < FFL_HEADLESS_READBACK_DEPTH; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, self->buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+#else
+    self->pPixels = (u8*)RL_MALLOC((size_t)width * height * 4);
+#endif
+    return true;
+}
+
+// Copy pPixels, bottom row first as glReadPixels returns them, flipped and hand them to the encoder
+static void FFLHeadlessReadback_Queue(FFLHeadlessReadback* self, const u8* pPixels, u32 index)
+{
+    const size_t rowSize = (size_t)self->width * 4;
+    FFLHeadlessImage* pImage = (FFLHeadlessImage*)RL_MALLOC(sizeof(FFLHeadlessImage));
+    pImage->pPixels = (u8*)RL_MALLOC(rowSize * self->height);
+    pImage->index = index;
+    pImage->pNext = NULL;
+    for (int y = 0; y < self->height; y++)
+        memcpy(pImage->pPixels + rowSize * y, pPixels + rowSize * (self->height - 1 - y), rowSize);
+
+    pthread_mutex_lock(&self->mutex);
+    if (self->pQueueTail != NULL)
+        self->pQueueTail->pNext = pImage;
+    else
+        self->pQueueHead = pImage;
+    self->pQueueTail = pImage;
+    self->pendingCount++;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+#ifndef VAO_NOT_SUPPORTED
+// Hand the oldest buffer that was read into to the encoder. Unless shouldWait
+// is set, only if its read is done. Returns whether it was handed over.
+static bool FFLHeadlessReadback_QueueOldest(FFLHeadlessReadback* self, bool shouldWait)
+{
+    const int slot = self->queuedCount % FFL_HEADLESS_READBACK_DEPTH;
+    const GLenum status = glClientWaitSync(self->fences[slot], shouldWait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+        shouldWait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(self->fences[slot]);
+    self->fences[slot] = NULL;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, self->buffers[slot]);
+    const u8* pPixels = (const u8*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+        (GLsizeiptr)self->width * self->height * 4, GL_MAP_READ_BIT);
+    if (status != GL_WAIT_FAILED && pPixels != NULL)
+        FFLHeadlessReadback_Queue(self, pPixels, self->indices[slot]);
+    else
+    {
+        TraceLog(LOG_ERROR, "Cannot read back image %u", self->indices[slot]);
+        pthread_mutex_lock(&self->mutex);
+        self->failedCount++;
+        pthread_mutex_unlock(&self->mutex);
+    }
+    if (pPixels != NULL)
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    self->queuedCount++;
+    return true;
+}
+#endif
+
+// Read back what was drawn into renderTexture, to be written as image index
+void FFLHeadlessReadback_Push(FFLHeadlessReadback* self, RenderTexture renderTexture, u32 index)
+{
+    rlEnableFramebuffer(renderTexture.id);
+#ifndef VAO_NOT_SUPPORTED
+    // Hand over every read that is done without waiting for the GPU,
+    // and only wait when the oldest buffer is needed again
+    while (self->queuedCount != self->readCount && FFLHeadlessReadback_QueueOldest(self, false))
+        ;
+    if (self->readCount - self->queuedCount == FFL_HEADLESS_READBACK_DEPTH)
+        FFLHeadlessReadback_QueueOldest(self, true);
+
+    const int slot = self->readCount % FFL_HEADLESS_READBACK_DEPTH;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, self->buffers[slot]);
+    glReadPixels(0, 0, self->width, self->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // returns before it is done
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    self->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush(); // so that the fence is signaled without waiting on it
+    self->indices[slot] = index;
+    self->readCount++;
+#else
+    glReadPixels(0, 0, self->width, self->height, GL_RGBA, GL_UNSIGNED_BYTE, self->pPixels);
+    FFLHeadlessReadback_Queue(self, self->pPixels, index);
+#endif
+    rlDisableFramebuffer();
+}
+
+// Wait until every image that was pushed is written,
+// returns how many of them could not be written
+u32 FFLHeadlessReadback_Flush(FFLHeadlessReadback* self)
+{
+#ifndef VAO_NOT_SUPPORTED
+    while (self->queuedCount != self->readCount)
+        FFLHeadlessReadback_QueueOldest(self, true);
+#endif
+    pthread_mutex_lock(&self->mutex);
+    while (self->pendingCount != 0)
+        pthread_cond_wait(&self->cond, &self->mutex);
+    const u32 failedCount = self->failedCount;
+    self->failedCount = 0;
+    pthread_mutex_unlock(&self->mutex);
+    return failedCount;
+}
+
+// Stop the encoder and free the buffers, after FFLHeadlessReadback_Flush
+void FFLHeadlessReadback_Destroy(FFLHeadlessReadback* self)
+{
+    pthread_mutex_lock(&self->mutex);
+    self->shouldExit = true;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->mutex);
+    pthread_join(self->encoder, NULL);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+
+#ifndef VAO_NOT_SUPPORTED
+    glDeleteBuffers(FFL_HEADLESS_READBACK_DEPTH, self->buffers);
+#else
+    RL_FREE(self->pPixels);
+    self->pPixels = NULL;
+#endif
+}
+
+// TraceLog callback writing to stderr, so that images can be written to stdout
+void FFLHeadless_TraceLogCallback(int logLevel, const char* text, va_list args)
+{
+    static const char* cLevelNames[] = { "ALL", "TRACE", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL", "NONE" };
+    fprintf(stderr, "%s: ", logLevel >= 0 && logLevel <= LOG_NONE ? cLevelNames[logLevel] : "?");
+    vfprintf(stderr, text, args);
+    fputc('\n', stderr);
+}
+
+#endif // FFL_HEADLESS_EGL
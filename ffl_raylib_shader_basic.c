@@ -57,6 +57,11 @@
         "#define gl_FragColor FragColor\n" \
         "#define texture2D texture\n" \
         "out vec4 FragColor;\n" \
+        "#define TEXCOORD_PRECISION\n" \
+    "#elif defined(GL_FRAGMENT_PRECISION_HIGH)\n" \
+        "#define TEXCOORD_PRECISION highp\n" \
+    "#else\n" \
+        "#define TEXCOORD_PRECISION mediump\n" \
     "#endif\n" \
 #src
 
@@ -91,7 +96,7 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
         v_position = u_mv * a_position;
 
         //v_normal = normalize(u_it * a_normal);
-        v_texCoord = a_texCoord;
+        v_texCoord = a_texCoord; // into the atlas region in the fragment shader
         //v_tangent = normalize(u_it * a_tangent);
         //v_color = a_color;
     }
@@ -105,20 +110,39 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
     uniform vec3 u_const2;
     uniform vec3 u_const3;
     uniform sampler2D s_texture;
+    // Atlas pages are up to 4096 texels wide, more than mediump
+    // can address, see TEXCOORD_PRECISION in GLSL_FRAG
+    uniform TEXCOORD_PRECISION vec4 u_texcoord_transform; // scale in xy, offset in zw, see FFLTextureAtlasRegion
+    uniform TEXCOORD_PRECISION vec4 u_texcoord_bounds; // texCoordBounds of the region
+    uniform int u_texcoord_wrap; // FFLTextureAtlasWrap
 
-    varying vec2 v_texCoord;
+    varying TEXCOORD_PRECISION vec2 v_texCoord;
+
+    // Wrap within the atlas region, since the sampler wraps the whole page
+    TEXCOORD_PRECISION vec2 getTexCoord()
+    {
+        TEXCOORD_PRECISION vec2 texCoord = v_texCoord;
+        if (u_texcoord_wrap == 2) // mirrored repeat
+            texCoord = 1.0 - abs(mod(texCoord, 2.0) - 1.0);
+        texCoord = texCoord * u_texcoord_transform.xy + u_texcoord_transform.zw;
+        if (u_texcoord_wrap != 0)
+            texCoord = clamp(texCoord, u_texcoord_bounds.xy, u_texcoord_bounds.zw);
+        return texCoord;
+    }
 
     void main(void)
     {
+        TEXCOORD_PRECISION vec2 texCoord = getTexCoord();
+
         if (u_mode == 0)
             gl_FragColor = vec4(u_const1, 1.0);
 
         else if (u_mode == 1)
-            gl_FragColor = texture2D(s_texture, v_texCoord);
+            gl_FragColor = texture2D(s_texture, texCoord);
 
         else if (u_mode == 2)
         {
-            vec4 textureColor = texture2D(s_texture, v_texCoord);
+            vec4 textureColor = texture2D(s_texture, texCoord);
             gl_FragColor = vec4(
                 u_const1 * textureColor.r +
                 u_const2 * textureColor.g +
@@ -128,7 +152,7 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
         }
         else if (u_mode == 3)
         {
-            vec4 textureColor = texture2D(s_texture, v_texCoord);
+            vec4 textureColor = texture2D(s_texture, texCoord);
             gl_FragColor = vec4(
                 u_const1 * textureColor.r,
                 textureColor.r
@@ -136,7 +160,7 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
         }
         else if (u_mode == 4)
         {
-            vec4 textureColor = texture2D(s_texture, v_texCoord);
+            vec4 textureColor = texture2D(s_texture, texCoord);
             gl_FragColor = vec4(
                 u_const1 * textureColor.g,
                 textureColor.r
@@ -144,7 +168,7 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
         }
         else if (u_mode == 5)
         {
-            vec4 textureColor = texture2D(s_texture, v_texCoord);
+            vec4 textureColor = texture2D(s_texture, texCoord);
             gl_FragColor = vec4(
                 u_const1 * textureColor.r,
                 1.0
@@ -167,11 +191,23 @@ enum ShaderFFLPixelUniform
     SH_FFL_PIXEL_UNIFORM_CONST2,
     SH_FFL_PIXEL_UNIFORM_CONST3,
     SH_FFL_PIXEL_UNIFORM_MODE,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP,
     SH_FFL_PIXEL_UNIFORM_MAX
 };
 
 #include <nn/ffl.h>
 
+#include "ffl_gl_state_helpers.c"
+#include "ffl_gl_cache_helpers.c"
+#include "ffl_resource_helpers.c"
+#include "ffl_texture_atlas_helpers.c"
+#include <nn/ffl/detail/FFLiCharInfo.h> // for ffl_char_model_texture_cache_helpers.c
+#include "ffl_char_model_texture_cache_helpers.c"
+#include "ffl_char_model_builder_helpers.c"
+#include "ffl_headless_helpers.c"
+
 // Shader for FFL
 typedef struct {
     Shader shader; // Raylib Shader
@@ -179,10 +215,18 @@ typedef struct {
     int pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MAX];
     int samplerLocation;
     int attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
+    u32 attributeLocationMask; // bit for each location in attributeLocation
     GLuint vboHandle[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
     GLuint vaoHandle;
+    GLuint streamIndexBufferHandle; // for draws without a CharModel
     FFLShaderCallback callback;
     void* samplerTexture;
+    FFLGLBufferCache bufferCache; // vertex buffers uploaded per CharModel
+    const FFLCharModel* pCurrentCharModel; // owner of the buffers being drawn, or NULL to stream
+    FFLGLAttribState attribState; // last shape set up without VAOs
+    FFLGLState glState; // filters redundant state changes between draws
+    FFLGLUniformShadow uniformShadow; // uniform values set on shader
+    bool isBaking; // draws only bake shapes, see ShaderForFFL_BakeCharModel
 } ShaderForFFL;
 
 // define global instance of the shader
@@ -210,10 +254,16 @@ void ShaderForFFL_Initialize(ShaderForFFL* self)
     self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2] = GetShaderLocation(self->shader, "u_const2");
     self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3] = GetShaderLocation(self->shader, "u_const3");
     self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE] = GetShaderLocation(self->shader, "u_mode");
+    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM] = GetShaderLocation(self->shader, "u_texcoord_transform");
+    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS] = GetShaderLocation(self->shader, "u_texcoord_bounds");
+    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP] = GetShaderLocation(self->shader, "u_texcoord_wrap");
     TraceLog(LOG_TRACE, "Pixel uniform 'u_const1' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1]);
     TraceLog(LOG_TRACE, "Pixel uniform 'u_const2' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2]);
     TraceLog(LOG_TRACE, "Pixel uniform 'u_const3' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3]);
     TraceLog(LOG_TRACE, "Pixel uniform 'u_mode' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE]);
+    TraceLog(LOG_TRACE, "Pixel uniform 'u_texcoord_transform' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM]);
+    TraceLog(LOG_TRACE, "Pixel uniform 'u_texcoord_bounds' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS]);
+    TraceLog(LOG_TRACE, "Pixel uniform 'u_texcoord_wrap' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP]);
 
     self->samplerLocation = GetShaderLocation(self->shader, "s_texture");
     TraceLog(LOG_TRACE, "Sampler uniform 's_texture' location: %d", self->samplerLocation);
@@ -241,6 +291,31 @@ void ShaderForFFL_Initialize(ShaderForFFL* self)
     glGenBuffers(FFL_ATTRIBUTE_BUFFER_TYPE_MAX, self->vboHandle);
     TraceLog(LOG_TRACE, "VBOs created");
 
+    FFLGLBufferCache_Initialize(&self->bufferCache);
+    self->pCurrentCharModel = NULL;
+    self->isBaking = false;
+    FFLGLState_Initialize(&self->glState);
+    FFLGLUniformShadow_Invalidate(&self->uniformShadow);
+
+    self->attributeLocationMask = 0;
+    for (int i = 0; i < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; i++)
+    {
+        if (self->attributeLocation[i] != -1)
+            self->attributeLocationMask |= 1u << self->attributeLocation[i];
+    }
+    FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
+    self->streamIndexBufferHandle = 0; // created on first use
+
+    // Draws that sample the texture atlas change these, others keep them
+    FFLGLState_UseProgram(&self->glState, self->shader.id);
+    const int texCoordWrap = FFL_TEXTURE_ATLAS_WRAP_NONE;
+    FFLGLState_SetUniform(&self->glState, &self->uniformShadow,
+        self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM],
+        &cFFLTextureAtlasIdentityTransform, SHADER_UNIFORM_VEC4);
+    FFLGLState_SetUniform(&self->glState, &self->uniformShadow,
+        self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP],
+        &texCoordWrap, SHADER_UNIFORM_INT);
+
     #ifndef VAO_NOT_SUPPORTED
     glBindVertexArray(0);
     TraceLog(LOG_TRACE, "VAO unbound");
@@ -264,11 +339,20 @@ void ShaderForFFL_Bind(ShaderForFFL* self)
     TraceLog(LOG_TRACE, "In ShaderForFFL_Bind, calling BeginShaderMode");
 
     BeginShaderMode(self->shader);
+    // raylib may have changed anything since the last draw
+    FFLGLState_Invalidate(&self->glState);
+    FFLGLState_UseProgram(&self->glState, self->shader.id);
 
     #ifndef VAO_NOT_SUPPORTED
     glBindVertexArray(self->vaoHandle);
     TraceLog(LOG_TRACE, "VAO bound");
     #endif
+
+    // Until ShaderForFFL_SetCharModel is called, buffers
+    // are streamed (e.g. temporary faceline/mask shapes)
+    self->pCurrentCharModel = NULL;
+    // Anything may have changed attribute state since the last frame
+    FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
 /*
     for (int i = 0; i < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; i++)
     {
@@ -279,6 +363,80 @@ void ShaderForFFL_Bind(ShaderForFFL* self)
 */
 }
 
+// Unbind the Shader after drawing, so that raylib can draw again
+void ShaderForFFL_Unbind(ShaderForFFL* self)
+{
+    FFLGLState_BindSampler(&self->glState, FFL_GL_SAMPLER_NONE);
+    FFLGLState_BindTexture(&self->glState, 0);
+    #ifndef VAO_NOT_SUPPORTED
+    glBindVertexArray(0);
+    #endif
+    EndShaderMode();
+    FFLGLState_Invalidate(&self->glState);
+}
+
+// Set the CharModel that the following draws belong to, so that its
+// vertex buffers are kept on the GPU between frames. It must be
+// the charModel of a CharModelRenderState, which has its textures.
+void ShaderForFFL_SetCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    self->pCurrentCharModel = pCharModel;
+}
+
+// Upload the buffers of every shape in a CharModel and bake them,
+// so that the first frame it is drawn does not have to
+void ShaderForFFL_BakeCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    const FFLCharModel* pPreviousCharModel = self->pCurrentCharModel;
+    self->pCurrentCharModel = pCharModel;
+    self->isBaking = true;
+    FFLDrawOpa(pCharModel);
+    FFLDrawXlu(pCharModel);
+    self->isBaking = false;
+    self->pCurrentCharModel = pPreviousCharModel;
+}
+
+// Delete cached buffers for a CharModel, call this
+// before deleting it or replacing its shapes
+void ShaderForFFL_InvalidateCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    FFLGLBufferCache_InvalidateOwner(&self->bufferCache, pCharModel);
+    if (self->pCurrentCharModel == pCharModel)
+        self->pCurrentCharModel = NULL;
+    // Its textures will be deleted, and their names may be reused
+    FFLGLState_InvalidateTextures(&self->glState);
+}
+
+// Get GL calls issued and skipped since the last call, then reset them
+FFLGLStateStats ShaderForFFL_ResetStateStats(ShaderForFFL* self)
+{
+    FFLGLStateStats stats = self->glState.stats;
+    FFLGLState_ResetStats(&self->glState);
+    return stats;
+}
+
+// Get buffer creations and avoided creations since the last call, then reset them
+FFLGLBufferCacheStats ShaderForFFL_ResetBufferStats(ShaderForFFL* self)
+{
+    FFLGLBufferCacheStats stats = self->bufferCache.stats;
+    FFLGLBufferCache_ResetStats(&self->bufferCache);
+    return stats;
+}
+
+// Unload the shader and every cached buffer
+void ShaderForFFL_Finalize(ShaderForFFL* self)
+{
+    UnloadShader(self->shader);
+    FFLGLBufferCache_Destroy(&self->bufferCache);
+    FFLGLState_Finalize(&self->glState);
+    glDeleteBuffers(FFL_ATTRIBUTE_BUFFER_TYPE_MAX, self->vboHandle);
+    if (self->streamIndexBufferHandle != 0)
+        glDeleteBuffers(1, &self->streamIndexBufferHandle);
+    #ifndef VAO_NOT_SUPPORTED
+    glDeleteVertexArrays(1, &self->vaoHandle);
+    #endif
+}
+
 // Set View Uniform
 void ShaderForFFL_SetViewUniform(ShaderForFFL* self, const Matrix* model_mtx, const Matrix* view_mtx, const Matrix* proj_mtx)
 {
@@ -302,44 +460,122 @@ void ShaderForFFL_SetViewUniform(ShaderForFFL* self, const Matrix* model_mtx, co
 }
 
 // Set Culling Mode
-void ShaderForFFL_SetCulling(FFLCullMode mode)
+void ShaderForFFL_SetCulling(ShaderForFFL* self, FFLCullMode mode)
 {
     TraceLog(LOG_TRACE, "Setting FFLCullMode: %d", mode);
+    // Only changes GL state if the mode is different from the last draw
+    FFLGLState_SetCullMode(&self->glState, mode);
+}
 
-    switch (mode)
+// Faceline and mask textures of every CharModelRenderState
+FFLTextureAtlas gCharModelTextureAtlas;
+
+// Faceline and mask textures shared between every CharModelRenderState
+FFLCharModelTextureCache gCharModelTextureCache;
+
+// A CharModel and the faceline and mask textures drawn for it,
+// in place of the ones FFLInitCharModelGPUStep would create.
+// The CharModel is the first member, so the draw callback can find the
+// textures from the CharModel passed to ShaderForFFL_SetCharModel.
+// Only the mask of the current expression is kept, the others are drawn
+// or found in gCharModelTextureCache when SetCharModelExpression uses them.
+typedef struct CharModelRenderState
+{
+    FFLCharModel charModel; // must be first
+    FFLCharModelTexture* pFaceline; // NULL if there is none
+    FFLCharModelTexture* pMask; // of expression, NULL if it could not be drawn
+    FFLExpression expression; // of the mask that is drawn
+} CharModelRenderState;
+
+// Release the faceline and mask textures from InitCharModelTextures,
+// they stay in gCharModelTextureCache for other CharModels
+void UnloadCharModelTextures(CharModelRenderState* pState)
+{
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pState->pFaceline);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pState->pMask);
+    pState->pFaceline = NULL;
+    pState->pMask = NULL;
+}
+
+// Get the CharModelRenderState of the CharModel being drawn
+static const CharModelRenderState* ShaderForFFL_GetCurrentRenderState(const ShaderForFFL* self)
+{
+    assert(self->pCurrentCharModel != NULL); // call ShaderForFFL_SetCharModel first
+    return (const CharModelRenderState*)self->pCurrentCharModel;
+}
+
+// Get the attribute format that FFL uses for each attribute buffer type
+static void ShaderForFFL_GetAttribFormat(int type, FFLGLShapeAttrib* pAttrib)
+{
+    switch (type)
     {
-    case FFL_CULL_MODE_NONE:
-        glDisable(GL_CULL_FACE);
-        TraceLog(LOG_TRACE, "Culling disabled (FFL_CULL_MODE_NONE)");
+    case FFL_ATTRIBUTE_BUFFER_TYPE_POSITION:
+        pAttrib->size = 3;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL:
+#ifndef VAO_NOT_SUPPORTED
+        pAttrib->size = 4;
+        pAttrib->type = GL_INT_2_10_10_10_REV;
+        pAttrib->normalized = GL_TRUE;
+#else
+        pAttrib->size = 3;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
+#endif
         break;
-    case FFL_CULL_MODE_BACK:
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        TraceLog(LOG_TRACE, "Culling mode set to FFL_CULL_MODE_BACK");
+    case FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT:
+        pAttrib->size = 4;
+        pAttrib->type = GL_BYTE;
+        pAttrib->normalized = GL_TRUE;
         break;
-    case FFL_CULL_MODE_FRONT:
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_FRONT);
-        TraceLog(LOG_TRACE, "Culling mode set to FFL_CULL_MODE_FRONT");
+    case FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD:
+        pAttrib->size = 2;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_COLOR:
+        pAttrib->size = 4;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
         break;
     default:
         break;
     }
 }
 
-RenderTexture gFacelineRenderTexture;
-RenderTexture gMaskRenderTextures[FFL_EXPRESSION_LIMIT]; // a render texture for each mask
-RenderTexture* gMaskRenderTextureCurrent = &gMaskRenderTextures[FFL_EXPRESSION_NORMAL];
-                                       // NOTE: default expression is not always normal
-
-void SetCharModelExpression(FFLCharModel* pCharModel, FFLExpression expression)
+// Get the baked shape for a draw of the current CharModel,
+// uploading its buffers and baking it if this is the first time
+static const FFLGLShape* ShaderForFFL_GetShape(ShaderForFFL* self, const FFLDrawParam* pDrawParam)
 {
-    assert(expression < FFL_EXPRESSION_LIMIT);
-    //assert(&gMaskRenderTextures[expression] != NULL); // but they are not initialized to null so nvm
+    const void* pIndexBuffer = pDrawParam->primitiveParam.pIndexBuffer;
+    const u32 indexBufferSize = pDrawParam->primitiveParam.indexCount * sizeof(unsigned short);
+
+    FFLGLShape* pShape = FFLGLBufferCache_FindShape(&self->bufferCache,
+        self->pCurrentCharModel, pIndexBuffer, indexBufferSize);
+    if (pShape != NULL)
+        return pShape;
+
+    FFLGLShapeAttrib attribs[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
+    int attribCount = 0;
+    for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
+    {
+        const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
+        const int location = self->attributeLocation[type];
+        if (buffer->ptr == NULL || location == -1 || buffer->stride == 0)
+            continue;
+
+        FFLGLShapeAttrib* pAttrib = &attribs[attribCount++];
+        ShaderForFFL_GetAttribFormat(type, pAttrib);
+        pAttrib->location = (GLuint)location;
+        pAttrib->stride = buffer->stride;
+        pAttrib->buffer = FFLGLBufferCache_Bind(&self->bufferCache, GL_ARRAY_BUFFER,
+            self->pCurrentCharModel, buffer->ptr, buffer->size, buffer->stride);
+    }
 
-    FFLSetExpression(pCharModel, expression);
-    // NOTE: assuming only one instance
-    gMaskRenderTextureCurrent = &gMaskRenderTextures[expression];
+    return FFLGLBufferCache_BakeShape(&self->bufferCache, self->pCurrentCharModel,
+        pIndexBuffer, indexBufferSize, attribs, attribCount);
 }
 
 // Callback: Draw
@@ -349,12 +585,20 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
 
     TraceLog(LOG_TRACE, "Draw callback called, preparing to draw");
 
-    ShaderForFFL_SetCulling(pDrawParam->cullMode);
+    if (self->isBaking)
+    {
+        // Only upload buffers, see ShaderForFFL_BakeCharModel
+        if (pDrawParam->primitiveParam.pIndexBuffer != NULL)
+            ShaderForFFL_GetShape(self, pDrawParam);
+        return;
+    }
 
-    BeginShaderMode(self->shader);
+    ShaderForFFL_SetCulling(self, pDrawParam->cullMode);
+
+    FFLGLState_UseProgram(&self->glState, self->shader.id);
 
     // Set u_mode uniform
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE], &pDrawParam->modulateParam.mode, SHADER_UNIFORM_INT);
+    FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE], &pDrawParam->modulateParam.mode, SHADER_UNIFORM_INT);
 
     // Set uniforms based on mode
     switch (pDrawParam->modulateParam.mode)
@@ -363,12 +607,12 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
     case FFL_MODULATE_MODE_ALPHA:
     case FFL_MODULATE_MODE_LUMINANCE_ALPHA:
     case FFL_MODULATE_MODE_ALPHA_OPA:
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
         break;
     case FFL_MODULATE_MODE_RGB_LAYERED:
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2], &pDrawParam->modulateParam.pColorG->r, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3], &pDrawParam->modulateParam.pColorB->r, SHADER_UNIFORM_VEC3);
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2], &pDrawParam->modulateParam.pColorG->r, SHADER_UNIFORM_VEC3);
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3], &pDrawParam->modulateParam.pColorB->r, SHADER_UNIFORM_VEC3);
         break;
     default:
         break;
@@ -381,16 +625,24 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
     )
     {
         GLuint textureHandle;
+        const Vector4* pTexCoordTransform = &cFFLTextureAtlasIdentityTransform;
 
         // For faceline and mask (FFL should always bind a texture2D to this...)
-        // we will instead use the textures we made ourself
+        // we will instead use the textures we made ourself, in the atlas
+        const FFLTextureAtlasRegion* pRegion = NULL;
         if (pDrawParam->modulateParam.type == FFL_MODULATE_TYPE_SHAPE_FACELINE)
         {
-            textureHandle = gFacelineRenderTexture.texture.id;
+            pRegion = FFLCharModelTexture_GetRegion(ShaderForFFL_GetCurrentRenderState(self)->pFaceline);
         }
         else if (pDrawParam->modulateParam.type == FFL_MODULATE_TYPE_SHAPE_MASK)
         {
-            textureHandle = gMaskRenderTextureCurrent->texture.id;
+            pRegion = FFLCharModelTexture_GetRegion(ShaderForFFL_GetCurrentRenderState(self)->pMask);
+        }
+
+        if (pRegion != NULL)
+        {
+            textureHandle = pRegion->texture;
+            pTexCoordTransform = &pRegion->texCoordTransform;
         }
         else {
             assert(pDrawParam->modulateParam.pTexture2D != NULL);
@@ -406,120 +658,87 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
         }
 
         // Bind the texture to texture unit 0
-        glActiveTexture(GL_TEXTURE0);
-
-        glBindTexture(GL_TEXTURE_2D, textureHandle);
+        FFLGLState_BindTexture(&self->glState, textureHandle);
 
-        // Set texture wrap to repeat
-        if (pDrawParam->modulateParam.type < FFL_MODULATE_TYPE_SHAPE_MAX)
-        {
-            // Only apply texture wrap to shapes (glass, faceline)
-            // since those are NPOT textures
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-        } else {
-            // Otherwise do not use repeat wrap
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        }
-
-        // Do not use mipmaps
-        // TODO: ADD MIPMAP SUPPORT but NOT SUPPORTED FOR ES 2.0
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        // Only apply texture wrap to shapes (glass, faceline)
+        // since those are NPOT textures, otherwise do not use repeat wrap
+        const FFLGLSampler sampler = FFLGLSampler_FromModulateType(pDrawParam->modulateParam.type);
+        FFLGLState_BindSampler(&self->glState, sampler);
 
         // Set the sampler uniform to use texture unit 0
-        glUniform1i(self->samplerLocation, 0);
+        const int textureUnit = 0;
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->samplerLocation, &textureUnit, SHADER_UNIFORM_SAMPLER2D);
+        // Heads that share an atlas page only differ in these, not in the texture
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM],
+            pTexCoordTransform, SHADER_UNIFORM_VEC4);
+        // The sampler would wrap the whole page, so wrap within the region instead
+        const int texCoordWrap = FFLTextureAtlasWrap_FromSampler(pRegion, sampler);
+        FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP],
+            &texCoordWrap, SHADER_UNIFORM_INT);
+        if (pRegion != NULL)
+            FFLGLState_SetUniform(&self->glState, &self->uniformShadow, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS],
+                &pRegion->texCoordBounds, SHADER_UNIFORM_VEC4);
     } else {
         // If there is no texture, bind nothing
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        FFLGLState_BindTexture(&self->glState, 0);
     }
 
     if (pDrawParam->primitiveParam.pIndexBuffer != NULL)
     {
         TraceLog(LOG_TRACE, "Binding index buffer: %p", pDrawParam->primitiveParam.pIndexBuffer);
-        // Bind and set up vertex attributes
-        #ifndef VAO_NOT_SUPPORTED
-        glBindVertexArray(self->vaoHandle);
-        #endif
-
-        for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
+        if (self->pCurrentCharModel != NULL)
+        {
+            // Shape owned by the CharModel, baked the first time it is seen
+            FFLGLShape_Bind(ShaderForFFL_GetShape(self, pDrawParam), &self->attribState);
+        }
+        else
         {
-            const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
-            int location = self->attributeLocation[type];
-            void* ptr = buffer->ptr;
+            // Temporary shape (faceline/mask textures), set up and upload every time
+            #ifndef VAO_NOT_SUPPORTED
+            glBindVertexArray(self->vaoHandle);
+            #endif
+            FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
 
-            if (ptr != NULL && location != -1 && buffer->stride > 0)
+            for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
             {
-                unsigned int stride = buffer->stride;
-                unsigned int vbo_handle = self->vboHandle[type];
-                unsigned int size = buffer->size;
+                const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
+                int location = self->attributeLocation[type];
+                void* ptr = buffer->ptr;
 
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_handle);
-                glBufferData(GL_ARRAY_BUFFER, size, ptr, GL_STATIC_DRAW);
-                glEnableVertexAttribArray(location);
-
-                // Set attribute pointer based on type
-                switch (type)
+                if (ptr != NULL && location != -1 && buffer->stride > 0)
                 {
-                case FFL_ATTRIBUTE_BUFFER_TYPE_POSITION:
-                    glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL:
-#ifndef VAO_NOT_SUPPORTED
-                    glVertexAttribPointer(location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)0);
-#else
-                    glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-#endif
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT:
-                    glVertexAttribPointer(location, 4, GL_BYTE, GL_TRUE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD:
-                    glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_COLOR:
-                    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride, (void*)0);
-                    break;
-                default:
-                    break;
+                    FFLGLShapeAttrib attrib;
+                    ShaderForFFL_GetAttribFormat(type, &attrib);
+
+                    glBindBuffer(GL_ARRAY_BUFFER, self->vboHandle[type]);
+                    glBufferData(GL_ARRAY_BUFFER, buffer->size, ptr, GL_STREAM_DRAW);
+                    glEnableVertexAttribArray(location);
+                    glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, buffer->stride, (void*)0);
                 }
+                else if (location != -1)
+                    glDisableVertexAttribArray(location);
             }
-            else if (location != -1)
-                glDisableVertexAttribArray(location);
-        }
 
-        // Create and bind index buffer
-        GLuint indexBufferHandle;
-        glGenBuffers(1, &indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, pDrawParam->primitiveParam.indexCount * sizeof(unsigned short), pDrawParam->primitiveParam.pIndexBuffer, GL_STATIC_DRAW);
+            FFLGLBufferCache_Stream(&self->bufferCache, GL_ELEMENT_ARRAY_BUFFER,
+                &self->streamIndexBufferHandle, pDrawParam->primitiveParam.pIndexBuffer,
+                pDrawParam->primitiveParam.indexCount * sizeof(unsigned short));
+        }
 
-        glDepthMask(GL_TRUE); // enable depth writing
+        FFLGLState_SetDepthMask(&self->glState, GL_TRUE); // enable depth writing
 
         // Draw elements
         // primitiveType maps directly to OpenGL primitives
         TraceLog(LOG_TRACE, "glDrawElements(%d)", pDrawParam->primitiveParam.indexCount);
         glDrawElements(pDrawParam->primitiveParam.primitiveType, pDrawParam->primitiveParam.indexCount, GL_UNSIGNED_SHORT, 0);
-
-        // Cleanup
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDeleteBuffers(1, &indexBufferHandle);
-
-        #ifndef VAO_NOT_SUPPORTED
-        glBindVertexArray(0);
-        #endif
     }
 
-    // Unbind the texture
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Disable shader
-    EndShaderMode();
+    // NOTE: The texture, VAO and shader are left bound
+    // for the next draw, ShaderForFFL_Unbind resets them
 }
 
 
 FFLResourceDesc gResourceDesc; // Global so data can be freed
+FFLResourceFile gResourceFileHigh; // Owns gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH]
 
 const char* cFFLResourceHighFilename = "./FFLResHigh.dat";
 //const char* cFFLResourceHighFilename = "/home/arian/Downloads/ffl/tools/AFLResHigh_2_3_LE.dat";
@@ -537,48 +756,13 @@ FFLResult InitializeFFL()
     // Reset high size to 0 indicating it is not allocated
     gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = 0;
     gResourceDesc.size[FFL_RESOURCE_TYPE_MIDDLE] = 0; // Skip middle
-    // Open the file in binary mode
-    FILE* file = fopen(cFFLResourceHighFilename, "rb");
-    if (!file) {
-        TraceLog(LOG_ERROR, "Error: Cannot open file %s", cFFLResourceHighFilename);
-        return FFL_RESULT_FS_ERROR;
-    }
-    TraceLog(LOG_DEBUG, "Opened %s", cFFLResourceHighFilename);
-    // Seek to the end to determine file size
-    fseek(file, 0, SEEK_END);
-    unsigned long fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET);  // Go back to the start of the file
-    if (fileSize <= 0) {
-        TraceLog(LOG_ERROR, "Invalid file size for %s", cFFLResourceHighFilename);
-        fclose(file);
-        return FFL_RESULT_FS_ERROR;
-    }
-    /*
-    const size_t alignment = 0x2000;
-    // Allocate aligned memory
-    void* fileData = NULL;
-    if (posix_memalign(&fileData, alignment, (size_t)fileSize)) {
-        TraceLog(LOG_ERROR, "Cannot allocate aligned memory");
-        fclose(file);
-        return FFL_RESULT_ERROR;
-    }
-    */
-    void* fileData = malloc((size_t)fileSize);
-    // Read the file data into fileData
-    size_t bytesRead = fread(fileData, 1, (size_t)fileSize, file);
-    if (bytesRead == fileSize) {
-        // Store the data and size in the appropriate resource type slot
-        gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH] = fileData;
-        gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = (size_t)fileSize;
-    } else {
-        TraceLog(LOG_ERROR, "Cannot read file %s", cFFLResourceHighFilename);
-        free(fileData);
-        fclose(file);
-
-        return FFL_RESULT_FS_ERROR;
-    }
-    // Close the file because we are done reading it
-    fclose(file);
+    // Mapped instead of copied where possible, see ffl_resource_helpers.c
+    FFLResult loadResult = FFLResourceFile_Load(&gResourceFileHigh, cFFLResourceHighFilename);
+    if (loadResult != FFL_RESULT_OK)
+        return loadResult;
+    // Store the data and size in the appropriate resource type slot
+    gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH] = gResourceFileHigh.pData;
+    gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = gResourceFileHigh.size;
 
     FFLResult result;
     TraceLog(LOG_DEBUG, "Calling FFLInitResEx");
@@ -609,6 +793,10 @@ const unsigned char cLaneStoreData[96] = {
     0x03, 0x01, 0x00, 0x30, 0x80, 0x21, 0x58, 0x64, 0x80, 0x44, 0x00, 0xa0, 0x91, 0xcd, 0xf6, 0x74, 0xe0, 0x0c, 0x7f, 0xe4, 0x7c, 0x69, 0x00, 0x00, 0x58, 0x58, 0x4c, 0x00, 0x61, 0x00, 0x6e, 0x00, 0x65, 0x00, 0x00, 0x00, 0x74, 0x00, 0x00, 0x00, 0x61, 0x00, 0x6e, 0x00, 0x65, 0x00, 0x7f, 0x2e, 0x08, 0x00, 0x33, 0x06, 0xa5, 0x28, 0x43, 0x12, 0xe1, 0x23, 0x84, 0x0e, 0x61, 0x10, 0x15, 0x86, 0x0d, 0x00, 0x20, 0x41, 0x00, 0x52, 0x10, 0x1d, 0x4c, 0x00, 0x61, 0x00, 0x6e, 0x00, 0x65, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x91, 0x78
 };
 
+// Miis drawn side by side, each with its own CharModelRenderState
+#define CHAR_MODEL_COUNT 2
+const unsigned char* cCharModelStoreData[CHAR_MODEL_COUNT] = { cJasmineStoreData, cLaneStoreData };
+
 // forward decls
 void ExitFFL();
 
@@ -620,6 +808,17 @@ void ExitFFL();
 // FFLiInvalidatePartsTextures
 #include <nn/ffl/FFLiRawMask.h> // FFLiInvalidateRawMask, FFLiDrawRawMask
 
+// Every CharModel is created with this, also by FFLCharModelPipeline
+const FFLCharModelDesc cCharModelDesc = {
+    .resolution = (FFLResolution)512,
+    .expressionFlag =
+            (1 << FFL_EXPRESSION_NORMAL
+            | 1 << FFL_EXPRESSION_BLINK),
+    //.expressionFlag = 1 << FFL_EXPRESSION_PUZZLED,
+    .modelFlag = FFL_MODEL_FLAG_NORMAL, //FFL_MODEL_FLAG_FACE_ONLY,
+    .resourceType = FFL_RESOURCE_TYPE_HIGH
+};
+
 // calls FFLInitCharModelCPUStep, loading charmodel data,
 // , loading shapes, loading textures, uploading textures
 FFLResult CreateCharModelFromStoreData(FFLCharModel* pCharModel, const void* pStoreDataBuffer)
@@ -630,23 +829,10 @@ FFLResult CreateCharModelFromStoreData(FFLCharModel* pCharModel, const void* pSt
         .index = 0,
     };
 
-    const u32 expressionFlag =
-            (1 << FFL_EXPRESSION_NORMAL
-            | 1 << FFL_EXPRESSION_BLINK);
-
-    //const FFLExpressionFlag expressionFlag = 1 << FFL_EXPRESSION_PUZZLED;
-
-    FFLCharModelDesc modelDesc = {
-        .resolution = (FFLResolution)512,
-        .expressionFlag = expressionFlag,
-        .modelFlag = FFL_MODEL_FLAG_NORMAL, //FFL_MODEL_FLAG_FACE_ONLY,
-        .resourceType = FFL_RESOURCE_TYPE_HIGH
-    };
-
     FFLResult result;
 
     TraceLog(LOG_DEBUG, "Calling FFLInitCharModelCPUStep");
-    result = FFLInitCharModelCPUStep(pCharModel, &modelSource, &modelDesc);
+    result = FFLInitCharModelCPUStep(pCharModel, &modelSource, &cCharModelDesc);
 
     if (result != FFL_RESULT_OK)
     {
@@ -659,11 +845,93 @@ FFLResult CreateCharModelFromStoreData(FFLCharModel* pCharModel, const void* pSt
     return FFL_RESULT_OK;
 }
 
+// Get the mask of an expression from gCharModelTextureCache, or draw it
+// with the mask draw params that InitCharModelTextures kept. Drawing
+// switches to the atlas render texture, so call it outside of BeginDrawing.
+static FFLCharModelTexture* AcquireCharModelMask(CharModelRenderState* pState, FFLExpression expression)
+{
+    FFLiCharModel* piCharModel = (FFLiCharModel*)&pState->charModel;
+    const FFLResolution textureResolution = piCharModel->charModelDesc.resolution & FFL_RESOLUTION_MASK;
+
+    FFLCharModelTextureKey key;
+    FFLCharModelTextureKey_InitMask(&key, &piCharModel->charInfo, expression,
+        textureResolution, piCharModel->charModelDesc.resourceType);
+    FFLCharModelTexture* pMask = FFLCharModelTextureCache_Acquire(&gCharModelTextureCache, &key);
+    if (pMask != NULL) // drawn before, maybe by another CharModel
+        return pMask;
+
+    assert(piCharModel->pTextureTempObject != NULL); // deleted by DeleteCharModelMaskDrawParams
+    pMask = FFLCharModelTextureCache_Add(&gCharModelTextureCache, &key, textureResolution, textureResolution);
+    if (pMask == NULL)
+        return NULL;
+    TraceLog(LOG_DEBUG, "Drawing mask for expression %d in texture atlas: texture ID %d at %d, %d",
+        expression, pMask->region.texture, pMask->region.x, pMask->region.y);
+
+    ShaderForFFL_Bind(&gShaderForFFL);
+    Matrix texturesMatrix = MatrixIdentity();
+    ShaderForFFL_SetViewUniform(&gShaderForFFL, NULL, NULL, &texturesMatrix);
+
+    FFLiMaskTexturesTempObject* pObject = &piCharModel->pTextureTempObject->maskTextures;
+    FFLiInvalidateRawMask(pObject->pRawMaskDrawParam[expression]); // before ANY drawing
+
+    // switch to this region, cleared to rgba 0 0 0 0
+    FFLTextureAtlas_BeginRegion(&gCharModelTextureAtlas, &pMask->region, BLANK);
+    FFLGLState_Invalidate(&gShaderForFFL.glState); // raylib may change state
+    ShaderForFFL_SetCulling(&gShaderForFFL, FFL_CULL_MODE_NONE);
+
+    // mask blending
+    // glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_DST_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
+    rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
+    rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
+    glBlendEquation(GL_FUNC_ADD);
+
+    FFLShaderCallback* pCallback = &gShaderForFFL.callback;
+    FFLiDrawRawMask(pObject->pRawMaskDrawParam[expression], &pCallback); // submits draw calls to your callback
+    FFLTextureAtlas_EndRegion(&gCharModelTextureAtlas);
+
+    ShaderForFFL_Unbind(&gShaderForFFL);
+    rlSetBlendMode(BLEND_ALPHA);
+    return pMask;
+}
+
+// Change the mask that is drawn, drawing it first if it is not in
+// gCharModelTextureCache. This may draw, so call it outside of BeginDrawing.
+void SetCharModelExpression(CharModelRenderState* pState, FFLExpression expression)
+{
+    assert(expression < FFL_EXPRESSION_LIMIT);
+    assert(((FFLiCharModel*)&pState->charModel)->charModelDesc.expressionFlag & (1u << expression)); // not in expressionFlag
+
+    // Released after, so that the mask is not evicted when it is the same
+    FFLCharModelTexture* pOldMask = pState->pMask;
+    pState->pMask = AcquireCharModelMask(pState, expression);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pOldMask);
+
+    FFLSetExpression(&pState->charModel, expression);
+    pState->expression = expression;
+}
+
+// Delete the mask draw params kept by InitCharModelTextures,
+// after UnloadCharModelTextures and before FFLDeleteCharModel
+void DeleteCharModelMaskDrawParams(FFLCharModel* pCharModel)
+{
+    FFLiCharModel* piCharModel = (FFLiCharModel*)pCharModel;
+    if (piCharModel->pTextureTempObject == NULL)
+        return;
+    FFLiDeleteTempObjectMaskTextures(&piCharModel->pTextureTempObject->maskTextures, piCharModel->charModelDesc.allExpressionFlag, piCharModel->charModelDesc.resourceType);
+    FFLiDeleteTextureTempObject(piCharModel);
+    piCharModel->pTextureTempObject = NULL;
+}
+
 // calls FFLInitCharModelGPUStep or our alternative, both draw faceline and masks
-void InitCharModelTextures(FFLCharModel* pCharModel)
+void InitCharModelTextures(CharModelRenderState* pState)
 {
+    FFLCharModel* pCharModel = &pState->charModel;
     TraceLog(LOG_DEBUG, "InitCharModelTextures(%p), drawing faceline and masks...", pCharModel);
 
+    // both are acquired below, NULL for ones that are not drawn
+    pState->pFaceline = NULL;
+    pState->pMask = NULL;
+
     TraceLog(LOG_DEBUG, "Calling ShaderForFFL_Bind");
     ShaderForFFL_Bind(&gShaderForFFL); // for init textures
 
@@ -701,32 +969,44 @@ void InitCharModelTextures(FFLCharModel* pCharModel)
 
     FFLResolution textureResolution = piCharModel->charModelDesc.resolution & FFL_RESOLUTION_MASK;
     TraceLog(LOG_DEBUG, "Faceline/mask texture resolution: %d", textureResolution);
-    // apply linear filtering to mask and faceline textures
-    const int renderTextureFilter = TEXTURE_FILTER_BILINEAR;
 
-    ShaderForFFL_SetCulling(FFL_CULL_MODE_NONE);
+    ShaderForFFL_SetCulling(&gShaderForFFL, FFL_CULL_MODE_NONE);
 
     void** ppFacelineTexture2D = (void*)&piCharModel->facelineRenderTexture; // HACK: FFLiRenderTexture = FFLTexture**
-    if (*ppFacelineTexture2D != NULL) // should we draw the faceline texture?
+    bool shouldDrawFaceline = false;
+    if (*ppFacelineTexture2D != NULL) // does this CharModel have a faceline texture?
+    {
+        FFLCharModelTextureKey facelineKey;
+        FFLCharModelTextureKey_InitFaceline(&facelineKey, &piCharModel->charInfo,
+            textureResolution, piCharModel->charModelDesc.resourceType);
+        pState->pFaceline = FFLCharModelTextureCache_Acquire(&gCharModelTextureCache, &facelineKey);
+        if (pState->pFaceline != NULL)
+            TraceLog(LOG_DEBUG, "Sharing faceline texture: texture ID %d at %d, %d", pState->pFaceline->region.texture,
+                pState->pFaceline->region.x, pState->pFaceline->region.y);
+        else
+        {
+            pState->pFaceline = FFLCharModelTextureCache_Add(&gCharModelTextureCache, &facelineKey,
+                textureResolution / 2, textureResolution);
+            shouldDrawFaceline = pState->pFaceline != NULL;
+        }
+    }
+
+    if (shouldDrawFaceline)
     {
-        // assuming there is only one faceline texture ever, which there is
-        gFacelineRenderTexture = LoadRenderTexture(textureResolution / 2, textureResolution);
-        TraceLog(LOG_DEBUG, "Created render texture for faceline: %p, texture ID %d",
-            &gFacelineRenderTexture, gFacelineRenderTexture.texture.id);
-        // faceline texture
-        BeginTextureMode(gFacelineRenderTexture);
-        SetTextureFilter(gFacelineRenderTexture.texture, renderTextureFilter);
+        TraceLog(LOG_DEBUG, "Drawing faceline in texture atlas: texture ID %d at %d, %d",
+            pState->pFaceline->region.texture, pState->pFaceline->region.x, pState->pFaceline->region.y);
         FFLiInvalidateTempObjectFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture); // before drawing...
 
         FFLColor facelineColor = FFLGetFacelineColor(piCharModel->charInfo.parts.facelineColor);
         TraceLog(LOG_DEBUG, "Faceline color: %f, %f, %f, %f", facelineColor.r, facelineColor.g, facelineColor.b, facelineColor.a);
-        // set raylib color from FFLColor
-        ClearBackground((Color) {
+        // faceline texture, cleared to the raylib color from FFLColor
+        FFLTextureAtlas_BeginRegion(&gCharModelTextureAtlas, &pState->pFaceline->region, (Color) {
             (unsigned char)(facelineColor.r * 255.0f),
             (unsigned char)(facelineColor.g * 255.0f),
             (unsigned char)(facelineColor.b * 255.0f),
             (unsigned char)(facelineColor.a * 255.0f),
         });
+        FFLGLState_Invalidate(&gShaderForFFL.glState); // raylib may change state
 
         //glClearColor(facelineColor.r, facelineColor.g, facelineColor.b, facelineColor.a);
 
@@ -738,74 +1018,53 @@ void InitCharModelTextures(FFLCharModel* pCharModel)
 
         FFLiDrawFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture, ppCallback);
                                                     // FFLiShaderCallback = **FFLShaderCallback
+        FFLTextureAtlas_EndRegion(&gCharModelTextureAtlas);
     }
     else
     {
-        TraceLog(LOG_DEBUG, "Skipping rendering faceline texture (*ppFacelineTexture2D == NULL)");
+        TraceLog(LOG_DEBUG, "Skipping rendering faceline texture (none or shared)");
     }
 
 
-    // begin drrawing mask
+    // Only the mask of the current expression is drawn, after
+    // this, and the others when they are first used
     FFLiMaskTexturesTempObject* pObject = &piCharModel->pTextureTempObject->maskTextures;
-    FFLiInvalidatePartsTextures(&pObject->partsTextures); // before looping at ALL
-
-    // NOTE: LOOP BEGINS HERE
-    u32 lExpressionFlag = piCharModel->charModelDesc.expressionFlag;
-    for (u32 i = 0; lExpressionFlag != 0; i++, lExpressionFlag >>= 1)
-    {
-        if ((lExpressionFlag & 1) == 0)
-            //pMaskTextures->pRenderTextures[i] = NULL;
-            continue;
-
-        TraceLog(LOG_DEBUG, "Enabled expression: %d", i);
-
-        // create this mask texture
-        gMaskRenderTextures[i] = LoadRenderTexture(textureResolution, textureResolution);
-        TraceLog(LOG_DEBUG, "Created mask texture for expression %d: %p, texture ID %d",
-            i, &gMaskRenderTextures[i], gMaskRenderTextures[i].texture.id);
+    FFLiInvalidatePartsTextures(&pObject->partsTextures); // before drawing ANY mask
 
-        SetTextureFilter(gMaskRenderTextures[i].texture, renderTextureFilter);
+    pState->expression = (FFLExpression)piCharModel->expression;
 
-        // begin rendering to this mask texture
-        FFLiInvalidateRawMask(pObject->pRawMaskDrawParam[i]); // after verifying thisis supposed to be drawn but before ANY drawing
 
-        BeginTextureMode(gMaskRenderTextures[i]); // switch to this texture mode
-        ClearBackground(BLANK); // rgba 0 0 0 0
 
-        // mask blending
-        //glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_DST_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
-        rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
-        rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
-        glBlendEquation(GL_FUNC_ADD);
-
-        FFLiDrawRawMask(pObject->pRawMaskDrawParam[i], ppCallback); // submits draw calls to your callback
-    }
-    // set current expresssion as the mask
-    gMaskRenderTextureCurrent = &gMaskRenderTextures[piCharModel->expression];
-
-
-
-    // cleanup!!!
+    // cleanup!!! the mask draw params are kept, see DeleteCharModelMaskDrawParams
     if (*ppFacelineTexture2D != NULL)
         FFLiDeleteTempObjectFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture, &piCharModel->charInfo, piCharModel->charModelDesc.resourceType);
-    FFLiDeleteTempObjectMaskTextures(&piCharModel->pTextureTempObject->maskTextures, piCharModel->charModelDesc.allExpressionFlag, piCharModel->charModelDesc.resourceType);
-    FFLiDeleteTextureTempObject(piCharModel);
 
-    EndTextureMode();
+    ShaderForFFL_Unbind(&gShaderForFFL);
     // Go back to normal blend mode
     rlSetBlendMode(BLEND_ALPHA);
     /*
     rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
     rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
 */
+    // draws the mask of the current expression
+    SetCharModelExpression(pState, pState->expression);
     // FFLInitCharModelGPUStep does not return anything so neither do we
     TraceLog(LOG_DEBUG, "Exiting InitCharModelTextures");
 }
 
-void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel* pCharModel, FFLExpression initialExpression, double now);
+void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, CharModelRenderState* pState, FFLExpression initialExpression, double now);
 
 void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLTexture* pTexture)
 {
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    FFLDeferredTextureList* pDeferredTextures = FFLDeferredTextureList_GetCurrent();
+    if (pDeferredTextures != NULL)
+    {
+        // No GL context on the worker, created when the model is picked up
+        FFLDeferredTextureList_PushCreate(pDeferredTextures, pTextureInfo, pTexture);
+        return;
+    }
+#endif
 /*
     if (!pTextureInfo || !pTexture)
         return; // Invalid input
@@ -828,11 +1087,9 @@ void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLText
     glGenTextures(1, &textureHandle);
     glBindTexture(GL_TEXTURE_2D, textureHandle);
 
-    // Configure texture parameters (wrap and filter modes)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Configure texture parameters (wrap and filter modes) once here,
+    // draws only bind a sampler (or change the wrap mode without sampler objects)
+    FFLGLSampler_SetTextureParams(FFL_GL_SAMPLER_CLAMP);
 
     // Determine OpenGL format based on FFLTextureInfo format
     GLenum internalFormat, format, type;
@@ -922,6 +1179,17 @@ void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLText
 
 void TextureCallback_Delete(void* v, FFLTexture* pTexture)
 {
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    FFLDeferredTextureList* pDeferredTextures = FFLDeferredTextureList_GetCurrent();
+    if (pDeferredTextures != NULL)
+    {
+        // When building failed, or a model that was not picked up is deleted,
+        // the texture was not created yet
+        if (!FFLDeferredTextureList_PushDelete(pDeferredTextures, pTexture))
+            TraceLog(LOG_WARNING, "DeleteTexture: texture %p was not recorded in the deferred texture list", pTexture);
+        return;
+    }
+#endif
 /*
     if (!pTexture || !*pTexture)
         return; // Invalid input
@@ -941,9 +1209,248 @@ void TextureCallback_Delete(void* v, FFLTexture* pTexture)
     *(void**)pTexture = (void*)NULL;
 }
 
+#ifdef FFL_HEADLESS_EGL
 
-int main(void)
+#ifdef FFL_USE_TEXTURE_CALLBACK
+const FFLTextureCallback cHeadlessTextureCallback = {
+    .useOriginalTileMode = false,
+    .pCreateFunc = TextureCallback_Create,
+    .pDeleteFunc = TextureCallback_Delete
+};
+#endif // FFL_USE_TEXTURE_CALLBACK
+
+// FFL, the context and everything used to draw, for RenderHeadless and RenderHeadlessBatch
+static bool InitializeHeadless(FFLHeadlessContext* pContext, int size)
 {
+    if (InitializeFFL() != FFL_RESULT_OK)
+    {
+        TraceLog(LOG_ERROR, "FFL is not available :(");
+        return false;
+    }
+    if (!FFLHeadlessContext_Initialize(pContext, size, size))
+    {
+        ExitFFL();
+        return false;
+    }
+
+    ShaderForFFL_Initialize(&gShaderForFFL);
+    FFLTextureAtlas_Initialize(&gCharModelTextureAtlas, TEXTURE_FILTER_BILINEAR);
+    FFLCharModelTextureCache_Initialize(&gCharModelTextureCache, &gCharModelTextureAtlas,
+        FFL_CHAR_MODEL_TEXTURE_CACHE_BUDGET_DEFAULT);
+
+#ifdef FFL_USE_TEXTURE_CALLBACK
+    FFLSetTextureCallback(&cHeadlessTextureCallback);
+#endif // FFL_USE_TEXTURE_CALLBACK
+    FFLSetTextureFlipY(true);
+    return true;
+}
+
+static void FinalizeHeadless(FFLHeadlessContext* pContext)
+{
+    FFLCharModelTextureCache_Destroy(&gCharModelTextureCache);
+    FFLTextureAtlas_Destroy(&gCharModelTextureAtlas);
+    ShaderForFFL_Finalize(&gShaderForFFL);
+    FFLHeadlessContext_Destroy(pContext);
+    ExitFFL();
+}
+
+// Draw the head into renderTexture, framed like Wii U Mii icons on a transparent background
+static void DrawCharModelIcon(RenderTexture renderTexture, CharModelRenderState* pState)
+{
+    Camera camera = { 0 };
+    camera.position = (Vector3){ 0.0f, 34.5f, 415.7f };
+    camera.target = (Vector3){ 0.0f, 34.5f, 0.0f };
+    camera.up = (Vector3){ 0.0f, 1.0f, 0.0f };
+    camera.fovy = 15.0f;
+    camera.projection = CAMERA_PERSPECTIVE;
+
+    FFLCharModel* pCharModel = &pState->charModel;
+    BeginTextureMode(renderTexture);
+        ClearBackground(BLANK);
+        BeginMode3D(camera);
+            rlDrawRenderBatchActive();
+            Matrix matView = rlGetMatrixModelview();
+            Matrix matProjection = rlGetMatrixProjection();
+            Matrix matModel = MatrixIdentity();
+
+            ShaderForFFL_Bind(&gShaderForFFL);
+            ShaderForFFL_SetViewUniform(&gShaderForFFL, &matModel, &matView, &matProjection);
+            ShaderForFFL_SetCharModel(&gShaderForFFL, pCharModel);
+            FFLDrawOpa(pCharModel);
+            FFLDrawXlu(pCharModel);
+            ShaderForFFL_Unbind(&gShaderForFFL);
+        EndMode3D();
+    EndTextureMode();
+}
+
+static void DeleteHeadlessCharModel(CharModelRenderState* pState)
+{
+    ShaderForFFL_InvalidateCharModel(&gShaderForFFL, &pState->charModel);
+    UnloadCharModelTextures(pState);
+    DeleteCharModelMaskDrawParams(&pState->charModel);
+    FFLDeleteCharModel(&pState->charModel);
+}
+
+// Render the head of one Mii into a PNG without a window:
+// ffl_raylib_shader_basic --headless <StoreData hex, file or -> [output.png or -] [size]
+int RenderHeadless(int argc, char** argv)
+{
+    SetTraceLogCallback(FFLHeadless_TraceLogCallback); // the image may go to stdout
+    if (argc < 1)
+    {
+        TraceLog(LOG_ERROR, "Usage: ffl_raylib_shader_basic --headless <StoreData hex, file or -> [output.png or -] [size]");
+        return 1;
+    }
+    const char* outputPath = argc > 1 ? argv[1] : "icon.png";
+    const int size = argc > 2 ? atoi(argv[2]) : 256;
+    u8 storeData[FFL_HEADLESS_STORE_DATA_SIZE];
+    if (size <= 0 || !FFLHeadless_ReadStoreData(argv[0], storeData))
+        return 1;
+
+    FFLHeadlessContext context;
+    if (!InitializeHeadless(&context, size))
+        return 1;
+
+    bool isExported = false;
+    CharModelRenderState charModelState = { 0 };
+    if (CreateCharModelFromStoreData(&charModelState.charModel, storeData) == FFL_RESULT_OK)
+    {
+        InitCharModelTextures(&charModelState); // does drawing
+
+        RenderTexture renderTexture = LoadRenderTexture(size, size);
+        DrawCharModelIcon(renderTexture, &charModelState);
+        isExported = FFLHeadless_ExportRenderTexture(renderTexture, outputPath);
+        if (isExported)
+            TraceLog(LOG_INFO, "Wrote %dx%d icon to %s", size, size, outputPath);
+        UnloadRenderTexture(renderTexture);
+
+        DeleteHeadlessCharModel(&charModelState);
+    }
+    else
+        TraceLog(LOG_ERROR, "Cannot create a CharModel from the StoreData");
+
+    FinalizeHeadless(&context);
+    return isExported ? 0 : 1;
+}
+
+// Render the head of every Mii in a file of StoreData, one after another,
+// to <output prefix><index>.png:
+// ffl_raylib_shader_basic --batch <StoreData file> <output prefix> [size]
+//
+// With FFL_CHAR_MODEL_BUILDER_USE_THREAD, the next CharModels are built on
+// a worker while the main thread does everything outside of FFL. Images are read back once the GPU is done
+// with them and written to PNGs on an encoder thread, see FFLHeadlessReadback.
+int RenderHeadlessBatch(int argc, char** argv)
+{
+    SetTraceLogCallback(FFLHeadless_TraceLogCallback);
+    if (argc < 2)
+    {
+        TraceLog(LOG_ERROR, "Usage: ffl_raylib_shader_basic --batch <StoreData file> <output prefix> [size]");
+        return 1;
+    }
+    const char* prefix = argv[1];
+    const int size = argc > 2 ? atoi(argv[2]) : 256;
+    if (size <= 0)
+        return 1;
+
+    int fileSize = 0;
+    u8* pStoreData = LoadFileData(argv[0], &fileSize);
+    if (pStoreData == NULL)
+        return 1;
+    const u32 count = (u32)fileSize / FFL_HEADLESS_STORE_DATA_SIZE;
+    if (fileSize % FFL_HEADLESS_STORE_DATA_SIZE != 0)
+        TraceLog(LOG_WARNING, "%s has %d bytes after the last StoreData, ignoring them",
+            argv[0], fileSize % FFL_HEADLESS_STORE_DATA_SIZE);
+
+    FFLHeadlessContext context;
+    if (!InitializeHeadless(&context, size))
+    {
+        UnloadFileData(pStoreData);
+        return 1;
+    }
+
+    FFLHeadlessReadback readback;
+    if (!FFLHeadlessReadback_Initialize(&readback, size, size, prefix))
+    {
+        FinalizeHeadless(&context);
+        UnloadFileData(pStoreData);
+        return 1;
+    }
+    RenderTexture renderTexture = LoadRenderTexture(size, size);
+
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    FFLCharModelPipeline pipeline;
+    const bool isPipelineStarted = FFLCharModelPipeline_Initialize(&pipeline, pStoreData,
+        FFL_HEADLESS_STORE_DATA_SIZE, count, &cCharModelDesc);
+#endif
+
+    u32 failedCount = 0;
+    const double startTime = FFLHeadless_GetTime();
+    for (u32 index = 0; index < count; index++)
+    {
+        CharModelRenderState charModelState = { 0 };
+        FFLResult result;
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+        u32 builtIndex;
+        if (isPipelineStarted)
+        {
+            FFLCharModelPipeline_Next(&pipeline, &cHeadlessTextureCallback,
+                &charModelState.charModel, &result, &builtIndex);
+            assert(builtIndex == index);
+        }
+        else
+#endif
+            result = CreateCharModelFromStoreData(&charModelState.charModel,
+                pStoreData + (size_t)index * FFL_HEADLESS_STORE_DATA_SIZE);
+        if (result != FFL_RESULT_OK)
+        {
+            TraceLog(LOG_WARNING, "Skipping StoreData %u, creating its CharModel failed with result: %d", index, result);
+            failedCount++;
+            continue;
+        }
+
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+        // The worker may be in FFL building the next ones
+        if (isPipelineStarted)
+            FFLCharModelPipeline_LockFFL(&pipeline);
+#endif
+        InitCharModelTextures(&charModelState); // does drawing
+        DrawCharModelIcon(renderTexture, &charModelState);
+        DeleteHeadlessCharModel(&charModelState);
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+        if (isPipelineStarted)
+            FFLCharModelPipeline_UnlockFFL(&pipeline);
+#endif
+        // GL keeps what the draws used until they are done
+        FFLHeadlessReadback_Push(&readback, renderTexture, index);
+    }
+    failedCount += FFLHeadlessReadback_Flush(&readback);
+    const double seconds = FFLHeadless_GetTime() - startTime;
+    TraceLog(LOG_INFO, "Rendered %u of %u icons in %.2f s, %.1f per second",
+        count - failedCount, count, seconds, seconds > 0.0 ? (count - failedCount) / seconds : 0.0);
+
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    if (isPipelineStarted)
+        FFLCharModelPipeline_Finalize(&pipeline);
+#endif
+    FFLHeadlessReadback_Destroy(&readback);
+    UnloadRenderTexture(renderTexture);
+    FinalizeHeadless(&context);
+    UnloadFileData(pStoreData);
+    return failedCount == 0 ? 0 : 1;
+}
+
+#endif // FFL_HEADLESS_EGL
+
+int main(int argc, char** argv)
+{
+#ifdef FFL_HEADLESS_EGL
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0)
+        return RenderHeadless(argc - 2, argv + 2);
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+        return RenderHeadlessBatch(argc - 2, argv + 2);
+#endif
+
     SetTraceLogLevel(LOG_DEBUG);
     // Initialize FFL
 
@@ -963,6 +1470,10 @@ int main(void)
 
     TraceLog(LOG_DEBUG, "Calling ShaderForFFL_Initialize(%p)", &gShaderForFFL);
     ShaderForFFL_Initialize(&gShaderForFFL);
+    // apply linear filtering to mask and faceline textures
+    FFLTextureAtlas_Initialize(&gCharModelTextureAtlas, TEXTURE_FILTER_BILINEAR);
+    FFLCharModelTextureCache_Initialize(&gCharModelTextureCache, &gCharModelTextureAtlas,
+        FFL_CHAR_MODEL_TEXTURE_CACHE_BUDGET_DEFAULT);
 
 #ifdef FFL_USE_TEXTURE_CALLBACK
     FFLTextureCallback textureCallback = {
@@ -976,14 +1487,18 @@ int main(void)
     // custom FFL function that flips Y for mask/faceline (ASSUMES default gl clip control...)
     FFLSetTextureFlipY(true);
 
-    FFLCharModel charModel;
-    bool isFFLModelCreated = false;
-    if (isFFLAvailable)
+    CharModelRenderState charModelStates[CHAR_MODEL_COUNT] = { 0 }; // CharModels and their textures
+    bool isFFLModelCreated[CHAR_MODEL_COUNT] = { false };
+    for (int i = 0; i < CHAR_MODEL_COUNT && isFFLAvailable; i++)
     {
-        TraceLog(LOG_DEBUG, "Creating FFLCharModel at %p", &charModel);
-        isFFLModelCreated = CreateCharModelFromStoreData(&charModel, (const void*)(&cJasmineStoreData)) == FFL_RESULT_OK;
-        if (isFFLModelCreated)
-            InitCharModelTextures(&charModel); // does drawing
+        FFLCharModel* pCharModel = &charModelStates[i].charModel;
+        TraceLog(LOG_DEBUG, "Creating FFLCharModel at %p", pCharModel);
+        isFFLModelCreated[i] = CreateCharModelFromStoreData(pCharModel, (const void*)cCharModelStoreData[i]) == FFL_RESULT_OK;
+        if (isFFLModelCreated[i])
+        {
+            InitCharModelTextures(&charModelStates[i]); // does drawing
+            ShaderForFFL_BakeCharModel(&gShaderForFFL, pCharModel); // uploads shapes
+        }
     }
 
     // Set up the camera for the 3D cube
@@ -1001,9 +1516,15 @@ int main(void)
     //--------------------------------------------------------------------------------------
 
     // blinking logic
-    bool isBlinking = false;
-    double lastBlinkTime = GetTime();
-    FFLExpression initialExpression = FFLGetExpression(&charModel);
+    bool isBlinking[CHAR_MODEL_COUNT];
+    double lastBlinkTime[CHAR_MODEL_COUNT];
+    FFLExpression initialExpression[CHAR_MODEL_COUNT];
+    for (int i = 0; i < CHAR_MODEL_COUNT; i++)
+    {
+        isBlinking[i] = false;
+        lastBlinkTime[i] = GetTime() - i * 3.0; // do not blink at the same time
+        initialExpression[i] = isFFLModelCreated[i] ? FFLGetExpression(&charModelStates[i].charModel) : FFL_EXPRESSION_NORMAL;
+    }
 
     // Main game loop
     while (!WindowShouldClose())    // Detect window close button or ESC key
@@ -1021,6 +1542,13 @@ int main(void)
             rotationAngle = now * 45.0f; // 45 degrees per second
         //----------------------------------------------------------------------------------
 
+        // May draw a mask that was not used yet, so not between BeginDrawing and EndDrawing
+        for (int i = 0; i < CHAR_MODEL_COUNT; i++)
+        {
+            if (isFFLModelCreated[i])
+                UpdateCharModelBlink(&isBlinking[i], &lastBlinkTime[i], &charModelStates[i], initialExpression[i], now);
+        }
+
         // Draw
         //----------------------------------------------------------------------------------
         BeginDrawing();
@@ -1036,28 +1564,47 @@ int main(void)
                 // Draw custom OpenGL object after Raylib's 3D drawing
                 rlDrawRenderBatchActive();      // Flush Raylib's internal buffers
 
-                if (isFFLModelCreated) // draw only if it is valid
+                rlPushMatrix();
+                Matrix matView = rlGetMatrixModelview();
+                Matrix matProjection = rlGetMatrixProjection();
+                rlPopMatrix();  // Restore the previous matrix
+
+                ShaderForFFL_Bind(&gShaderForFFL);
+                for (int i = 0; i < CHAR_MODEL_COUNT; i++)
                 {
-                    // FFL model scale is 10.0
-                    Matrix matModel = MatrixScale(0.1, 0.1, 0.1);
-                    rlPushMatrix();
-                    Matrix matView = rlGetMatrixModelview();
-                    Matrix matProjection = rlGetMatrixProjection();
-                    rlPopMatrix();  // Restore the previous matrix
+                    if (!isFFLModelCreated[i]) // draw only if it is valid
+                        continue;
 
-                    UpdateCharModelBlink(&isBlinking, &lastBlinkTime, &charModel, initialExpression, now);
+                    // FFL model scale is 10.0, spaced 3.0 apart
+                    const float x = ((float)i - (float)(CHAR_MODEL_COUNT - 1) / 2.0f) * 3.0f;
+                    Matrix matModel = MatrixMultiply(MatrixScale(0.1, 0.1, 0.1), MatrixTranslate(x, 0.0f, 0.0f));
 
-                    ShaderForFFL_Bind(&gShaderForFFL);
+                    // The draw callback gets the textures from this CharModel
                     ShaderForFFL_SetViewUniform(&gShaderForFFL,
                                                 &matModel, &matView, &matProjection);
-                    FFLDrawOpa(&charModel);
-                    FFLDrawXlu(&charModel);
+                    ShaderForFFL_SetCharModel(&gShaderForFFL, &charModelStates[i].charModel);
+                    FFLDrawOpa(&charModelStates[i].charModel);
+                    FFLDrawXlu(&charModelStates[i].charModel);
                 }
+                ShaderForFFL_Unbind(&gShaderForFFL);
 
             EndMode3D();
 
             // Display FPS100ms
             DrawFPS(10, 10);
+
+            // Buffer objects created vs. reused this frame
+            FFLGLBufferCacheStats bufferStats = ShaderForFFL_ResetBufferStats(&gShaderForFFL);
+            DrawText(TextFormat("Buffers created: %d, avoided: %d", bufferStats.created, bufferStats.reused),
+                10, 35, 10, DARKGRAY);
+            // Same for GL state changes
+            FFLGLStateStats stateStats = ShaderForFFL_ResetStateStats(&gShaderForFFL);
+            DrawText(TextFormat("GL state calls issued: %d, skipped: %d", stateStats.issued, stateStats.skipped),
+                10, 50, 10, DARKGRAY);
+            // Faceline and mask textures drawn vs. shared between CharModels
+            const FFLCharModelTextureCacheStats textureStats = gCharModelTextureCache.stats;
+            DrawText(TextFormat("Faceline/mask textures drawn: %d, shared: %d", textureStats.drawn, textureStats.shared),
+                10, 65, 10, DARKGRAY);
         EndDrawing();
         //----------------------------------------------------------------------------------
     }
@@ -1066,19 +1613,23 @@ int main(void)
     //--------------------------------------------------------------------------------------
 
     UnloadShader(cubeShader);   // Unload default shader
-    UnloadShader(gShaderForFFL.shader); // Unload shader for FFL
 
-    if (isFFLModelCreated)
+    for (int i = 0; i < CHAR_MODEL_COUNT; i++)
     {
-        TraceLog(LOG_DEBUG, "FFLDeleteCharModel(%p)", &charModel);
-        FFLDeleteCharModel(&charModel);
+        if (!isFFLModelCreated[i])
+            continue;
+        FFLCharModel* pCharModel = &charModelStates[i].charModel;
+        TraceLog(LOG_DEBUG, "FFLDeleteCharModel(%p)", pCharModel);
+        ShaderForFFL_InvalidateCharModel(&gShaderForFFL, pCharModel);
+        UnloadCharModelTextures(&charModelStates[i]);
+        DeleteCharModelMaskDrawParams(pCharModel);
         // FFLCharModel destruction must happen before FFLExit, and before GL context is closed
+        FFLDeleteCharModel(pCharModel);
     }
 
-    // assuming that raylib checks if it is loaded or not
-    UnloadRenderTexture(gFacelineRenderTexture);
-    for (int i = 0; i < FFL_EXPRESSION_LIMIT; i++)
-        UnloadRenderTexture(gMaskRenderTextures[i]);
+    FFLCharModelTextureCache_Destroy(&gCharModelTextureCache); // after every CharModelRenderState is unloaded
+    FFLTextureAtlas_Destroy(&gCharModelTextureAtlas);
+    ShaderForFFL_Finalize(&gShaderForFFL); // Unload shader and buffers for FFL
 
     CloseWindow();              // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
@@ -1093,15 +1644,14 @@ int main(void)
 const float cBlinkInterval = 8.0f; // 8 secs
 const float cBlinkDuration = 0.08f; // 80ms
 
-void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel* pCharModel, FFLExpression initialExpression, double now)
+void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, CharModelRenderState* pState, FFLExpression initialExpression, double now)
 {
     //double now = GetTime();
     double timeSinceLastBlink = now - *lastBlinkTime;
 
     // Check if it's time to blink (every 3 seconds = 3000 ms)
     if (!*isBlinking && timeSinceLastBlink >= cBlinkInterval) {
-        //FFLSetExpression(pCharModel, FFL_EXPRESSION_BLINK);
-        SetCharModelExpression(pCharModel, FFL_EXPRESSION_BLINK);
+        SetCharModelExpression(pState, FFL_EXPRESSION_BLINK);
         *isBlinking = true;
         TraceLog(LOG_TRACE, "expression: %d", FFL_EXPRESSION_BLINK);
         *lastBlinkTime = now;  // Reset the blink time
@@ -1109,7 +1659,7 @@ void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel*
 
     // Check if the blink should stop after 100ms
     if (*isBlinking && (now - *lastBlinkTime) >= cBlinkDuration) {
-        SetCharModelExpression(pCharModel, initialExpression); // back to previous
+        SetCharModelExpression(pState, initialExpression); // back to previous
         TraceLog(LOG_TRACE, "expression: %d", initialExpression);
         *isBlinking = false;
     }
@@ -1120,8 +1670,8 @@ void ExitFFL()
     TraceLog(LOG_DEBUG, "Calling FFLExit");
     FFLExit();
 
-    if (gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] > 0)
-        free(gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH]);
+    FFLResourceFile_Unload(&gResourceFileHigh);
+    gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = 0;
     if (gResourceDesc.size[FFL_RESOURCE_TYPE_MIDDLE] > 0)
         free(gResourceDesc.pData[FFL_RESOURCE_TYPE_MIDDLE]);
 }
@@ -39,6 +39,14 @@
 #include <nn/ffl.h>
 #include <nn/ffl/detail/FFLiCharInfo.h> // optional, should work in C
 
+#include "ffl_gl_state_helpers.c"
+#include "ffl_gl_cache_helpers.c"
+#include "ffl_resource_helpers.c"
+#include "ffl_texture_atlas_helpers.c"
+#include "ffl_char_model_texture_cache_helpers.c"
+#include "ffl_char_model_builder_helpers.c"
+#include "ffl_char_info_edit_helpers.c"
+
 #include "body_scale_helpers_iqm.c"
 
 #define STR_HELPER(x) #x
@@ -53,23 +61,80 @@
         "highp mat3 inverse(highp mat3 m) {\n\thighp float c01 = m[2].z * m[1].y - m[1].z * m[2].y;\n\thighp float c11 = -m[2].z * m[1].x + m[1].z * m[2].x;\n\thighp float c21 = m[2].y * m[1].x - m[1].y * m[2].x;\n\thighp float d = 1.0 / (m[0].x * c01 + m[0].y * c11 + m[0].z * c21);\n\n\treturn mat3(c01, (-m[2].z * m[0].y + m[0].z * m[2].y), (m[1].z * m[0].y - m[0].z * m[1].y),\n\t\t\t\t   c11, (m[2].z * m[0].x - m[0].z * m[2].x), (-m[1].z * m[0].x + m[0].z * m[1].x),\n\t\t\t\t   c21, (-m[2].y * m[0].x + m[0].y * m[2].x), (m[1].y * m[0].x - m[0].y * m[1].x)) *\n\t\t\td;\n}\n\nhighp mat3 transpose(highp mat3 m) {\n\treturn mat3(\n\t\t\tvec3(m[0].x, m[1].x, m[2].x),\n\t\t\tvec3(m[0].y, m[1].y, m[2].y),\n\t\t\tvec3(m[0].z, m[1].z, m[2].z));\n}\n" \
     "#endif\n" \
 #src
-#define GLSL_FRAG(src) "#version " STR(GLSL_VERSION) "\n" \
+// Same as GLSL_FRAG, with declarations that differ between versions before src
+#define GLSL_FRAG_WITH(declarations, src) "#version " STR(GLSL_VERSION) "\n" \
     "#ifndef GL_ES\n" \
         "#define varying in\n" \
         "#define gl_FragColor FragColor\n" \
         "#define texture2D texture\n" \
         "out vec4 FragColor;\n" \
+        "#define TEXCOORD_PRECISION\n" \
     "#else\n" \
         "precision mediump float;\n" \
+        "#ifdef GL_FRAGMENT_PRECISION_HIGH\n" \
+            "#define TEXCOORD_PRECISION highp\n" \
+        "#else\n" \
+            "#define TEXCOORD_PRECISION mediump\n" \
+        "#endif\n" \
     "#endif\n" \
+    declarations \
 #src
+#define GLSL_FRAG(src) GLSL_FRAG_WITH("", src)
+
+// Lighting constants and all materials, see ShaderForFFLParams.
+// Materials are three vec4s each: ambient and specular power,
+// diffuse and specular mode (also SPECULAR_MODE), then specular.
+#ifndef VAO_NOT_SUPPORTED
+// One uniform buffer, uploaded once and shared by every draw
+#define GLSL_FFL_PARAMS STR_HELPER( \
+    uniform int u_material_index; \
+    \
+    layout(std140) uniform FFLShaderParams \
+    { \
+        vec4 u_light[5]; \
+        vec4 u_material[33]; \
+    }; \
+    \
+    void getMaterial(out vec4 ambient, out vec4 diffuse, out vec4 specular) \
+    { \
+        int i = u_material_index * 3; \
+        ambient = u_material[i]; \
+        diffuse = u_material[i + 1]; \
+        specular = u_material[i + 2]; \
+    } \
+)
+#else
+// Without uniform buffers, the same data is in plain uniform arrays.
+// ES 2.0 fragment shaders can only index them with the loop counter.
+#define GLSL_FFL_PARAMS STR_HELPER( \
+    uniform int u_material_index; \
+    \
+    uniform vec4 u_light[5]; \
+    uniform vec4 u_material[33]; \
+    \
+    void getMaterial(out vec4 ambient, out vec4 diffuse, out vec4 specular) \
+    { \
+        for (int i = 0; i < 11; i++) \
+        { \
+            if (i == u_material_index) \
+            { \
+                ambient = u_material[i * 3]; \
+                diffuse = u_material[i * 3 + 1]; \
+                specular = u_material[i * 3 + 2]; \
+            } \
+        } \
+    } \
+)
+#endif
 
+// Attributes use raylib's default names, which raylib binds to the same
+// locations in every program, so that VAOs work with every variant
 const char* vertexShaderCodeFFL = GLSL_VERT(
-    attribute vec4 a_position;
-    attribute vec2 a_texCoord;
-    attribute vec3 a_normal;
-    attribute vec4 a_color;
-    attribute vec3 a_tangent;
+    attribute vec4 vertexPosition;
+    attribute vec2 vertexTexCoord;
+    attribute vec3 vertexNormal;
+    attribute vec4 vertexColor;
+    attribute vec3 vertexTangent;
 
     attribute vec4 vertexBoneIds;
     attribute vec4 vertexBoneWeights;
@@ -83,17 +148,19 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
     uniform   mat4 u_model; //u_mv;
     uniform   mat4 u_view;
     uniform   mat4 u_proj;
-    //uniform   mat4 u_it;
+    uniform   mat3 u_it; // transpose(inverse(mat3(mv))), see GetNormalMatrix3
 
     uniform mat4 boneMatrices[80];
-    uniform int skinningEnabled;
+    uniform mat3 boneNormalMatrices[80]; // same for each of boneMatrices
+    uniform vec4 bonePalette[80 * 3]; // rows of 3x4 bone matrices, see GetBonePalette3x4
+    // SKINNING is defined per variant, see ShaderForFFL_LinkVariant
     /*
         void main()
         {
             vec4 skinnedPosition;
             vec3 skinnedNormal;
             vec3 skinnedTangent;
-            if (skinningEnabled == 1)
+            if (SKINNING == 1)
             {
                 skinnedPosition = vec4(0.0);
                 skinnedNormal = vec3(0.0);
@@ -107,16 +174,16 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
                     mat4 boneMatrix = boneMatrices[boneId];
                     mat3 boneMatrix3 = mat3(boneMatrix); // Extract rotation part
 
-                    skinnedPosition += weight * boneMatrix * a_position;
-                    skinnedNormal += weight * boneMatrix3 * a_normal;
-                    skinnedTangent += weight * boneMatrix3 * a_tangent;
+                    skinnedPosition += weight * boneMatrix * vertexPosition;
+                    skinnedNormal += weight * boneMatrix3 * vertexNormal;
+                    skinnedTangent += weight * boneMatrix3 * vertexTangent;
                 }
             }
             else
             {
-                skinnedPosition = a_position;
-                skinnedNormal.xyz = a_normal;
-                skinnedTangent.xyz = a_tangent;
+                skinnedPosition = vertexPosition;
+                skinnedNormal.xyz = vertexNormal;
+                skinnedTangent.xyz = vertexTangent;
             }
 
             mat4 mv = u_view * u_model;
@@ -128,9 +195,9 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
 
             //v_normal = vec3(0.0, 1.0, 0.0); // for test
             v_normal = normalize(normalMatrix * skinnedNormal.xyz);
-            v_texCoord = a_texCoord;
+            v_texCoord = vertexTexCoord;
             v_tangent = normalize(normalMatrix * skinnedTangent.xyz);
-            v_color = a_color;
+            v_color = vertexColor;
         }
     */
     void main()
@@ -139,46 +206,80 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
         vec3 normal;
         vec3 tangent;
 
-        if (skinningEnabled == 1)
+        if (SKINNING == 1)
         {
             // Transform position
             position = vec4(0.0);
-            position += vertexBoneWeights[0] * boneMatrices[int(vertexBoneIds[0])] * a_position;
-            position += vertexBoneWeights[1] * boneMatrices[int(vertexBoneIds[1])] * a_position;
-            position += vertexBoneWeights[2] * boneMatrices[int(vertexBoneIds[2])] * a_position;
-            position += vertexBoneWeights[3] * boneMatrices[int(vertexBoneIds[3])] * a_position;
+            position += vertexBoneWeights[0] * boneMatrices[int(vertexBoneIds[0])] * vertexPosition;
+            position += vertexBoneWeights[1] * boneMatrices[int(vertexBoneIds[1])] * vertexPosition;
+            position += vertexBoneWeights[2] * boneMatrices[int(vertexBoneIds[2])] * vertexPosition;
+            position += vertexBoneWeights[3] * boneMatrices[int(vertexBoneIds[3])] * vertexPosition;
 
             // Transform normal
 
             vec3 skinnedNormal = vec3(0.0);
-            mat3 normalMatrix0 = transpose(inverse(mat3(boneMatrices[int(vertexBoneIds[0])])));
-            mat3 normalMatrix1 = transpose(inverse(mat3(boneMatrices[int(vertexBoneIds[1])])));
-            mat3 normalMatrix2 = transpose(inverse(mat3(boneMatrices[int(vertexBoneIds[2])])));
-            mat3 normalMatrix3 = transpose(inverse(mat3(boneMatrices[int(vertexBoneIds[3])])));
-
-            skinnedNormal += vertexBoneWeights[0] * (normalMatrix0 * a_normal);
-            skinnedNormal += vertexBoneWeights[1] * (normalMatrix1 * a_normal);
-            skinnedNormal += vertexBoneWeights[2] * (normalMatrix2 * a_normal);
-            skinnedNormal += vertexBoneWeights[3] * (normalMatrix3 * a_normal);
+            mat3 normalMatrix0 = boneNormalMatrices[int(vertexBoneIds[0])];
+            mat3 normalMatrix1 = boneNormalMatrices[int(vertexBoneIds[1])];
+            mat3 normalMatrix2 = boneNormalMatrices[int(vertexBoneIds[2])];
+            mat3 normalMatrix3 = boneNormalMatrices[int(vertexBoneIds[3])];
+
+            skinnedNormal += vertexBoneWeights[0] * (normalMatrix0 * vertexNormal);
+            skinnedNormal += vertexBoneWeights[1] * (normalMatrix1 * vertexNormal);
+            skinnedNormal += vertexBoneWeights[2] * (normalMatrix2 * vertexNormal);
+            skinnedNormal += vertexBoneWeights[3] * (normalMatrix3 * vertexNormal);
             normal = normalize(skinnedNormal);
             /*
             // Transform tangent (if using normal mapping)
             vec3 skinnedTangent = vec3(0.0);
-            skinnedTangent += vertexBoneWeights[0] * (normalMatrix0 * a_tangent);
-            skinnedTangent += vertexBoneWeights[1] * (normalMatrix1 * a_tangent);
-            skinnedTangent += vertexBoneWeights[2] * (normalMatrix2 * a_tangent);
-            skinnedTangent += vertexBoneWeights[3] * (normalMatrix3 * a_tangent);
+            skinnedTangent += vertexBoneWeights[0] * (normalMatrix0 * vertexTangent);
+            skinnedTangent += vertexBoneWeights[1] * (normalMatrix1 * vertexTangent);
+            skinnedTangent += vertexBoneWeights[2] * (normalMatrix2 * vertexTangent);
+            skinnedTangent += vertexBoneWeights[3] * (normalMatrix3 * vertexTangent);
             tangent = normalize(skinnedTangent);
             */
-            tangent = a_tangent;
+            tangent = vertexTangent;
 
-            //normal = a_normal;
+            //normal = vertexNormal;
+        }
+        else if (SKINNING == 2)
+        {
+            // Blend the rows of each bone's 3x4 matrix, then transform once
+            int bone0 = int(vertexBoneIds[0]) * 3;
+            int bone1 = int(vertexBoneIds[1]) * 3;
+            int bone2 = int(vertexBoneIds[2]) * 3;
+            int bone3 = int(vertexBoneIds[3]) * 3;
+
+            vec4 row0 = vertexBoneWeights[0] * bonePalette[bone0]
+                      + vertexBoneWeights[1] * bonePalette[bone1]
+                      + vertexBoneWeights[2] * bonePalette[bone2]
+                      + vertexBoneWeights[3] * bonePalette[bone3];
+            vec4 row1 = vertexBoneWeights[0] * bonePalette[bone0 + 1]
+                      + vertexBoneWeights[1] * bonePalette[bone1 + 1]
+                      + vertexBoneWeights[2] * bonePalette[bone2 + 1]
+                      + vertexBoneWeights[3] * bonePalette[bone3 + 1];
+            vec4 row2 = vertexBoneWeights[0] * bonePalette[bone0 + 2]
+                      + vertexBoneWeights[1] * bonePalette[bone1 + 2]
+                      + vertexBoneWeights[2] * bonePalette[bone2 + 2]
+                      + vertexBoneWeights[3] * bonePalette[bone3 + 2];
+
+            position = vec4(dot(row0, vertexPosition), dot(row1, vertexPosition),
+                            dot(row2, vertexPosition), 1.0);
+
+            // Adjugate of the blended 3x3 (its inverse times the determinant),
+            // multiplying from the left transposes it, so this is
+            // transpose(inverse()) up to a scale that normalize removes
+            // and non-uniform bone scales still give correct normals
+            mat3 adjugate = mat3(cross(row1.xyz, row2.xyz),
+                                 cross(row2.xyz, row0.xyz),
+                                 cross(row0.xyz, row1.xyz));
+            normal = normalize(vertexNormal * adjugate);
+            tangent = vertexTangent;
         }
         else
         {
-            position = a_position;
-            normal = a_normal;
-            tangent = a_tangent;
+            position = vertexPosition;
+            normal = vertexNormal;
+            tangent = vertexTangent;
         }
 
         // Apply model-view and projection transformations
@@ -187,9 +288,9 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
         gl_Position = u_proj * v_position;
 
         // Compute normal matrix for non-skinned vertices
-        //if (skinningEnabled == 0)
+        //if (SKINNING == 0)
         //{
-            mat3 normalMatrix = transpose(inverse(mat3(mv)));
+            mat3 normalMatrix = u_it;
             normal = normalize(normalMatrix * normal);
             // safe normalize
             if (tangent.xyz != vec3(0.0, 0.0, 0.0))
@@ -204,12 +305,12 @@ const char* vertexShaderCodeFFL = GLSL_VERT(
 
         v_normal = normal;
         v_tangent = tangent;
-        v_texCoord = a_texCoord;
-        v_color = a_color;
+        v_texCoord = vertexTexCoord; // into the atlas region in the fragment shader
+        v_color = vertexColor;
     }
 );
 
-const char* fragmentShaderCodeFFL = GLSL_FRAG(
+const char* fragmentShaderCodeFFL = GLSL_FRAG_WITH(GLSL_FFL_PARAMS,
     const int MODULATE_MODE_CONSTANT        = 0;
     const int MODULATE_MODE_TEXTURE_DIRECT  = 1;
     const int MODULATE_MODE_RGB_LAYERED     = 2;
@@ -217,6 +318,9 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
     const int MODULATE_MODE_LUMINANCE_ALPHA = 4;
     const int MODULATE_MODE_ALPHA_OPA       = 5;
 
+    const int TEXCOORD_WRAP_NONE   = 0; // FFLTextureAtlasWrap
+    const int TEXCOORD_WRAP_MIRROR = 2;
+
     float calculateAnisotropicSpecular(vec3 light, vec3 tangent, vec3 eye, float power)
     {
         float dotLT = dot(light, tangent);
@@ -265,94 +369,104 @@ const char* fragmentShaderCodeFFL = GLSL_FRAG(
     varying vec4 v_position;
     varying vec3 v_normal;
     varying vec3 v_tangent;
-    varying vec2 v_texCoord;
+    varying TEXCOORD_PRECISION vec2 v_texCoord;
 
     uniform vec3  u_const1;
     uniform vec3  u_const2;
     uniform vec3  u_const3;
 
-    uniform vec3 u_light_ambient;
-    uniform vec3 u_light_diffuse;
-    uniform vec3 u_light_dir;
-    uniform bool u_light_enable;
-    uniform vec3 u_light_specular;
-
-    uniform vec3 u_material_ambient;
-    uniform vec3 u_material_diffuse;
-    uniform vec3 u_material_specular;
-    uniform int u_material_specular_mode;
-    uniform float u_material_specular_power;
-
-    uniform int u_mode;
-
-    uniform vec3  u_rim_color;
-    uniform float u_rim_power;
+    // MODULATE_MODE, LIGHT_ENABLE and SPECULAR_MODE are defined
+    // per variant, see ShaderForFFL_LinkVariant
 
     uniform sampler2D s_texture;
+    // Atlas pages are up to 4096 texels wide, more than mediump
+    // can address, see TEXCOORD_PRECISION in GLSL_FRAG_WITH
+    uniform TEXCOORD_PRECISION vec4 u_texcoord_transform; // scale in xy, offset in zw, see FFLTextureAtlasRegion
+    uniform TEXCOORD_PRECISION vec4 u_texcoord_bounds; // texCoordBounds of the region
+    uniform int  u_texcoord_wrap;
+
+    // Wrap within the atlas region, since the sampler wraps the whole page
+    TEXCOORD_PRECISION vec2 getTexCoord()
+    {
+        TEXCOORD_PRECISION vec2 texCoord = v_texCoord;
+        if (u_texcoord_wrap == TEXCOORD_WRAP_MIRROR)
+            texCoord = 1.0 - abs(mod(texCoord, 2.0) - 1.0);
+        texCoord = texCoord * u_texcoord_transform.xy + u_texcoord_transform.zw;
+        if (u_texcoord_wrap != TEXCOORD_WRAP_NONE)
+            texCoord = clamp(texCoord, u_texcoord_bounds.xy, u_texcoord_bounds.zw);
+        return texCoord;
+    }
 
     void main()
     {
         vec4 color;
-        float specularPower = u_material_specular_power;
+        TEXCOORD_PRECISION vec2 texCoord = getTexCoord();
         float rimWidth = v_color.a;
 
-        if(u_mode == MODULATE_MODE_CONSTANT)
+        if(MODULATE_MODE == MODULATE_MODE_CONSTANT)
         {
             color = vec4(u_const1, 1.0);
         }
-        else if(u_mode == MODULATE_MODE_TEXTURE_DIRECT)
+        else if(MODULATE_MODE == MODULATE_MODE_TEXTURE_DIRECT)
         {
-            color = texture2D(s_texture, v_texCoord);
+            color = texture2D(s_texture, texCoord);
         }
-        else if(u_mode == MODULATE_MODE_RGB_LAYERED)
+        else if(MODULATE_MODE == MODULATE_MODE_RGB_LAYERED)
         {
-            color = texture2D(s_texture, v_texCoord);
+            color = texture2D(s_texture, texCoord);
             color = vec4(color.r * u_const1.rgb + color.g * u_const2.rgb + color.b * u_const3.rgb, color.a);
         }
-        else if(u_mode == MODULATE_MODE_ALPHA)
+        else if(MODULATE_MODE == MODULATE_MODE_ALPHA)
         {
-            color = texture2D(s_texture, v_texCoord);
+            color = texture2D(s_texture, texCoord);
             color = vec4(u_const1.rgb, color.r);
         }
-        else if(u_mode == MODULATE_MODE_LUMINANCE_ALPHA)
+        else if(MODULATE_MODE == MODULATE_MODE_LUMINANCE_ALPHA)
         {
-            color = texture2D(s_texture, v_texCoord);
+            color = texture2D(s_texture, texCoord);
             color = vec4(color.g * u_const1.rgb, color.r);
         }
-        else if(u_mode == MODULATE_MODE_ALPHA_OPA)
+        else if(MODULATE_MODE == MODULATE_MODE_ALPHA_OPA)
         {
-            color = texture2D(s_texture, v_texCoord);
+            color = texture2D(s_texture, texCoord);
             color = vec4(color.r * u_const1.rgb, 1.0);
         }
 
-        if(u_mode != MODULATE_MODE_CONSTANT && color.a == 0.0)
+        if(MODULATE_MODE != MODULATE_MODE_CONSTANT && color.a == 0.0)
         {
             discard;
         }
 
-        if(u_light_enable)
+        if(LIGHT_ENABLE == 1)
         {
-            vec3 ambient = calculateAmbientColor(u_light_ambient.xyz, u_material_ambient.xyz);
+            vec4 materialAmbient;
+            vec4 materialDiffuse;
+            vec4 materialSpecular;
+            getMaterial(materialAmbient, materialDiffuse, materialSpecular);
+            float specularPower = materialAmbient.w;
+            vec3 lightDir = u_light[0].xyz;
+
+            vec3 ambient = calculateAmbientColor(u_light[1].xyz, materialAmbient.xyz);
             vec3 norm = normalize(v_normal);
             vec3 eye = normalize(-v_position.xyz);
-            float fDot = calculateDot(u_light_dir, norm);
-            vec3 diffuse = calculateDiffuseColor(u_light_diffuse.xyz, u_material_diffuse.xyz, fDot);
-            float specularBlinn = calculateBlinnSpecular(u_light_dir, norm, eye, u_material_specular_power);
+            float fDot = calculateDot(lightDir, norm);
+            vec3 diffuse = calculateDiffuseColor(u_light[2].xyz, materialDiffuse.xyz, fDot);
+            float specularBlinn = calculateBlinnSpecular(lightDir, norm, eye, specularPower);
 
             float reflection;
             float strength = v_color.g;
-            if(u_material_specular_mode == 0) // blinn
+            if(SPECULAR_MODE == 0) // blinn
             {
                 strength = 1.0;
                 reflection = specularBlinn;
             }
             else
             {
-                float specularAniso = calculateAnisotropicSpecular(u_light_dir, v_tangent, eye, u_material_specular_power);
+                float specularAniso = calculateAnisotropicSpecular(lightDir, v_tangent, eye, specularPower);
                 reflection = calculateSpecularBlend(v_color.r, specularBlinn, specularAniso);
             }
-            vec3 specular = calculateSpecularColor(u_light_specular.xyz, u_material_specular.xyz, reflection, strength);
-            vec3 rimColor = calculateRimColor(u_rim_color.rgb, norm.z, rimWidth, u_rim_power);
+            vec3 specular = calculateSpecularColor(u_light[3].xyz, materialSpecular.xyz, reflection, strength);
+            vec3 rimColor = calculateRimColor(u_light[4].rgb, norm.z, rimWidth, u_light[4].a);
             color.rgb = (ambient + diffuse) * color.rgb + specular + rimColor;
         }
 
@@ -481,12 +595,36 @@ const float cRimPower = 2.0f;
     #define SHADER_FFL_SPECULAR_MODE 1 // aniso
 #endif
 
+// Index of each constant in u_light
+enum ShaderFFLLightParam
+{
+    SH_FFL_LIGHT_PARAM_DIR = 0,
+    SH_FFL_LIGHT_PARAM_AMBIENT,
+    SH_FFL_LIGHT_PARAM_DIFFUSE,
+    SH_FFL_LIGHT_PARAM_SPECULAR,
+    SH_FFL_LIGHT_PARAM_RIM, // rgb is color, a is power
+    SH_FFL_LIGHT_PARAM_MAX
+};
+
+// Contents of FFLShaderParams in the shader. Only vec4s,
+// so this is the same as the std140 layout and the uniform arrays.
+typedef struct ShaderForFFLParams
+{
+    Vector4 light[SH_FFL_LIGHT_PARAM_MAX];
+    Vector4 material[MATERIAL_PARAM_SIZE][3];
+} ShaderForFFLParams;
+
+// Uniform buffer binding point used for FFLShaderParams
+#define SH_FFL_PARAMS_BINDING 0
+
 // Shader uniform enums for shader for FFL
 enum ShaderFFLVertexUniform
 {
     SH_FFL_VERTEX_UNIFORM_MV = 0,
     SH_FFL_VERTEX_UNIFORM_PROJ,
-    //SH_FFL_VERTEX_UNIFORM_IT,
+    SH_FFL_VERTEX_UNIFORM_IT,
+    SH_FFL_VERTEX_UNIFORM_BONE_IT,
+    SH_FFL_VERTEX_UNIFORM_BONE_PALETTE,
     SH_FFL_VERTEX_UNIFORM_MAX
 };
 enum ShaderFFLPixelUniform
@@ -494,34 +632,84 @@ enum ShaderFFLPixelUniform
     SH_FFL_PIXEL_UNIFORM_CONST1 = 0,
     SH_FFL_PIXEL_UNIFORM_CONST2,
     SH_FFL_PIXEL_UNIFORM_CONST3,
-    SH_FFL_PIXEL_UNIFORM_LIGHT_AMBIENT,
-    SH_FFL_PIXEL_UNIFORM_LIGHT_DIFFUSE,
-    SH_FFL_PIXEL_UNIFORM_LIGHT_DIR,
-    SH_FFL_PIXEL_UNIFORM_LIGHT_ENABLE,
-    SH_FFL_PIXEL_UNIFORM_LIGHT_SPECULAR,
-    SH_FFL_PIXEL_UNIFORM_MATERIAL_AMBIENT,
-    SH_FFL_PIXEL_UNIFORM_MATERIAL_DIFFUSE,
-    SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR,
-    SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_MODE,
-    SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_POWER,
-    SH_FFL_PIXEL_UNIFORM_MODE,
-    SH_FFL_PIXEL_UNIFORM_RIM_COLOR,
-    SH_FFL_PIXEL_UNIFORM_RIM_POWER,
+    SH_FFL_PIXEL_UNIFORM_MATERIAL_INDEX,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS,
+    SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP,
+#ifdef VAO_NOT_SUPPORTED
+    SH_FFL_PIXEL_UNIFORM_LIGHT, // in a uniform buffer otherwise
+    SH_FFL_PIXEL_UNIFORM_MATERIAL,
+#endif
     SH_FFL_PIXEL_UNIFORM_MAX
 };
+const char* cShaderFFLPixelUniformNames[SH_FFL_PIXEL_UNIFORM_MAX] = {
+    "u_const1",
+    "u_const2",
+    "u_const3",
+    "u_material_index",
+    "u_texcoord_transform",
+    "u_texcoord_bounds",
+    "u_texcoord_wrap",
+#ifdef VAO_NOT_SUPPORTED
+    "u_light",
+    "u_material",
+#endif
+};
+
+// How skinned meshes are transformed, SKINNING in the vertex shader
+enum ShaderFFLSkinningMode
+{
+    SH_FFL_SKINNING_NONE = 0,
+    // boneMatrices from DrawMesh and boneNormalMatrices, four
+    // mat4 and mat3 products per vertex, 7 uniform vectors per bone
+    SH_FFL_SKINNING_MATRIX,
+    // bonePalette, weights are blended into one 3x4 matrix
+    // before transforming, 3 uniform vectors per bone
+    SH_FFL_SKINNING_PALETTE,
+    SH_FFL_SKINNING_MODE_MAX
+};
+
+// Instead of branching on uniforms, the shader is compiled once for each
+// modulate mode, lighting on or off, specular mode and skinning mode.
+// Variants are linked the first time they are used.
+#define SH_FFL_MODULATE_MODE_COUNT 6 // FFL_MODULATE_MODE_CONSTANT to FFL_MODULATE_MODE_ALPHA_OPA
+#define SH_FFL_VARIANT_MAX (SH_FFL_MODULATE_MODE_COUNT * 2 * 2 * SH_FFL_SKINNING_MODE_MAX)
+
+typedef struct ShaderForFFLVariant
+{
+    Shader shader; // id is 0 until it is linked
+    int vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_MAX]; // MV and PROJ are in shader.locs
+    int pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MAX];
+    FFLGLUniformShadow uniformShadow; // uniform values set on this program
+    u32 matrixGeneration; // of the view matrices last set on this program
+} ShaderForFFLVariant;
 
 
 // Shader for FFL
 typedef struct {
-    Shader shader; // Raylib Shader
-    //int vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_MAX];
-    int pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MAX];
+    ShaderForFFLVariant variants[SH_FFL_VARIANT_MAX];
+    ShaderForFFLVariant* pCurrentVariant; // set by ShaderForFFL_SelectVariant
+    int variantCount; // linked so far
+    bool isLightEnabled; // for the variants selected until the next bind
+    Matrix viewUniform[3]; // model, view, projection
+    float normalMatrix[9]; // of model and view, see GetNormalMatrix3
+    u32 matrixGeneration; // incremented when viewUniform changes
+    ShaderForFFLParams params;
     //int samplerLocation;
     int attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
+    u32 attributeLocationMask; // bit for each location in attributeLocation
     GLuint vboHandle[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
     GLuint vaoHandle;
+    GLuint streamIndexBufferHandle; // for draws without a CharModel
+    GLuint paramsBufferHandle; // uniform buffer with ShaderForFFLParams, if supported
     FFLShaderCallback callback;
     void* samplerTexture;
+    FFLGLBufferCache bufferCache; // vertex buffers uploaded per CharModel
+    const FFLCharModel* pCurrentCharModel; // owner of the buffers being drawn, or NULL to stream
+    FFLGLAttribState attribState; // last shape set up without VAOs
+    FFLGLState glState; // filters redundant state changes between draws
+    bool isBaking; // draws only bake shapes, see ShaderForFFL_BakeCharModel
+    FFLGLBufferRecord* pRecord; // draws only record buffers if not NULL, see ShaderForFFL_RekeyCharModel
 } ShaderForFFL;
 
 // define global instance of the shader
@@ -531,85 +719,230 @@ ShaderForFFL gShaderForFFL;
 void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* drawParam);
 void ShaderForFFL_SetMatrixCallback(void* pObj, const float pBaseMtx44f[16]);
 
-int gLocationOfShaderForFFLSkinningEnable;
+// Get transpose(inverse(mat3(m))) as a column-major mat3 for normals,
+// which is the cofactor matrix of the upper 3x3 divided by its determinant
+void GetNormalMatrix3(Matrix m, float* pOut)
+{
+    const float a00 = m.m0, a01 = m.m4, a02 = m.m8;
+    const float a10 = m.m1, a11 = m.m5, a12 = m.m9;
+    const float a20 = m.m2, a21 = m.m6, a22 = m.m10;
+
+    const float c00 = a11 * a22 - a12 * a21;
+    const float c01 = a12 * a20 - a10 * a22;
+    const float c02 = a10 * a21 - a11 * a20;
+    float det = a00 * c00 + a01 * c01 + a02 * c02;
+    if (det == 0.0f)
+        det = 1.0f; // degenerate, normals are normalized anyway
+    const float invDet = 1.0f / det;
+
+    // column 0
+    pOut[0] = c00 * invDet;
+    pOut[1] = (a02 * a21 - a01 * a22) * invDet; // c10
+    pOut[2] = (a01 * a12 - a02 * a11) * invDet; // c20
+    // column 1
+    pOut[3] = c01 * invDet;
+    pOut[4] = (a00 * a22 - a02 * a20) * invDet; // c11
+    pOut[5] = (a02 * a10 - a00 * a12) * invDet; // c21
+    // column 2
+    pOut[6] = c02 * invDet;
+    pOut[7] = (a01 * a20 - a00 * a21) * invDet; // c12
+    pOut[8] = (a00 * a11 - a01 * a10) * invDet; // c22
+}
+
+// Get the top three rows of each bone matrix for bonePalette, the last
+// row of an affine matrix is always (0, 0, 0, 1) so it is not uploaded.
+// Scale is kept as-is, so this works with UpdateModelAnimationBonesScaling.
+void GetBonePalette3x4(const Matrix* pBoneMatrices, int boneCount, Vector4* pOut)
+{
+    for (int i = 0; i < boneCount; i++)
+    {
+        const Matrix m = pBoneMatrices[i];
+        pOut[i * 3 + 0] = (Vector4){ m.m0, m.m4, m.m8, m.m12 };
+        pOut[i * 3 + 1] = (Vector4){ m.m1, m.m5, m.m9, m.m13 };
+        pOut[i * 3 + 2] = (Vector4){ m.m2, m.m6, m.m10, m.m14 };
+    }
+}
+
+// Get the specular mode of cMaterialParam[materialIndex]
+static int ShaderForFFL_GetSpecularMode(int materialIndex)
+{
+    int specularMode = 0; // blinn as default
+    if (SHADER_FFL_SPECULAR_MODE != 0) // if the default is not blinn,
+        specularMode = cMaterialParam[materialIndex].specularMode; // set it
+    return specularMode;
+}
+
+// Pack the lighting constants and cMaterialParam into ShaderForFFLParams,
+// and upload them to a uniform buffer that stays on the GPU if supported
+static void ShaderForFFL_InitializeParams(ShaderForFFL* self)
+{
+    // the shader declares these sizes as literals
+    assert(SH_FFL_LIGHT_PARAM_MAX == 5 && MATERIAL_PARAM_SIZE == 11);
+
+    ShaderForFFLParams* pParams = &self->params;
+    pParams->light[SH_FFL_LIGHT_PARAM_DIR] = (Vector4){ cLightDir.x, cLightDir.y, cLightDir.z, 0.0f };
+    pParams->light[SH_FFL_LIGHT_PARAM_AMBIENT] = (Vector4){ cLightAmbient.x, cLightAmbient.y, cLightAmbient.z, 0.0f };
+    pParams->light[SH_FFL_LIGHT_PARAM_DIFFUSE] = (Vector4){ cLightDiffuse.x, cLightDiffuse.y, cLightDiffuse.z, 0.0f };
+    pParams->light[SH_FFL_LIGHT_PARAM_SPECULAR] = (Vector4){ cLightSpecular.x, cLightSpecular.y, cLightSpecular.z, 0.0f };
+    pParams->light[SH_FFL_LIGHT_PARAM_RIM] = (Vector4){ cRimColor.x, cRimColor.y, cRimColor.z, cRimPower };
+
+    for (int i = 0; i < MATERIAL_PARAM_SIZE; i++)
+    {
+        const FFLiDefaultShaderMaterial* pMaterial = &cMaterialParam[i];
+        const int specularMode = ShaderForFFL_GetSpecularMode(i);
+
+        pParams->material[i][0] = (Vector4){ pMaterial->ambient.x, pMaterial->ambient.y, pMaterial->ambient.z, pMaterial->specularPower };
+        pParams->material[i][1] = (Vector4){ pMaterial->diffuse.x, pMaterial->diffuse.y, pMaterial->diffuse.z, (float)specularMode };
+        pParams->material[i][2] = (Vector4){ pMaterial->specular.x, pMaterial->specular.y, pMaterial->specular.z, 0.0f };
+    }
+
+#ifndef VAO_NOT_SUPPORTED
+    glGenBuffers(1, &self->paramsBufferHandle);
+    glBindBuffer(GL_UNIFORM_BUFFER, self->paramsBufferHandle);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(*pParams), pParams, GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    TraceLog(LOG_DEBUG, "Uploaded %d bytes of shader params to uniform buffer %d",
+        (int)sizeof(*pParams), self->paramsBufferHandle);
+#else
+    self->paramsBufferHandle = 0; // uploaded to each variant instead
+#endif
+}
+
+// Insert lines of #defines after the #version line of a shader,
+// the result must be freed with RL_FREE
+static char* ShaderForFFL_InjectDefines(const char* source, const char* defines)
+{
+    const char* pVersionEnd = strchr(source, '\n');
+    assert(pVersionEnd != NULL); // GLSL_VERT/GLSL_FRAG always begin with #version
+    const size_t versionLength = (size_t)(pVersionEnd - source) + 1;
+    const size_t definesLength = strlen(defines);
+    const size_t restLength = strlen(source) - versionLength;
+
+    char* result = (char*)RL_MALLOC(versionLength + definesLength + restLength + 1);
+    memcpy(result, source, versionLength);
+    memcpy(result + versionLength, defines, definesLength);
+    memcpy(result + versionLength + definesLength, source + versionLength, restLength + 1);
+    return result;
+}
+
+static int ShaderForFFL_GetVariantIndex(FFLModulateMode mode, bool lightEnable, int specularMode, int skinningMode)
+{
+    assert((int)mode >= 0 && (int)mode < SH_FFL_MODULATE_MODE_COUNT);
+    assert(skinningMode >= 0 && skinningMode < SH_FFL_SKINNING_MODE_MAX);
+    return (((int)mode * 2 + (lightEnable ? 1 : 0)) * 2 + (specularMode != 0 ? 1 : 0))
+        * SH_FFL_SKINNING_MODE_MAX + skinningMode;
+}
+
+// Compile and link one variant of the shader
+static void ShaderForFFL_LinkVariant(ShaderForFFL* self, ShaderForFFLVariant* pVariant,
+    FFLModulateMode mode, bool lightEnable, int specularMode, int skinningMode)
+{
+    char* vertexCode = ShaderForFFL_InjectDefines(vertexShaderCodeFFL,
+        TextFormat("#define SKINNING %d\n", skinningMode));
+    char* fragmentCode = ShaderForFFL_InjectDefines(fragmentShaderCodeFFL,
+        TextFormat("#define MODULATE_MODE %d\n#define LIGHT_ENABLE %d\n#define SPECULAR_MODE %d\n",
+            (int)mode, lightEnable ? 1 : 0, specularMode));
+
+    pVariant->shader = LoadShaderFromMemory(vertexCode, fragmentCode);
+    RL_FREE(vertexCode);
+    RL_FREE(fragmentCode);
+    assert(pVariant->shader.locs != NULL); // Shader did not load correctly.
+
+    Shader shader = pVariant->shader;
+    // Get uniform locations
+    shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(shader, "u_model");//"u_mv");
+    shader.locs[SHADER_LOC_MATRIX_VIEW] = GetShaderLocation(shader, "u_view");
+    shader.locs[SHADER_LOC_MATRIX_PROJECTION] = GetShaderLocation(shader, "u_proj");
+    shader.locs[SHADER_LOC_MAP_ALBEDO] = GetShaderLocation(shader, "s_texture");
+    pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_MV] = shader.locs[SHADER_LOC_MATRIX_MODEL];
+    pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_PROJ] = shader.locs[SHADER_LOC_MATRIX_PROJECTION];
+    pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT] = GetShaderLocation(shader, "u_it");
+    pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_BONE_IT] = GetShaderLocation(shader, "boneNormalMatrices");
+    pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_BONE_PALETTE] = GetShaderLocation(shader, "bonePalette");
+    if (skinningMode != SH_FFL_SKINNING_MATRIX)
+        shader.locs[SHADER_LOC_BONE_MATRICES] = -1; // keep DrawMesh from uploading them
+    for (int i = 0; i < SH_FFL_PIXEL_UNIFORM_MAX; i++)
+    {
+        pVariant->pixelUniformLocation[i] = GetShaderLocation(shader, cShaderFFLPixelUniformNames[i]);
+        TraceLog(LOG_TRACE, "Pixel uniform '%s' location: %d", cShaderFFLPixelUniformNames[i], pVariant->pixelUniformLocation[i]);
+    }
+
+    FFLGLUniformShadow_Invalidate(&pVariant->uniformShadow);
+    pVariant->matrixGeneration = 0; // never matches self->matrixGeneration
+
+    // Draws that sample the texture atlas change these, others keep them
+    FFLGLState_UseProgram(&self->glState, shader.id);
+    const int texCoordWrap = FFL_TEXTURE_ATLAS_WRAP_NONE;
+    FFLGLState_SetUniform(&self->glState, &pVariant->uniformShadow,
+        pVariant->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM],
+        &cFFLTextureAtlasIdentityTransform, SHADER_UNIFORM_VEC4);
+    FFLGLState_SetUniform(&self->glState, &pVariant->uniformShadow,
+        pVariant->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP],
+        &texCoordWrap, SHADER_UNIFORM_INT);
+
+#ifndef VAO_NOT_SUPPORTED
+    // Lighting constants and materials are in the uniform buffer
+    const GLuint blockIndex = glGetUniformBlockIndex(shader.id, "FFLShaderParams");
+    if (blockIndex != GL_INVALID_INDEX) // optimized out without lighting
+        glUniformBlockBinding(shader.id, blockIndex, SH_FFL_PARAMS_BINDING);
+#else
+    // Uniform values are kept by the program
+    glUniform4fv(pVariant->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT],
+        SH_FFL_LIGHT_PARAM_MAX, &self->params.light[0].x);
+    glUniform4fv(pVariant->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL],
+        MATERIAL_PARAM_SIZE * 3, &self->params.material[0][0].x);
+#endif
+
+    self->variantCount++;
+    TraceLog(LOG_DEBUG, "Linked shader variant %d for FFL (mode: %d, light: %d, specular mode: %d, skinning mode: %d), program %d",
+        self->variantCount, mode, lightEnable, specularMode, skinningMode, shader.id);
+}
+
+// Get a variant of the shader, linking it if it was never used
+ShaderForFFLVariant* ShaderForFFL_GetVariant(ShaderForFFL* self,
+    FFLModulateMode mode, bool lightEnable, int specularMode, int skinningMode)
+{
+    if (!lightEnable)
+        specularMode = 0; // no difference without lighting
+    ShaderForFFLVariant* pVariant = &self->variants[ShaderForFFL_GetVariantIndex(mode, lightEnable, specularMode, skinningMode)];
+    if (pVariant->shader.id == 0)
+        ShaderForFFL_LinkVariant(self, pVariant, mode, lightEnable, specularMode, skinningMode);
+    return pVariant;
+}
 
 // Initialize the Shader
 void ShaderForFFL_Initialize(ShaderForFFL* self)
 {
     TraceLog(LOG_DEBUG, "In ShaderForFFL_Initialize");
 
-    // Load the shader
-    self->shader = LoadShaderFromMemory(vertexShaderCodeFFL, fragmentShaderCodeFFL);
-    assert(self->shader.locs != NULL); // Shader did not load correctly.
+    memset(self->variants, 0, sizeof(self->variants));
+    self->pCurrentVariant = NULL;
+    self->variantCount = 0;
+    self->isLightEnabled = false;
+    for (int i = 0; i < 3; i++)
+        self->viewUniform[i] = MatrixIdentity();
+    GetNormalMatrix3(MatrixIdentity(), self->normalMatrix);
+    self->matrixGeneration = 1;
+
+    FFLGLState_Initialize(&self->glState);
+    ShaderForFFL_InitializeParams(self);
+
+    // Load the variant that FFL draws textures with first,
+    // attribute locations are the same in all of them
+    Shader shader = ShaderForFFL_GetVariant(self, FFL_MODULATE_MODE_CONSTANT, false, 0, SH_FFL_SKINNING_NONE)->shader;
     TraceLog(LOG_DEBUG, "Shader loaded");
 
-    // Get uniform locations
-    self->shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocation(self->shader, "u_model");//"u_mv");
-    TraceLog(LOG_TRACE, "Vertex uniform 'u_model' location: %d", self->shader.locs[SHADER_LOC_MATRIX_MODEL]);
-    self->shader.locs[SHADER_LOC_MATRIX_VIEW] = GetShaderLocation(self->shader, "u_view");
-    TraceLog(LOG_TRACE, "Vertex uniform 'u_view' location: %d", self->shader.locs[SHADER_LOC_MATRIX_VIEW]);
-    self->shader.locs[SHADER_LOC_MATRIX_PROJECTION] = GetShaderLocation(self->shader, "u_proj");
-    TraceLog(LOG_TRACE, "Vertex uniform 'u_proj' location: %d", self->shader.locs[SHADER_LOC_MATRIX_PROJECTION]);
-    //self->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT] = GetShaderLocation(self->shader, "u_it");
-    //TraceLog(LOG_TRACE, "Vertex uniform 'u_it' location: %d", self->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT]);
-
-    gLocationOfShaderForFFLSkinningEnable = GetShaderLocation(self->shader, "skinningEnabled");
-
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1] = GetShaderLocation(self->shader, "u_const1");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2] = GetShaderLocation(self->shader, "u_const2");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3] = GetShaderLocation(self->shader, "u_const3");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE] = GetShaderLocation(self->shader, "u_mode");
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_const1' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_const2' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_const3' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_mode' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE]);
-
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_AMBIENT] = GetShaderLocation(self->shader, "u_light_ambient");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIFFUSE] = GetShaderLocation(self->shader, "u_light_diffuse");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIR] = GetShaderLocation(self->shader, "u_light_dir");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_ENABLE] = GetShaderLocation(self->shader, "u_light_enable");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_SPECULAR] = GetShaderLocation(self->shader, "u_light_specular");
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_light_ambient' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_AMBIENT]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_light_diffuse' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIFFUSE]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_light_dir' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIR]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_light_enable' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_ENABLE]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_light_specular' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_SPECULAR]);
-
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_AMBIENT] = GetShaderLocation(self->shader, "u_material_ambient");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_DIFFUSE] = GetShaderLocation(self->shader, "u_material_diffuse");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR] = GetShaderLocation(self->shader, "u_material_specular");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_MODE] = GetShaderLocation(self->shader, "u_material_specular_mode");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_POWER] = GetShaderLocation(self->shader, "u_material_specular_power");
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_material_ambient' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_AMBIENT]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_material_diffuse' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_DIFFUSE]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_material_specular' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_material_specular_mode' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_MODE]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_material_specular_power' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_POWER]);
-
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE] = GetShaderLocation(self->shader, "u_mode");
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_mode' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE]);
-
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_COLOR] = GetShaderLocation(self->shader, "u_rim_color");
-    self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_POWER] = GetShaderLocation(self->shader, "u_rim_power");
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_rim_color' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_COLOR]);
-    TraceLog(LOG_TRACE, "Pixel uniform 'u_rim_power' location: %d", self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_POWER]);
-
-
-    //self->samplerLocation = GetShaderLocation(self->shader, "s_texture");
-    self->shader.locs[SHADER_LOC_MAP_ALBEDO] = GetShaderLocation(self->shader, "s_texture");
-    TraceLog(LOG_TRACE, "Sampler uniform 's_texture' location: %d", self->shader.locs[SHADER_LOC_MAP_ALBEDO]);
-
     // Get attribute locations
-    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_COLOR] = GetShaderLocationAttrib(self->shader, "a_color");
-    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL] = GetShaderLocationAttrib(self->shader, "a_normal");
-    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_POSITION] = GetShaderLocationAttrib(self->shader, "a_position");
-    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT] = GetShaderLocationAttrib(self->shader, "a_tangent");
-    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD] = GetShaderLocationAttrib(self->shader, "a_texCoord");
-    TraceLog(LOG_TRACE, "Attribute 'a_color' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_COLOR]);
-    TraceLog(LOG_TRACE, "Attribute 'a_normal' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL]);
-    TraceLog(LOG_TRACE, "Attribute 'a_position' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_POSITION]);
-    TraceLog(LOG_TRACE, "Attribute 'a_tangent' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT]);
-    TraceLog(LOG_TRACE, "Attribute 'a_texCoord' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD]);
+    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_COLOR] = GetShaderLocationAttrib(shader, "vertexColor");
+    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL] = GetShaderLocationAttrib(shader, "vertexNormal");
+    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_POSITION] = GetShaderLocationAttrib(shader, "vertexPosition");
+    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT] = GetShaderLocationAttrib(shader, "vertexTangent");
+    self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD] = GetShaderLocationAttrib(shader, "vertexTexCoord");
+    TraceLog(LOG_TRACE, "Attribute 'vertexColor' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_COLOR]);
+    TraceLog(LOG_TRACE, "Attribute 'vertexNormal' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL]);
+    TraceLog(LOG_TRACE, "Attribute 'vertexPosition' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_POSITION]);
+    TraceLog(LOG_TRACE, "Attribute 'vertexTangent' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT]);
+    TraceLog(LOG_TRACE, "Attribute 'vertexTexCoord' location: %d", self->attributeLocation[FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD]);
 
     // Create VBOs and VAO if supported
 #ifndef VAO_NOT_SUPPORTED
@@ -622,6 +955,20 @@ void ShaderForFFL_Initialize(ShaderForFFL* self)
     glGenBuffers(FFL_ATTRIBUTE_BUFFER_TYPE_MAX, self->vboHandle);
     TraceLog(LOG_TRACE, "VBOs created");
 
+    FFLGLBufferCache_Initialize(&self->bufferCache);
+    self->pCurrentCharModel = NULL;
+    self->isBaking = false;
+    self->pRecord = NULL;
+
+    self->attributeLocationMask = 0;
+    for (int i = 0; i < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; i++)
+    {
+        if (self->attributeLocation[i] != -1)
+            self->attributeLocationMask |= 1u << self->attributeLocation[i];
+    }
+    FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
+    self->streamIndexBufferHandle = 0; // created on first use
+
 #ifndef VAO_NOT_SUPPORTED
     glBindVertexArray(0);
     TraceLog(LOG_TRACE, "VAO unbound");
@@ -636,12 +983,76 @@ void ShaderForFFL_Initialize(ShaderForFFL* self)
     FFLSetShaderCallback(&self->callback);
 }
 
+// Set a uniform on the selected variant, skipped if it already has that value
+void ShaderForFFL_SetUniform(ShaderForFFL* self, int location, const void* pValue, int uniformType)
+{
+    ShaderForFFLVariant* pVariant = self->pCurrentVariant;
+    FFLGLState_UseProgram(&self->glState, pVariant->shader.id);
+    FFLGLState_SetUniform(&self->glState, &pVariant->uniformShadow, location, pValue, uniformType);
+}
+
+// Same as ShaderForFFL_SetUniform, for uniforms in ShaderFFLPixelUniform
+void ShaderForFFL_SetPixelUniform(ShaderForFFL* self, int uniform, const void* pValue, int uniformType)
+{
+    ShaderForFFL_SetUniform(self, self->pCurrentVariant->pixelUniformLocation[uniform], pValue, uniformType);
+}
+
+// Select the variant that following draws use, and one of cMaterialParam
+// (or -1 to keep the last one). Returns its shader for raylib's DrawMesh.
+Shader ShaderForFFL_SelectVariant(ShaderForFFL* self, FFLModulateMode mode, int materialIndex, int skinningMode)
+{
+    assert(materialIndex >= -1 && materialIndex < MATERIAL_PARAM_SIZE);
+    const int specularMode = materialIndex != -1 ? ShaderForFFL_GetSpecularMode(materialIndex) : 0;
+    ShaderForFFLVariant* pVariant = ShaderForFFL_GetVariant(self, mode, self->isLightEnabled, specularMode, skinningMode);
+    self->pCurrentVariant = pVariant;
+    FFLGLState_UseProgram(&self->glState, pVariant->shader.id);
+
+    // Every program has its own matrices, only set them if they changed
+    if (pVariant->matrixGeneration != self->matrixGeneration)
+    {
+        rlSetUniformMatrix(pVariant->shader.locs[SHADER_LOC_MATRIX_MODEL], self->viewUniform[0]);
+        rlSetUniformMatrix(pVariant->shader.locs[SHADER_LOC_MATRIX_VIEW], self->viewUniform[1]);
+        rlSetUniformMatrix(pVariant->shader.locs[SHADER_LOC_MATRIX_PROJECTION], self->viewUniform[2]);
+        glUniformMatrix3fv(pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT], 1, GL_FALSE, self->normalMatrix);
+        pVariant->matrixGeneration = self->matrixGeneration;
+        self->glState.stats.issued += 4;
+    }
+    else
+        self->glState.stats.skipped += 4;
+
+    if (materialIndex != -1)
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_MATERIAL_INDEX, &materialIndex, SHADER_UNIFORM_INT);
+
+    return pVariant->shader;
+}
+
+// Set normal matrices for the bone matrices that DrawMesh sets
+// on the selected variant, from UpdateModelAnimationBonesScaling
+void ShaderForFFL_SetBoneNormalMatrices(ShaderForFFL* self, const float* pBoneNormalMatrices, int boneCount)
+{
+    ShaderForFFLVariant* pVariant = self->pCurrentVariant;
+    FFLGLState_UseProgram(&self->glState, pVariant->shader.id);
+    glUniformMatrix3fv(pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_BONE_IT], boneCount, GL_FALSE, pBoneNormalMatrices);
+}
+
+// Set the bone matrices of a SH_FFL_SKINNING_PALETTE variant,
+// three rows per bone from GetBonePalette3x4
+void ShaderForFFL_SetBonePalette(ShaderForFFL* self, const Vector4* pBonePalette, int boneCount)
+{
+    ShaderForFFLVariant* pVariant = self->pCurrentVariant;
+    FFLGLState_UseProgram(&self->glState, pVariant->shader.id);
+    glUniform4fv(pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_BONE_PALETTE], boneCount * 3, &pBonePalette[0].x);
+}
+
 // Bind the Shader
 void ShaderForFFL_Bind(ShaderForFFL* self, bool forInitTextures)
 {
     TraceLog(LOG_TRACE, "In ShaderForFFL_Bind, calling BeginShaderMode, light enable: %i", forInitTextures);
 
-    BeginShaderMode(self->shader);
+    // Draw what raylib has batched before changing any state
+    rlDrawRenderBatchActive();
+    // raylib may have changed anything since the last draw
+    FFLGLState_Invalidate(&self->glState);
 
 #ifndef VAO_NOT_SUPPORTED
     glBindVertexArray(self->vaoHandle);
@@ -656,23 +1067,157 @@ void ShaderForFFL_Bind(ShaderForFFL* self, bool forInitTextures)
             TraceLog(LOG_TRACE, "Disabled vertex attrib array at location: %d", self->attributeLocation[i]);
         }
     }
-    const int lightEnable = (int)!forInitTextures;
+    // Until ShaderForFFL_SetCharModel is called, buffers
+    // are streamed (e.g. temporary faceline/mask shapes)
+    self->pCurrentCharModel = NULL;
+    // Anything may have changed attribute state since the last frame
+    FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
+
+#ifndef VAO_NOT_SUPPORTED
+    // Lighting constants and materials, see ShaderForFFL_UploadParams
+    glBindBufferBase(GL_UNIFORM_BUFFER, SH_FFL_PARAMS_BINDING, self->paramsBufferHandle);
+#endif
+
+    // Usually disabled for init textures, decides the variants selected
+    self->isLightEnabled = !forInitTextures;
+    self->pCurrentVariant = NULL;
+}
 
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_ENABLE], &lightEnable, SHADER_UNIFORM_INT);
-    if (lightEnable == 1) // usually disabled for init textures
+// Unbind the Shader after drawing, so that raylib can draw again
+void ShaderForFFL_Unbind(ShaderForFFL* self)
+{
+    FFLGLState_BindSampler(&self->glState, FFL_GL_SAMPLER_NONE);
+    FFLGLState_BindTexture(&self->glState, 0);
+#ifndef VAO_NOT_SUPPORTED
+    glBindVertexArray(0);
+#endif
+    FFLGLState_Invalidate(&self->glState);
+}
+
+// Draw a raylib mesh between ShaderForFFL_Bind and ShaderForFFL_Unbind
+void ShaderForFFL_DrawMesh(ShaderForFFL* self, Mesh mesh, Material material, Matrix transform)
+{
+    // raylib's textures have their own parameters
+    FFLGLState_BindSampler(&self->glState, FFL_GL_SAMPLER_NONE);
+
+    // DrawMesh sets the model and view matrices itself, from transform
+    // and rlgl's matrices, so set the normal matrix matching them
+    ShaderForFFLVariant* pVariant = self->pCurrentVariant;
+    assert(pVariant != NULL && pVariant->shader.id == material.shader.id); // call ShaderForFFL_SelectVariant first
+    float normalMatrix[9];
+    const Matrix matModel = MatrixMultiply(transform, rlGetMatrixTransform());
+    GetNormalMatrix3(MatrixMultiply(matModel, rlGetMatrixModelview()), normalMatrix);
+    FFLGLState_UseProgram(&self->glState, pVariant->shader.id);
+    glUniformMatrix3fv(pVariant->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT], 1, GL_FALSE, normalMatrix);
+
+    DrawMesh(mesh, material, transform);
+    // DrawMesh binds its own textures and unbinds the shader when it is done
+    FFLGLState_Invalidate(&self->glState);
+    // It also sets its own matrices on the shader
+    for (int i = 0; i < SH_FFL_VARIANT_MAX; i++)
     {
-        // Bind shader uniforms that will never change
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIR], &cLightDir, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_AMBIENT], &cLightAmbient, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_DIFFUSE], &cLightDiffuse, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_LIGHT_SPECULAR], &cLightSpecular, SHADER_UNIFORM_VEC3);
-
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_COLOR], &cRimColor, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_RIM_POWER], &cRimPower, SHADER_UNIFORM_FLOAT);
+        if (self->variants[i].shader.id == material.shader.id)
+            self->variants[i].matrixGeneration = 0;
     }
+}
+
+// Set the CharModel that the following draws belong to, so that its
+// vertex buffers are kept on the GPU between frames. It must be
+// the charModel of a CharModelRenderState, which has its textures.
+void ShaderForFFL_SetCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    self->pCurrentCharModel = pCharModel;
+}
+
+// Upload the buffers of every shape in a CharModel and bake them,
+// so that the first frame it is drawn does not have to
+void ShaderForFFL_BakeCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    const FFLCharModel* pPreviousCharModel = self->pCurrentCharModel;
+    self->pCurrentCharModel = pCharModel;
+    self->isBaking = true;
+    FFLDrawOpa(pCharModel);
+    FFLDrawXlu(pCharModel);
+    self->isBaking = false;
+    self->pCurrentCharModel = pPreviousCharModel;
+}
+
+// Record the buffers that every draw of a CharModel would upload
+static void ShaderForFFL_RecordCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel, FFLGLBufferRecord* pRecord)
+{
+    pRecord->count = 0;
+    pRecord->isOverflowed = false;
+    self->pRecord = pRecord;
+    FFLDrawOpa(pCharModel);
+    FFLDrawXlu(pCharModel);
+    self->pRecord = NULL;
+}
+
+// Keep the buffers uploaded for pOwner when its shapes were rebuilt
+// from the same parts, so that they are not uploaded again. pOldModel is
+// a copy of pOwner from before it was rebuilt, whose buffers must not have
+// been freed yet. Returns false if the shapes differ, then call
+// ShaderForFFL_InvalidateCharModel and ShaderForFFL_BakeCharModel instead.
+bool ShaderForFFL_RekeyCharModel(ShaderForFFL* self, const FFLCharModel* pOwner,
+    const FFLCharModel* pOldModel, const FFLCharModel* pNewModel)
+{
+    FFLGLBufferRecord* pRecords = (FFLGLBufferRecord*)RL_MALLOC(2 * sizeof(FFLGLBufferRecord)); // too large for the stack
+    ShaderForFFL_RecordCharModel(self, pOldModel, &pRecords[0]);
+    ShaderForFFL_RecordCharModel(self, pNewModel, &pRecords[1]);
+    const bool isRekeyed = FFLGLBufferCache_RekeyOwner(&self->bufferCache, pOwner, &pRecords[0], &pRecords[1]);
+    RL_FREE(pRecords);
+    // Textures are handled by the caller, but their names may be reused
+    FFLGLState_InvalidateTextures(&self->glState);
+    return isRekeyed;
+}
+
+// Delete cached buffers for a CharModel, call this
+// before deleting it or replacing its shapes
+void ShaderForFFL_InvalidateCharModel(ShaderForFFL* self, const FFLCharModel* pCharModel)
+{
+    FFLGLBufferCache_InvalidateOwner(&self->bufferCache, pCharModel);
+    if (self->pCurrentCharModel == pCharModel)
+        self->pCurrentCharModel = NULL;
+    // Its textures will be deleted, and their names may be reused
+    FFLGLState_InvalidateTextures(&self->glState);
+}
+
+// Get GL calls issued and skipped since the last call, then reset them
+FFLGLStateStats ShaderForFFL_ResetStateStats(ShaderForFFL* self)
+{
+    FFLGLStateStats stats = self->glState.stats;
+    FFLGLState_ResetStats(&self->glState);
+    return stats;
+}
+
+// Get buffer creations and avoided creations since the last call, then reset them
+FFLGLBufferCacheStats ShaderForFFL_ResetBufferStats(ShaderForFFL* self)
+{
+    FFLGLBufferCacheStats stats = self->bufferCache.stats;
+    FFLGLBufferCache_ResetStats(&self->bufferCache);
+    return stats;
+}
 
-    const int zero = 0;
-    SetShaderValue(self->shader, gLocationOfShaderForFFLSkinningEnable, &zero, SHADER_UNIFORM_INT);
+// Unload the shader and every cached buffer
+void ShaderForFFL_Finalize(ShaderForFFL* self)
+{
+    for (int i = 0; i < SH_FFL_VARIANT_MAX; i++)
+    {
+        if (self->variants[i].shader.id != 0)
+            UnloadShader(self->variants[i].shader);
+    }
+    self->variantCount = 0;
+    FFLGLBufferCache_Destroy(&self->bufferCache);
+    FFLGLState_Finalize(&self->glState);
+#ifndef VAO_NOT_SUPPORTED
+    glDeleteBuffers(1, &self->paramsBufferHandle);
+#endif
+    glDeleteBuffers(FFL_ATTRIBUTE_BUFFER_TYPE_MAX, self->vboHandle);
+    if (self->streamIndexBufferHandle != 0)
+        glDeleteBuffers(1, &self->streamIndexBufferHandle);
+#ifndef VAO_NOT_SUPPORTED
+    glDeleteVertexArrays(1, &self->vaoHandle);
+#endif
 }
 
 // Set View Uniform
@@ -694,13 +1239,15 @@ void ShaderForFFL_SetViewUniform(ShaderForFFL* self, const Matrix* model_mtx, co
         proj = MatrixIdentity();
 
 
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_MODEL], model);
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_VIEW], view);
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_PROJECTION], proj);
+    // Set on each variant when it is selected
+    self->viewUniform[0] = model;
+    self->viewUniform[1] = view;
+    self->viewUniform[2] = proj;
+    self->matrixGeneration++;
 
-    // Calculate the inverse transpose of the MV matrix
-    //Matrix normalMatrix = MatrixTranspose(MatrixInvert(mv));
-    //SetShaderValueMatrix(self->shader, self->vertexUniformLocation[SH_FFL_VERTEX_UNIFORM_IT], normalMatrix);
+    // Calculate the inverse transpose of the MV matrix once here,
+    // instead of for every vertex in the shader
+    GetNormalMatrix3(MatrixMultiply(model, view), self->normalMatrix);
 }
 
 // Apply Alpha Test (no-op for now)
@@ -713,44 +1260,11 @@ void ShaderForFFL_ApplyAlphaTest(bool enable, FFLRIOCompareFunc func, float ref)
 */
 
 // Set Culling Mode
-void ShaderForFFL_SetCulling(FFLCullMode mode)
+void ShaderForFFL_SetCulling(ShaderForFFL* self, FFLCullMode mode)
 {
     TraceLog(LOG_TRACE, "Setting FFLCullMode: %d", mode);
-
-    switch (mode)
-    {
-    case FFL_CULL_MODE_NONE:
-        glDisable(GL_CULL_FACE);
-        TraceLog(LOG_TRACE, "Culling disabled (FFL_CULL_MODE_NONE)");
-        break;
-    case FFL_CULL_MODE_BACK:
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        TraceLog(LOG_TRACE, "Culling mode set to FFL_CULL_MODE_BACK");
-        break;
-    case FFL_CULL_MODE_FRONT:
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_FRONT);
-        TraceLog(LOG_TRACE, "Culling mode set to FFL_CULL_MODE_FRONT");
-        break;
-    default:
-        break;
-    }
-}
-
-// Set material uniforms from FFLiDefaultShaderMaterial
-void ShaderForFFL_SetMaterial(ShaderForFFL* self, const FFLiDefaultShaderMaterial* pMaterial)
-{
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_AMBIENT], &pMaterial->ambient.x, SHADER_UNIFORM_VEC3);
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_DIFFUSE], &pMaterial->diffuse.x, SHADER_UNIFORM_VEC3);
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR], &pMaterial->specular.x, SHADER_UNIFORM_VEC3);
-
-    int specularMode = 0; // blinn as default
-    if (SHADER_FFL_SPECULAR_MODE != 0) // if the default is not blinn,
-        specularMode = pMaterial->specularMode; // set it
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_MODE], &specularMode, SHADER_UNIFORM_INT);
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MATERIAL_SPECULAR_POWER], &pMaterial->specularPower, SHADER_UNIFORM_FLOAT);
-
+    // Only changes GL state if the mode is different from the last draw
+    FFLGLState_SetCullMode(&self->glState, mode);
 }
 
 // Callback: Set Matrix
@@ -769,24 +1283,123 @@ void ShaderForFFL_SetMatrixCallback(void* pObj, const float pBaseMtx44f[16])
     */
     matrix = MatrixIdentity();
 
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_MODEL], MatrixIdentity());
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_VIEW], MatrixIdentity());
-    SetShaderValueMatrix(self->shader, self->shader.locs[SHADER_LOC_MATRIX_PROJECTION], matrix);
+    self->viewUniform[0] = MatrixIdentity();
+    self->viewUniform[1] = MatrixIdentity();
+    self->viewUniform[2] = matrix;
+    GetNormalMatrix3(MatrixIdentity(), self->normalMatrix);
+    self->matrixGeneration++;
 }
 
-RenderTexture gFacelineRenderTexture;
-RenderTexture gMaskRenderTextures[FFL_EXPRESSION_LIMIT]; // a render texture for each mask
-RenderTexture* gMaskRenderTextureCurrent = &gMaskRenderTextures[FFL_EXPRESSION_NORMAL];
-// NOTE: default expression is not always normal
+// Faceline and mask textures of every CharModelRenderState
+FFLTextureAtlas gCharModelTextureAtlas;
+
+// Faceline and mask textures shared between every CharModelRenderState
+FFLCharModelTextureCache gCharModelTextureCache;
 
-void SetCharModelExpression(FFLCharModel* pCharModel, FFLExpression expression)
+// A CharModel and the faceline and mask textures drawn for it,
+// in place of the ones FFLInitCharModelGPUStep would create.
+// The CharModel is the first member, so the draw callback can find the
+// textures from the CharModel passed to ShaderForFFL_SetCharModel.
+// Only the mask of the current expression is kept, the others are drawn
+// or found in gCharModelTextureCache when SetCharModelExpression uses them.
+typedef struct CharModelRenderState
 {
-    assert(expression < FFL_EXPRESSION_LIMIT);
-    // assert(&gMaskRenderTextures[expression] != NULL); // but they are not initialized to null so nvm
+    FFLCharModel charModel; // must be first
+    FFLCharModelTexture* pFaceline; // NULL if there is none
+    FFLCharModelTexture* pMask; // of expression, NULL if it could not be drawn
+    FFLExpression expression; // of the mask that is drawn
+} CharModelRenderState;
+
+// Release the faceline and mask textures from InitCharModelTextures,
+// they stay in gCharModelTextureCache for other CharModels
+void UnloadCharModelTextures(CharModelRenderState* pState)
+{
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pState->pFaceline);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pState->pMask);
+    pState->pFaceline = NULL;
+    pState->pMask = NULL;
+}
+
+// Get the CharModelRenderState of the CharModel being drawn
+static const CharModelRenderState* ShaderForFFL_GetCurrentRenderState(const ShaderForFFL* self)
+{
+    assert(self->pCurrentCharModel != NULL); // call ShaderForFFL_SetCharModel first
+    return (const CharModelRenderState*)self->pCurrentCharModel;
+}
 
-    FFLSetExpression(pCharModel, expression);
-    // NOTE: assuming only one instance
-    gMaskRenderTextureCurrent = &gMaskRenderTextures[expression];
+// Get the attribute format that FFL uses for each attribute buffer type
+static void ShaderForFFL_GetAttribFormat(int type, FFLGLShapeAttrib* pAttrib)
+{
+    switch (type)
+    {
+    case FFL_ATTRIBUTE_BUFFER_TYPE_POSITION:
+        pAttrib->size = 3;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL:
+#ifdef GL_INT_2_10_10_10_REV
+        pAttrib->size = 4;
+        pAttrib->type = GL_INT_2_10_10_10_REV;
+        pAttrib->normalized = GL_TRUE;
+#else
+        // NOTE: assuming FFL converted to FFLiSnorm8_8_8_8
+        pAttrib->size = 4;
+        pAttrib->type = GL_BYTE;
+        pAttrib->normalized = GL_TRUE;
+#endif
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT:
+        pAttrib->size = 4;
+        pAttrib->type = GL_BYTE;
+        pAttrib->normalized = GL_TRUE;
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD:
+        pAttrib->size = 2;
+        pAttrib->type = GL_FLOAT;
+        pAttrib->normalized = GL_FALSE;
+        break;
+    case FFL_ATTRIBUTE_BUFFER_TYPE_COLOR:
+        pAttrib->size = 4;
+        pAttrib->type = GL_UNSIGNED_BYTE;
+        pAttrib->normalized = GL_TRUE;
+        break;
+    default:
+        break;
+    }
+}
+
+// Get the baked shape for a draw of the current CharModel,
+// uploading its buffers and baking it if this is the first time
+static const FFLGLShape* ShaderForFFL_GetShape(ShaderForFFL* self, const FFLDrawParam* pDrawParam)
+{
+    const void* pIndexBuffer = pDrawParam->primitiveParam.pIndexBuffer;
+    const u32 indexBufferSize = pDrawParam->primitiveParam.indexCount * sizeof(unsigned short);
+
+    FFLGLShape* pShape = FFLGLBufferCache_FindShape(&self->bufferCache,
+        self->pCurrentCharModel, pIndexBuffer, indexBufferSize);
+    if (pShape != NULL)
+        return pShape;
+
+    FFLGLShapeAttrib attribs[FFL_ATTRIBUTE_BUFFER_TYPE_MAX];
+    int attribCount = 0;
+    for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
+    {
+        const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
+        const int location = self->attributeLocation[type];
+        if (buffer->ptr == NULL || location == -1 || buffer->stride == 0)
+            continue;
+
+        FFLGLShapeAttrib* pAttrib = &attribs[attribCount++];
+        ShaderForFFL_GetAttribFormat(type, pAttrib);
+        pAttrib->location = (GLuint)location;
+        pAttrib->stride = buffer->stride;
+        pAttrib->buffer = FFLGLBufferCache_Bind(&self->bufferCache, GL_ARRAY_BUFFER,
+            self->pCurrentCharModel, buffer->ptr, buffer->size, buffer->stride);
+    }
+
+    return FFLGLBufferCache_BakeShape(&self->bufferCache, self->pCurrentCharModel,
+        pIndexBuffer, indexBufferSize, attribs, attribCount);
 }
 
 // Callback: Draw
@@ -796,12 +1409,39 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
 
     TraceLog(LOG_TRACE, "Draw callback called, preparing to draw");
 
-    ShaderForFFL_SetCulling(pDrawParam->cullMode);
+    if (self->pRecord != NULL)
+    {
+        // Only record buffers, see ShaderForFFL_RekeyCharModel
+        if (pDrawParam->primitiveParam.pIndexBuffer == NULL)
+            return;
+        for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
+        {
+            const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
+            if (buffer->ptr == NULL || self->attributeLocation[type] == -1 || buffer->stride == 0)
+                continue;
+            FFLGLBufferRecord_Add(self->pRecord, buffer->ptr, buffer->size, buffer->stride);
+        }
+        FFLGLBufferRecord_Add(self->pRecord, pDrawParam->primitiveParam.pIndexBuffer,
+            pDrawParam->primitiveParam.indexCount * sizeof(unsigned short), 0);
+        return;
+    }
+
+    if (self->isBaking)
+    {
+        // Only upload buffers, see ShaderForFFL_BakeCharModel
+        if (pDrawParam->primitiveParam.pIndexBuffer != NULL)
+            ShaderForFFL_GetShape(self, pDrawParam);
+        return;
+    }
 
-    BeginShaderMode(self->shader);
+    ShaderForFFL_SetCulling(self, pDrawParam->cullMode);
 
-    // Set u_mode uniform
-    SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE], &pDrawParam->modulateParam.mode, SHADER_UNIFORM_INT);
+    // Pick the variant for this mode and material
+    int materialIndex = -1;
+    if (pDrawParam->modulateParam.type < FFL_MODULATE_TYPE_SHAPE_MAX
+        && pDrawParam->modulateParam.type >= 0)
+        materialIndex = (int)pDrawParam->modulateParam.type;
+    ShaderForFFL_SelectVariant(self, pDrawParam->modulateParam.mode, materialIndex, SH_FFL_SKINNING_NONE);
 
     // Set uniforms based on mode
     switch (pDrawParam->modulateParam.mode)
@@ -810,12 +1450,12 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
     case FFL_MODULATE_MODE_ALPHA:
     case FFL_MODULATE_MODE_LUMINANCE_ALPHA:
     case FFL_MODULATE_MODE_ALPHA_OPA:
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_CONST1, &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
         break;
     case FFL_MODULATE_MODE_RGB_LAYERED:
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST2], &pDrawParam->modulateParam.pColorG->r, SHADER_UNIFORM_VEC3);
-        SetShaderValue(self->shader, self->pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST3], &pDrawParam->modulateParam.pColorB->r, SHADER_UNIFORM_VEC3);
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_CONST1, &pDrawParam->modulateParam.pColorR->r, SHADER_UNIFORM_VEC3);
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_CONST2, &pDrawParam->modulateParam.pColorG->r, SHADER_UNIFORM_VEC3);
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_CONST3, &pDrawParam->modulateParam.pColorB->r, SHADER_UNIFORM_VEC3);
         break;
     default:
         break;
@@ -827,13 +1467,20 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
         || pDrawParam->modulateParam.type == FFL_MODULATE_TYPE_SHAPE_MASK)
     {
         GLuint textureHandle;
+        const Vector4* pTexCoordTransform = &cFFLTextureAtlasIdentityTransform;
 
         // For faceline and mask (FFL should always bind a texture2D to this...)
-        // we will instead use the textures we made ourself
+        // we will instead use the textures we made ourself, in the atlas
+        const FFLTextureAtlasRegion* pRegion = NULL;
         if (pDrawParam->modulateParam.type == FFL_MODULATE_TYPE_SHAPE_FACELINE) {
-            textureHandle = gFacelineRenderTexture.texture.id;
+            pRegion = FFLCharModelTexture_GetRegion(ShaderForFFL_GetCurrentRenderState(self)->pFaceline);
         } else if (pDrawParam->modulateParam.type == FFL_MODULATE_TYPE_SHAPE_MASK) {
-            textureHandle = gMaskRenderTextureCurrent->texture.id;
+            pRegion = FFLCharModelTexture_GetRegion(ShaderForFFL_GetCurrentRenderState(self)->pMask);
+        }
+
+        if (pRegion != NULL) {
+            textureHandle = pRegion->texture;
+            pTexCoordTransform = &pRegion->texCoordTransform;
         } else {
             assert(pDrawParam->modulateParam.pTexture2D != NULL);
             // assuming that the pTexture2D is really not null
@@ -848,130 +1495,85 @@ void ShaderForFFL_DrawCallback(void* pObj, const FFLDrawParam* pDrawParam)
         }
 
         // Bind the texture to texture unit 0
-        glActiveTexture(GL_TEXTURE0);
+        FFLGLState_BindTexture(&self->glState, textureHandle);
 
-        glBindTexture(GL_TEXTURE_2D, textureHandle);
-
-        // Set texture wrap to repeat
-        if (pDrawParam->modulateParam.type < FFL_MODULATE_TYPE_SHAPE_MAX)
-        {
-            // Only apply texture wrap to shapes (glass, faceline)
-            // since those are NPOT textures
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-        } else {
-            // Otherwise do not use repeat wrap
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        }
-
-        // Do not use mipmaps
-        // TODO: ADD MIPMAP SUPPORT but NOT SUPPORTED FOR ES 2.0
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        // Only apply texture wrap to shapes (glass, faceline)
+        // since those are NPOT textures, otherwise do not use repeat wrap
+        const FFLGLSampler sampler = FFLGLSampler_FromModulateType(pDrawParam->modulateParam.type);
+        FFLGLState_BindSampler(&self->glState, sampler);
 
         // Set the sampler uniform to use texture unit 0
-        glUniform1i(self->shader.locs[SHADER_LOC_MAP_ALBEDO], 0);
+        const int textureUnit = 0;
+        ShaderForFFL_SetUniform(self, self->pCurrentVariant->shader.locs[SHADER_LOC_MAP_ALBEDO], &textureUnit, SHADER_UNIFORM_SAMPLER2D);
+        // Heads that share an atlas page only differ in these, not in the texture
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_TEXCOORD_TRANSFORM, pTexCoordTransform, SHADER_UNIFORM_VEC4);
+        // The sampler would wrap the whole page, so wrap within the region instead
+        const int texCoordWrap = FFLTextureAtlasWrap_FromSampler(pRegion, sampler);
+        ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_TEXCOORD_WRAP, &texCoordWrap, SHADER_UNIFORM_INT);
+        if (pRegion != NULL)
+            ShaderForFFL_SetPixelUniform(self, SH_FFL_PIXEL_UNIFORM_TEXCOORD_BOUNDS, &pRegion->texCoordBounds, SHADER_UNIFORM_VEC4);
     } else {
         // If there is no texture, bind nothing
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-
-    // bind material uniforms
-    if (pDrawParam->modulateParam.type < FFL_MODULATE_TYPE_SHAPE_MAX
-        && pDrawParam->modulateParam.type >= 0)
-    {
-        const FFLiDefaultShaderMaterial* param = &cMaterialParam[pDrawParam->modulateParam.type];
-        ShaderForFFL_SetMaterial(self, param);
+        FFLGLState_BindTexture(&self->glState, 0);
     }
 
 
     if (pDrawParam->primitiveParam.pIndexBuffer != NULL)
     {
         TraceLog(LOG_TRACE, "Binding index buffer: %p", pDrawParam->primitiveParam.pIndexBuffer);
-        // Bind and set up vertex attributes
+        if (self->pCurrentCharModel != NULL)
+        {
+            // Shape owned by the CharModel, baked the first time it is seen
+            FFLGLShape_Bind(ShaderForFFL_GetShape(self, pDrawParam), &self->attribState);
+        }
+        else
+        {
+            // Temporary shape (faceline/mask textures), set up and upload every time
 #ifndef VAO_NOT_SUPPORTED
-        glBindVertexArray(self->vaoHandle);
+            glBindVertexArray(self->vaoHandle);
 #endif
+            FFLGLAttribState_Invalidate(&self->attribState, self->attributeLocationMask);
 
-        for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
-        {
-            const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
-            int location = self->attributeLocation[type];
-            void* ptr = buffer->ptr;
-
-            if (ptr != NULL && location != -1 && buffer->stride > 0)
+            for (int type = 0; type < FFL_ATTRIBUTE_BUFFER_TYPE_MAX; ++type)
             {
-                unsigned int stride = buffer->stride;
-                unsigned int vbo_handle = self->vboHandle[type];
-                unsigned int size = buffer->size;
-
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_handle);
-                glBufferData(GL_ARRAY_BUFFER, size, ptr, GL_STATIC_DRAW);
-                glEnableVertexAttribArray(location);
+                const FFLAttributeBuffer* buffer = &pDrawParam->attributeBufferParam.attributeBuffers[type];
+                int location = self->attributeLocation[type];
+                void* ptr = buffer->ptr;
 
-                // Set attribute pointer based on type
-                switch (type)
+                if (ptr != NULL && location != -1 && buffer->stride > 0)
                 {
-                case FFL_ATTRIBUTE_BUFFER_TYPE_POSITION:
-                    glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_NORMAL:
-#ifdef GL_INT_2_10_10_10_REV
-                    glVertexAttribPointer(location, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)0);
-#else
-                    // NOTE: assuming FFL converted to FFLiSnorm8_8_8_8
-                    glVertexAttribPointer(location, 4, GL_BYTE, GL_TRUE, stride, (void*)0);
-#endif
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_TANGENT:
-                    glVertexAttribPointer(location, 4, GL_BYTE, GL_TRUE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_TEXCOORD:
-                    glVertexAttribPointer(location, 2, GL_FLOAT, GL_FALSE, stride, (void*)0);
-                    break;
-                case FFL_ATTRIBUTE_BUFFER_TYPE_COLOR:
-                    glVertexAttribPointer(location, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)0);
-                    break;
-                default:
-                    break;
+                    FFLGLShapeAttrib attrib;
+                    ShaderForFFL_GetAttribFormat(type, &attrib);
+
+                    glBindBuffer(GL_ARRAY_BUFFER, self->vboHandle[type]);
+                    glBufferData(GL_ARRAY_BUFFER, buffer->size, ptr, GL_STREAM_DRAW);
+                    glEnableVertexAttribArray(location);
+                    glVertexAttribPointer(location, attrib.size, attrib.type, attrib.normalized, buffer->stride, (void*)0);
                 }
+                else if (location != -1)
+                    glDisableVertexAttribArray(location);
             }
-            else if (location != -1)
-                glDisableVertexAttribArray(location);
-        }
 
-        // Create and bind index buffer
-        GLuint indexBufferHandle;
-        glGenBuffers(1, &indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, pDrawParam->primitiveParam.indexCount * sizeof(unsigned short), pDrawParam->primitiveParam.pIndexBuffer, GL_STATIC_DRAW);
+            FFLGLBufferCache_Stream(&self->bufferCache, GL_ELEMENT_ARRAY_BUFFER,
+                &self->streamIndexBufferHandle, pDrawParam->primitiveParam.pIndexBuffer,
+                pDrawParam->primitiveParam.indexCount * sizeof(unsigned short));
+        }
 
-        glDepthMask(GL_TRUE); // enable depth writing
+        FFLGLState_SetDepthMask(&self->glState, GL_TRUE); // enable depth writing
 
         // Draw elements
         // primitiveType maps directly to OpenGL primitives
         TraceLog(LOG_TRACE, "glDrawElements(%d)", pDrawParam->primitiveParam.indexCount);
         glDrawElements(pDrawParam->primitiveParam.primitiveType, pDrawParam->primitiveParam.indexCount, GL_UNSIGNED_SHORT, 0);
-
-        // Cleanup
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glDeleteBuffers(1, &indexBufferHandle);
-
-#ifndef VAO_NOT_SUPPORTED
-        glBindVertexArray(0);
-#endif
     }
 
-    // Unbind the texture
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Disable shader
-    EndShaderMode();
+    // NOTE: The texture, VAO and shader are left bound
+    // for the next draw, ShaderForFFL_Unbind resets them
 }
 
 
 FFLResourceDesc gResourceDesc; // Global so data can be freed
+FFLResourceFile gResourceFileHigh; // Owns gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH]
 
 const char* cFFLResourceHighFilename = "./FFLResHigh.dat";
 
@@ -988,56 +1590,13 @@ FFLResult InitializeFFL()
     // Reset high size to 0 indicating it is not allocated
     gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = 0;
     gResourceDesc.size[FFL_RESOURCE_TYPE_MIDDLE] = 0; // Skip middle
-    // Open the file in binary mode
-    FILE* file = fopen(cFFLResourceHighFilename, "rb");
-    if (!file) {
-        TraceLog(LOG_ERROR, "Error: Cannot open file %s", cFFLResourceHighFilename);
-        return FFL_RESULT_FS_ERROR;
-    }
-    TraceLog(LOG_DEBUG, "Opened %s", cFFLResourceHighFilename);
-    // Seek to the end to determine file size
-    fseek(file, 0, SEEK_END);
-    unsigned long fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET); // Go back to the start of the file
-    if (fileSize <= 0)
-    {
-        TraceLog(LOG_ERROR, "Invalid file size for %s", cFFLResourceHighFilename);
-        fclose(file);
-        return FFL_RESULT_FS_ERROR;
-    }
-    /*
-    const size_t alignment = 0x2000;
-    // Allocate aligned memory
-    void* fileData = NULL;
-    if (posix_memalign(&fileData, alignment, (size_t)fileSize)) {
-        TraceLog(LOG_ERROR, "Cannot allocate aligned memory");
-        fclose(file);
-        return FFL_RESULT_ERROR;
-    }
-    */
-    void* fileData = malloc((size_t)fileSize);
-    if (fileData == NULL)
-    {
-        TraceLog(LOG_ERROR, "Cannot allocate memory for resource buffer");
-        fclose(file);
-        return FFL_RESULT_ERROR;
-    }
-    // Read the file data into fileData
-    size_t bytesRead = fread(fileData, 1, (size_t)fileSize, file);
-    if (bytesRead == fileSize)
-    {
-        // Store the data and size in the appropriate resource type slot
-        gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH] = fileData;
-        gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = (u32)fileSize;
-    } else {
-        TraceLog(LOG_ERROR, "Cannot read file %s", cFFLResourceHighFilename);
-        free(fileData);
-        fclose(file);
-
-        return FFL_RESULT_FS_ERROR;
-    }
-    // Close the file because we are done reading it
-    fclose(file);
+    // Mapped instead of copied where possible, see ffl_resource_helpers.c
+    FFLResult loadResult = FFLResourceFile_Load(&gResourceFileHigh, cFFLResourceHighFilename);
+    if (loadResult != FFL_RESULT_OK)
+        return loadResult;
+    // Store the data and size in the appropriate resource type slot
+    gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH] = gResourceFileHigh.pData;
+    gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = gResourceFileHigh.size;
 
     FFLResult result;
     TraceLog(LOG_DEBUG, "Calling FFLInitResEx");
@@ -1113,17 +1672,92 @@ FFLResult CreateCharModelFromStoreData(FFLCharModel* pCharModel, const void* pSt
     return FFL_RESULT_OK;
 }
 
+// Get the mask of an expression from gCharModelTextureCache, or draw it
+// with the mask draw params that InitCharModelTextures kept. Drawing
+// switches to the atlas render texture, so call it outside of BeginDrawing.
+static FFLCharModelTexture* AcquireCharModelMask(CharModelRenderState* pState, FFLExpression expression)
+{
+    FFLiCharModel* piCharModel = (FFLiCharModel*)&pState->charModel;
+    const FFLResolution textureResolution = piCharModel->charModelDesc.resolution & FFL_RESOLUTION_MASK;
+
+    FFLCharModelTextureKey key;
+    FFLCharModelTextureKey_InitMask(&key, &piCharModel->charInfo, expression,
+        textureResolution, piCharModel->charModelDesc.resourceType);
+    FFLCharModelTexture* pMask = FFLCharModelTextureCache_Acquire(&gCharModelTextureCache, &key);
+    if (pMask != NULL) // drawn before, maybe by another CharModel
+        return pMask;
+
+    assert(piCharModel->pTextureTempObject != NULL); // deleted by DeleteCharModelMaskDrawParams
+    pMask = FFLCharModelTextureCache_Add(&gCharModelTextureCache, &key, textureResolution, textureResolution);
+    if (pMask == NULL)
+        return NULL;
+    TraceLog(LOG_DEBUG, "Drawing mask for expression %d in texture atlas: texture ID %d at %d, %d",
+        expression, pMask->region.texture, pMask->region.x, pMask->region.y);
+
+    ShaderForFFL_Bind(&gShaderForFFL, true);
+    Matrix texturesMatrix = MatrixIdentity();
+    ShaderForFFL_SetViewUniform(&gShaderForFFL, NULL, NULL, &texturesMatrix);
+
+    FFLiMaskTexturesTempObject* pObject = &piCharModel->pTextureTempObject->maskTextures;
+    FFLiInvalidateRawMask(pObject->pRawMaskDrawParam[expression]); // before ANY drawing
+
+    // switch to this region, cleared to rgba 0 0 0 0
+    FFLTextureAtlas_BeginRegion(&gCharModelTextureAtlas, &pMask->region, BLANK);
+    FFLGLState_Invalidate(&gShaderForFFL.glState); // raylib may change state
+    ShaderForFFL_SetCulling(&gShaderForFFL, FFL_CULL_MODE_NONE);
+
+    // mask blending
+    // glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_DST_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
+    rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
+    rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
+    glBlendEquation(GL_FUNC_ADD);
+
+    FFLShaderCallback* pCallback = &gShaderForFFL.callback;
+    FFLiDrawRawMask(pObject->pRawMaskDrawParam[expression], &pCallback); // submits draw calls to your callback
+    FFLTextureAtlas_EndRegion(&gCharModelTextureAtlas);
+
+    ShaderForFFL_Unbind(&gShaderForFFL);
+    rlSetBlendMode(BLEND_ALPHA);
+    return pMask;
+}
+
+// Change the mask that is drawn, drawing it first if it is not in
+// gCharModelTextureCache. This may draw, so call it outside of BeginDrawing.
+void SetCharModelExpression(CharModelRenderState* pState, FFLExpression expression)
+{
+    assert(expression < FFL_EXPRESSION_LIMIT);
+    assert(((FFLiCharModel*)&pState->charModel)->charModelDesc.expressionFlag & (1u << expression)); // not in expressionFlag
+
+    // Released after, so that the mask is not evicted when it is the same
+    FFLCharModelTexture* pOldMask = pState->pMask;
+    pState->pMask = AcquireCharModelMask(pState, expression);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pOldMask);
+
+    FFLSetExpression(&pState->charModel, expression);
+    pState->expression = expression;
+}
+
+// Delete the mask draw params kept by InitCharModelTextures,
+// after UnloadCharModelTextures and before FFLDeleteCharModel
+void DeleteCharModelMaskDrawParams(FFLCharModel* pCharModel)
+{
+    FFLiCharModel* piCharModel = (FFLiCharModel*)pCharModel;
+    if (piCharModel->pTextureTempObject == NULL)
+        return;
+    FFLiDeleteTempObjectMaskTextures(&piCharModel->pTextureTempObject->maskTextures, piCharModel->charModelDesc.allExpressionFlag, piCharModel->charModelDesc.resourceType);
+    FFLiDeleteTextureTempObject(piCharModel);
+    piCharModel->pTextureTempObject = NULL;
+}
+
 // calls FFLInitCharModelGPUStep or our alternative, both draw faceline and masks
-void InitCharModelTextures(FFLCharModel* pCharModel)
+void InitCharModelTextures(CharModelRenderState* pState)
 {
+    FFLCharModel* pCharModel = &pState->charModel;
     TraceLog(LOG_DEBUG, "InitCharModelTextures(%p), drawing faceline and masks...", pCharModel);
 
-    // zero-init all of this
-    memset(&gFacelineRenderTexture.texture, 0, sizeof(gFacelineRenderTexture.texture));
-    for (size_t i = 0; i < (sizeof(gMaskRenderTextures) / sizeof(gMaskRenderTextures[0])); i++)
-    {
-        memset(&gMaskRenderTextures[i].texture, 0, sizeof(gMaskRenderTextures[0].texture));
-    }
+    // both are acquired below, NULL for ones that are not drawn
+    pState->pFaceline = NULL;
+    pState->pMask = NULL;
 
     TraceLog(LOG_DEBUG, "Calling ShaderForFFL_Bind");
     ShaderForFFL_Bind(&gShaderForFFL, true); // for init textures
@@ -1162,31 +1796,43 @@ void InitCharModelTextures(FFLCharModel* pCharModel)
 
     FFLResolution textureResolution = piCharModel->charModelDesc.resolution & FFL_RESOLUTION_MASK;
     TraceLog(LOG_DEBUG, "Faceline/mask texture resolution: %d", textureResolution);
-    // apply linear filtering to mask and faceline textures
-    const int renderTextureFilter = TEXTURE_FILTER_BILINEAR;
 
     void** ppFacelineTexture2D = (void*)&piCharModel->facelineRenderTexture; // HACK: FFLiRenderTexture = FFLTexture**
-    if (*ppFacelineTexture2D != NULL) // should we draw the faceline texture?
+    bool shouldDrawFaceline = false;
+    if (*ppFacelineTexture2D != NULL) // does this CharModel have a faceline texture?
+    {
+        FFLCharModelTextureKey facelineKey;
+        FFLCharModelTextureKey_InitFaceline(&facelineKey, &piCharModel->charInfo,
+            textureResolution, piCharModel->charModelDesc.resourceType);
+        pState->pFaceline = FFLCharModelTextureCache_Acquire(&gCharModelTextureCache, &facelineKey);
+        if (pState->pFaceline != NULL)
+            TraceLog(LOG_DEBUG, "Sharing faceline texture: texture ID %d at %d, %d", pState->pFaceline->region.texture,
+                pState->pFaceline->region.x, pState->pFaceline->region.y);
+        else
+        {
+            pState->pFaceline = FFLCharModelTextureCache_Add(&gCharModelTextureCache, &facelineKey,
+                textureResolution / 2, textureResolution);
+            shouldDrawFaceline = pState->pFaceline != NULL;
+        }
+    }
+
+    if (shouldDrawFaceline)
     {
-        // assuming there is only one faceline texture ever, which there is
-        gFacelineRenderTexture = LoadRenderTexture(textureResolution / 2, textureResolution);
-        TraceLog(LOG_DEBUG, "Created render texture for faceline: %p, texture ID %d",
-            &gFacelineRenderTexture, gFacelineRenderTexture.texture.id);
-        ShaderForFFL_SetCulling(FFL_CULL_MODE_NONE);
-        // faceline texture
-        BeginTextureMode(gFacelineRenderTexture);
-        SetTextureFilter(gFacelineRenderTexture.texture, renderTextureFilter);
+        TraceLog(LOG_DEBUG, "Drawing faceline in texture atlas: texture ID %d at %d, %d",
+            pState->pFaceline->region.texture, pState->pFaceline->region.x, pState->pFaceline->region.y);
+        ShaderForFFL_SetCulling(&gShaderForFFL, FFL_CULL_MODE_NONE);
         FFLiInvalidateTempObjectFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture); // before drawing...
 
         const FFLColor facelineColor = *FFLGetDrawParamOpaNose(pCharModel)->modulateParam.pColorR;
         TraceLog(LOG_DEBUG, "Faceline color: %f, %f, %f, %f", facelineColor.r, facelineColor.g, facelineColor.b, facelineColor.a);
-        // set raylib color from FFLColor
-        ClearBackground((Color) {
+        // faceline texture, cleared to the raylib color from FFLColor
+        FFLTextureAtlas_BeginRegion(&gCharModelTextureAtlas, &pState->pFaceline->region, (Color) {
             (unsigned char)(facelineColor.r * 255.0f),
             (unsigned char)(facelineColor.g * 255.0f),
             (unsigned char)(facelineColor.b * 255.0f),
             (unsigned char)(facelineColor.a * 255.0f),
         });
+        FFLGLState_Invalidate(&gShaderForFFL.glState); // raylib may change state
 
         // glClearColor(facelineColor.r, facelineColor.g, facelineColor.b, facelineColor.a);
 
@@ -1198,61 +1844,31 @@ void InitCharModelTextures(FFLCharModel* pCharModel)
 
         FFLiDrawFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture, ppCallback);
         // FFLiShaderCallback = **FFLShaderCallback
+        FFLTextureAtlas_EndRegion(&gCharModelTextureAtlas);
     } else {
-        TraceLog(LOG_DEBUG, "Skipping rendering faceline texture (*ppFacelineTexture2D == NULL)");
+        TraceLog(LOG_DEBUG, "Skipping rendering faceline texture (none or shared)");
     }
 
-    // begin drrawing mask
+    // Only the mask of the current expression is drawn, after
+    // this, and the others when they are first used
     FFLiMaskTexturesTempObject* pObject = &piCharModel->pTextureTempObject->maskTextures;
-    FFLiInvalidatePartsTextures(&pObject->partsTextures); // before looping at ALL
-
-    // NOTE: LOOP BEGINS HERE
-    u32 lExpressionFlag = piCharModel->charModelDesc.expressionFlag;
-    for (u32 i = 0; lExpressionFlag != 0; i++, lExpressionFlag >>= 1)
-    {
-        if ((lExpressionFlag & 1) == 0)
-            // pMaskTextures->pRenderTextures[i] = NULL;
-            continue;
-
-        TraceLog(LOG_DEBUG, "Enabled expression: %d", i);
-
-        // create this mask texture
-        gMaskRenderTextures[i] = LoadRenderTexture(textureResolution, textureResolution);
-        TraceLog(LOG_DEBUG, "Created mask texture for expression %d: %p, texture ID %d",
-            i, &gMaskRenderTextures[i], gMaskRenderTextures[i].texture.id);
-
-        SetTextureFilter(gMaskRenderTextures[i].texture, renderTextureFilter);
-
-        // begin rendering to this mask texture
-        FFLiInvalidateRawMask(pObject->pRawMaskDrawParam[i]); // after verifying thisis supposed to be drawn but before ANY drawing
-
-        BeginTextureMode(gMaskRenderTextures[i]); // switch to this texture mode
-        ClearBackground(BLANK); // rgba 0 0 0 0
+    FFLiInvalidatePartsTextures(&pObject->partsTextures); // before drawing ANY mask
 
-        // mask blending
-        // glBlendFuncSeparate(GL_ONE_MINUS_DST_ALPHA, GL_DST_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
-        rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
-        rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
-        glBlendEquation(GL_FUNC_ADD);
-
-        FFLiDrawRawMask(pObject->pRawMaskDrawParam[i], ppCallback); // submits draw calls to your callback
-    }
-    // set current expresssion as the mask
-    gMaskRenderTextureCurrent = &gMaskRenderTextures[piCharModel->expression];
+    pState->expression = (FFLExpression)piCharModel->expression;
 
-    // cleanup!!!
+    // cleanup!!! the mask draw params are kept, see DeleteCharModelMaskDrawParams
     if (*ppFacelineTexture2D != NULL)
         FFLiDeleteTempObjectFacelineTexture(&piCharModel->pTextureTempObject->facelineTexture, &piCharModel->charInfo, piCharModel->charModelDesc.resourceType);
-    FFLiDeleteTempObjectMaskTextures(&piCharModel->pTextureTempObject->maskTextures, piCharModel->charModelDesc.allExpressionFlag, piCharModel->charModelDesc.resourceType);
-    FFLiDeleteTextureTempObject(piCharModel);
 
-    EndTextureMode();
+    ShaderForFFL_Unbind(&gShaderForFFL);
     // Go back to normal blend mode
     rlSetBlendMode(BLEND_ALPHA);
     /*
     rlSetBlendFactorsSeparate(RL_ONE_MINUS_DST_ALPHA, RL_DST_ALPHA, RL_SRC_ALPHA, RL_DST_ALPHA, RL_MIN, RL_MIN);
     rlSetBlendMode(RL_BLEND_CUSTOM_SEPARATE);
 */
+    // draws the mask of the current expression
+    SetCharModelExpression(pState, pState->expression);
     // FFLInitCharModelGPUStep does not return anything so neither do we
     TraceLog(LOG_DEBUG, "Exiting InitCharModelTextures");
 }
@@ -1296,9 +1912,119 @@ void CalculateBodyScale(Vector3* scale, float build, float height)
     scale->z = scale->x;
 }
 
-void UpdateCharModel(FFLCharModel* pModel, const FFLiCharInfo* pNewCharInfo)
+// What an edit to the CharInfo changes on its CharModel
+typedef enum CharInfoEditFlag
+{
+    CHAR_INFO_EDIT_SHAPE    = 1 << 0, // shapes are rebuilt and uploaded again
+    CHAR_INFO_EDIT_FACELINE = 1 << 1, // faceline texture is drawn again
+    CHAR_INFO_EDIT_MASK     = 1 << 2, // mask textures are drawn again
+    CHAR_INFO_EDIT_COLOR    = 1 << 3, // only colors of shapes, from FFLInitCharModelCPUStep
+    CHAR_INFO_EDIT_ALL      = CHAR_INFO_EDIT_SHAPE | CHAR_INFO_EDIT_FACELINE | CHAR_INFO_EDIT_MASK | CHAR_INFO_EDIT_COLOR
+} CharInfoEditFlag;
+
+// What an edit to each FFLCharInfoField changes, as CharInfoEditFlag bits.
+// FACELINE and MASK follow the fields of FFLCharModelTextureKey_InitFaceline
+// and FFLCharModelTextureKey_InitMask.
+static const u8 cCharInfoFieldEditFlags[FFL_CHAR_INFO_FIELD_MAX] = {
+    [FFL_CHAR_INFO_FIELD_FACE_TYPE]           = CHAR_INFO_EDIT_SHAPE | CHAR_INFO_EDIT_FACELINE,
+    [FFL_CHAR_INFO_FIELD_FACELINE_COLOR]      = CHAR_INFO_EDIT_FACELINE | CHAR_INFO_EDIT_COLOR,
+    [FFL_CHAR_INFO_FIELD_FACE_LINE]           = CHAR_INFO_EDIT_FACELINE,
+    [FFL_CHAR_INFO_FIELD_FACE_MAKEUP]         = CHAR_INFO_EDIT_FACELINE,
+    [FFL_CHAR_INFO_FIELD_HAIR_TYPE]           = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_HAIR_COLOR]          = CHAR_INFO_EDIT_COLOR,
+    [FFL_CHAR_INFO_FIELD_HAIR_DIR]            = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_EYE_TYPE]            = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_COLOR]           = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_SCALE]           = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_SCALE_Y]         = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_ROTATE]          = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_SPACING_X]       = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYE_POSITION_Y]      = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_TYPE]        = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_COLOR]       = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_SCALE]       = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_SCALE_Y]     = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_ROTATE]      = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_SPACING_X]   = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_EYEBROW_POSITION_Y]  = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_NOSE_TYPE]           = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_NOSE_SCALE]          = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_NOSE_POSITION_Y]     = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_MOUTH_TYPE]          = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOUTH_COLOR]         = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOUTH_SCALE]         = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOUTH_SCALE_Y]       = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOUTH_POSITION_Y]    = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MUSTACHE_TYPE]       = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_BEARD_TYPE]          = CHAR_INFO_EDIT_SHAPE | CHAR_INFO_EDIT_FACELINE,
+    [FFL_CHAR_INFO_FIELD_BEARD_COLOR]         = CHAR_INFO_EDIT_FACELINE | CHAR_INFO_EDIT_MASK | CHAR_INFO_EDIT_COLOR,
+    [FFL_CHAR_INFO_FIELD_MUSTACHE_SCALE]      = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MUSTACHE_POSITION_Y] = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_GLASS_TYPE]          = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_GLASS_COLOR]         = CHAR_INFO_EDIT_COLOR,
+    [FFL_CHAR_INFO_FIELD_GLASS_SCALE]         = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_GLASS_POSITION_Y]    = CHAR_INFO_EDIT_SHAPE,
+    [FFL_CHAR_INFO_FIELD_MOLE_TYPE]           = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOLE_SCALE]          = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOLE_POSITION_X]     = CHAR_INFO_EDIT_MASK,
+    [FFL_CHAR_INFO_FIELD_MOLE_POSITION_Y]     = CHAR_INFO_EDIT_MASK,
+};
+
+// CharInfoEditFlag bits for a dirty mask from FFLCharInfoEdit_Consume
+u32 GetCharInfoEditFlags(u64 dirtyMask)
+{
+    u32 flags = 0;
+    for (int field = 0; field < FFL_CHAR_INFO_FIELD_MAX; field++)
+    {
+        if (dirtyMask & FFL_CHAR_INFO_FIELD_BIT(field))
+            flags |= cCharInfoFieldEditFlags[field];
+    }
+    // Nothing known (no fields, or not from an FFLCharInfoEdit) is not safe
+    return flags != 0 ? flags : CHAR_INFO_EDIT_ALL;
+}
+
+// Replace the CharModel of pState with pNewModel from FFLInitCharModelCPUStep,
+// which pState then owns. editFlags are the CharInfoEditFlag bits from the old
+// CharInfo to the new one, see GetCharInfoEditFlags. Only the buffers of
+// CHAR_INFO_EDIT_SHAPE edits are uploaded again, and textures are only drawn
+// when no other CharModel has the same ones (see InitCharModelTextures).
+void SwapCharModel(CharModelRenderState* pState, const FFLCharModel* pNewModel, u32 editFlags)
 {
+    FFLCharModel* pModel = &pState->charModel;
 
+    // A CharModel can be moved with memcpy, it has no pointers to itself
+    FFLCharModel modelTempForDelete;
+    memcpy(&modelTempForDelete, pModel, sizeof(FFLCharModel));
+    memcpy(pModel, pNewModel, sizeof(FFLCharModel));
+
+    // The shapes were rebuilt even if they did not change, so move the
+    // uploaded buffers to the new ones if they are the same
+    const bool isShapeKept = !(editFlags & CHAR_INFO_EDIT_SHAPE)
+        && ShaderForFFL_RekeyCharModel(&gShaderForFFL, pModel, &modelTempForDelete, pModel);
+    if (!isShapeKept)
+        ShaderForFFL_InvalidateCharModel(&gShaderForFFL, pModel);
+    TraceLog(LOG_DEBUG, "SwapCharModel: edit flags 0x%x, %s shapes", editFlags,
+        isShapeKept ? "kept" : "uploading");
+
+    // Acquire the new textures before releasing the old ones, so that the
+    // ones that did not change are found in the cache instead of evicted
+    FFLCharModelTexture* pOldFaceline = pState->pFaceline;
+    FFLCharModelTexture* pOldMask = pState->pMask;
+    InitCharModelTextures(pState);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pOldFaceline);
+    FFLCharModelTextureCache_Release(&gCharModelTextureCache, pOldMask);
+    // delete the mask draw params of the old model
+    DeleteCharModelMaskDrawParams(&modelTempForDelete);
+
+    if (!isShapeKept)
+        ShaderForFFL_BakeCharModel(&gShaderForFFL, pModel);
+    FFLDeleteCharModel(&modelTempForDelete);
+}
+
+// Rebuild the CharModel of pState from a new CharInfo on this thread,
+// keeps the old one and returns false if it fails. See SwapCharModel for editFlags.
+bool UpdateCharModel(CharModelRenderState* pState, const FFLiCharInfo* pNewCharInfo, u32 editFlags)
+{
     FFLCharModelSource source = {
         .dataSource = FFL_DATA_SOURCE_BUFFER,
         .pBuffer = pNewCharInfo,
@@ -1306,41 +2032,18 @@ void UpdateCharModel(FFLCharModel* pModel, const FFLiCharInfo* pNewCharInfo)
     };
 
     FFLCharModelDesc desc;
-    memcpy(&desc, &((FFLiCharModel*)pModel)->charModelDesc, sizeof(FFLCharModelDesc));
-
-#if 1
-    FFLCharModel modelTempForDelete;
-    memcpy(&modelTempForDelete, pModel, sizeof(FFLCharModel));
-#else
-    FFLDeleteCharModel(pModel);
-#endif
+    memcpy(&desc, &((FFLiCharModel*)&pState->charModel)->charModelDesc, sizeof(FFLCharModelDesc));
 
-    FFLResult result = FFLInitCharModelCPUStep(pModel, &source, &desc);
+    FFLCharModel newModel;
+    FFLResult result = FFLInitCharModelCPUStep(&newModel, &source, &desc);
 
     if (result != FFL_RESULT_OK)
     {
         TraceLog(LOG_ERROR, "FFLInitCharModelCPUStep failed with result: %d", result);
-        memcpy(pModel, &modelTempForDelete, sizeof(FFLCharModel));
-        return;
-    }
-
-    // delete old render textures
-    if (gFacelineRenderTexture.texture.width)
-    {
-        UnloadRenderTexture(gFacelineRenderTexture);
-    }
-    for (size_t i = 0; i < (sizeof(gMaskRenderTextures) / sizeof(gMaskRenderTextures[0])); i++)
-    {
-        if (gMaskRenderTextures[i].id)
-        {
-            UnloadRenderTexture(gMaskRenderTextures[i]);
-        }
+        return false;
     }
-
-    InitCharModelTextures(pModel);
-#if 1
-    FFLDeleteCharModel(&modelTempForDelete);
-#endif
+    SwapCharModel(pState, &newModel, editFlags);
+    return true;
 }
 
 // Note that these are the same bones
@@ -1460,20 +2163,41 @@ void UpdateScaleForFFLBodyModel(Vector3* scaleOut, VriableIconBodyBoneKind bone,
 // early return statements.
 //
 
-void UpdateModelAnimationBonesScaling(Model model, ModelAnimation anim, int frame,
-                                           const Vector3 *perBoneScales)
-{
-    // Increase this if you have more bones.
-    static const int MAX_BONES = 64;
-    Transform worldPoses[MAX_BONES];
+// Size of pBoneNormalMatrices, same as MAX_BONES below
+#define BODY_BONE_NORMAL_MATRIX_MAX 64
 
-    if (anim.frameCount < 1 || anim.bones == NULL || anim.framePoses == NULL)
-        return;
+// Keep body animations as IQM stores them, 16-bit channels decoded for the
+// frame that is drawn, instead of decoding every frame to Transforms when loading
+#define BODY_ANIMATION_QUANTIZED
 
-    assert(anim.boneCount < MAX_BONES);
+// Matrix of a Transform: scale, then rotation, then translation
+Matrix GetTransformMatrix(const Transform *transform)
+{
+    return MatrixMultiply(MatrixMultiply(
+        MatrixScale(transform->scale.x, transform->scale.y, transform->scale.z),
+        QuaternionToMatrix(transform->rotation)),
+        MatrixTranslate(transform->translation.x, transform->translation.y, transform->translation.z));
+}
 
-    if (frame >= anim.frameCount) frame = frame % anim.frameCount;
+// Inverse of the bind matrix of each bone of model, made once after loading it
+// since the bind pose never changes. Free with RL_FREE, NULL without bones.
+Matrix *LoadInverseBindMatrices(Model model)
+{
+    if (model.boneCount < 1 || model.bindPose == NULL)
+        return NULL;
 
+    Matrix *inverseBindMatrices = (Matrix *)RL_MALLOC(model.boneCount * sizeof(Matrix));
+    for (int i = 0; i < model.boneCount; i++)
+        inverseBindMatrices[i] = MatrixInvert(GetTransformMatrix(&model.bindPose[i]));
+    return inverseBindMatrices;
+}
+
+// worldPoses holds the local pose of each bone, and receives their world poses.
+// inverseBindMatrices is from LoadInverseBindMatrices(model).
+// pBoneNormalMatrices receives a mat3 (9 floats) for each bone, or is NULL
+void UpdateModelBonesScaling(Model model, const Matrix *inverseBindMatrices, const BoneInfo *bones, int boneCount,
+                                  Transform *worldPoses, const Vector3 *perBoneScales, float *pBoneNormalMatrices)
+{
     int firstMeshWithBones = -1;
     for (int i = 0; i < model.meshCount; i++)
     {
@@ -1486,19 +2210,15 @@ void UpdateModelAnimationBonesScaling(Model model, ModelAnimation anim, int fram
 
     if (firstMeshWithBones == -1)
         return;
-
-    // Allocate temporary workspace for this frame only
-    // Transform *worldPoses = (Transform *)RL_MALLOC(anim.boneCount * sizeof(Transform));
-    // Copy local poses from animation frame
-    memcpy(worldPoses, anim.framePoses[frame], anim.boneCount * sizeof(Transform));
+    assert(inverseBindMatrices != NULL && boneCount <= model.boneCount);
 
     // === Build world transforms WITH per-bone scaling ===
-    for (int i = 0; i < anim.boneCount; i++)
+    for (int i = 0; i < boneCount; i++)
     {
-        if (anim.bones[i].parent < 1)
+        if (bones[i].parent < 1)
             continue;
 
-        int parentIdx = anim.bones[i].parent;
+        int parentIdx = bones[i].parent;
 #if 1
         Vector3 parentScale = perBoneScales ? perBoneScales[parentIdx] : (Vector3){1, 1, 1};
 #else
@@ -1534,29 +2254,22 @@ void UpdateModelAnimationBonesScaling(Model model, ModelAnimation anim, int fram
 #if 1
     if (perBoneScales)
     {
-        // for (int i = 0; i < anim.boneCount; i++)
+        // for (int i = 0; i < boneCount; i++)
         for (int i = VriableIconBodyBoneKind_AllRoot; i < VriableIconBodyBoneKind_End; i++)
             worldPoses[i].scale = Vector3Multiply(worldPoses[i].scale, perBoneScales[i]);
     }
 #endif
 
     // === Compute final bone matrices ===
-    for (int boneId = 0; boneId < anim.boneCount; boneId++)
+    for (int boneId = 0; boneId < boneCount; boneId++)
     {
-        Transform *bindTransform = &model.bindPose[boneId];
-        Matrix bindMatrix = MatrixMultiply(MatrixMultiply(
-            MatrixScale(bindTransform->scale.x, bindTransform->scale.y, bindTransform->scale.z),
-            QuaternionToMatrix(bindTransform->rotation)),
-            MatrixTranslate(bindTransform->translation.x, bindTransform->translation.y, bindTransform->translation.z));
-
-        Transform *targetTransform = &worldPoses[boneId];
-        Matrix targetMatrix = MatrixMultiply(MatrixMultiply(
-            MatrixScale(targetTransform->scale.x, targetTransform->scale.y, targetTransform->scale.z),
-            QuaternionToMatrix(targetTransform->rotation)),
-            MatrixTranslate(targetTransform->translation.x, targetTransform->translation.y, targetTransform->translation.z));
+        Matrix targetMatrix = GetTransformMatrix(&worldPoses[boneId]);
 
         model.meshes[firstMeshWithBones].boneMatrices[boneId] =
-            MatrixMultiply(MatrixInvert(bindMatrix), targetMatrix);
+            MatrixMultiply(inverseBindMatrices[boneId], targetMatrix);
+        // Normal matrix once per bone, rather than for every vertex in the shader
+        if (pBoneNormalMatrices != NULL)
+            GetNormalMatrix3(model.meshes[firstMeshWithBones].boneMatrices[boneId], &pBoneNormalMatrices[boneId * 9]);
     }
 
     // Copy to other meshes
@@ -1571,12 +2284,299 @@ void UpdateModelAnimationBonesScaling(Model model, ModelAnimation anim, int fram
     }
 }
 
-void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel* pCharModel, FFLExpression initialExpression, double now);
+// Update the bones of model to a frame of an animation from LoadModelAnimationsIQMParents
+void UpdateModelAnimationBonesScaling(Model model, const Matrix *inverseBindMatrices, ModelAnimation anim, int frame,
+                                           const Vector3 *perBoneScales, float *pBoneNormalMatrices)
+{
+    // Increase this if you have more bones.
+    static const int MAX_BONES = 64;
+    Transform worldPoses[MAX_BONES];
+
+    if (anim.frameCount < 1 || anim.bones == NULL)
+        return;
+
+    assert(anim.boneCount < MAX_BONES);
+
+    if (frame >= anim.frameCount) frame = frame % anim.frameCount;
+
+    // Allocate temporary workspace for this frame only
+    // Transform *worldPoses = (Transform *)RL_MALLOC(anim.boneCount * sizeof(Transform));
+    // Copy local poses from animation frame, each component is stored frame by frame
+    const IQMFramePoses* pFramePoses = GetIQMFramePoses(&anim);
+    for (int i = 0; i < anim.boneCount; i++)
+        worldPoses[i] = GetIQMFramePose(pFramePoses, frame, i);
+
+    UpdateModelBonesScaling(model, inverseBindMatrices, anim.bones, anim.boneCount, worldPoses, perBoneScales, pBoneNormalMatrices);
+}
+
+// Same for an animation kept quantized, only decoding the frame that is
+// used. frame may be between two frames to blend them.
+void UpdateModelQuantizedAnimationBonesScaling(Model model, const Matrix *inverseBindMatrices,
+                                                    const IQMQuantizedAnimation* pAnim, float frame,
+                                                    const Vector3 *perBoneScales, float *pBoneNormalMatrices)
+{
+    Transform worldPoses[BODY_BONE_NORMAL_MATRIX_MAX];
+    float scratch[IQM_QUANTIZED_SCRATCH_SIZE(BODY_BONE_NORMAL_MATRIX_MAX)];
+
+    if (pAnim->frameCount < 1)
+        return;
+
+    assert(pAnim->boneCount < BODY_BONE_NORMAL_MATRIX_MAX);
+
+    SampleIQMQuantizedAnimation(pAnim, frame, scratch, worldPoses);
+    UpdateModelBonesScaling(model, inverseBindMatrices, pAnim->bones, pAnim->boneCount, worldPoses, perBoneScales, pBoneNormalMatrices);
+}
+
+// Draw the body with one of ShaderFFLSkinningMode, the shader must be bound.
+// Bone normal matrices and the palette are both from the current animation frame.
+void DrawBodyModel(Model model, Matrix matBodyScale, int skinningMode,
+    const float* pBoneNormalMatrices, const Vector4* pBonePalette,
+    Vector3 pantsColor, Vector3 bodyColor)
+{
+    for (int i = 0; i < model.meshCount; i++) // will be 0 if failed to load
+    {
+        Material material = model.materials[model.meshMaterial[i]];
+        if ((i % 2) == 0) // pants
+        {
+            material.shader = ShaderForFFL_SelectVariant(&gShaderForFFL, FFL_MODULATE_MODE_CONSTANT, MATERIAL_PARAM_PANTS, skinningMode);
+            ShaderForFFL_SetPixelUniform(&gShaderForFFL, SH_FFL_PIXEL_UNIFORM_CONST1, &pantsColor, SHADER_UNIFORM_VEC3);
+        }
+        else
+        {
+            material.shader = ShaderForFFL_SelectVariant(&gShaderForFFL, FFL_MODULATE_MODE_CONSTANT, MATERIAL_PARAM_BODY, skinningMode);
+            ShaderForFFL_SetPixelUniform(&gShaderForFFL, SH_FFL_PIXEL_UNIFORM_CONST1, &bodyColor, SHADER_UNIFORM_VEC3);
+        }
+        if (model.meshes[i].boneMatrices != NULL)
+        {
+            const int boneCount = model.meshes[i].boneCount < BODY_BONE_NORMAL_MATRIX_MAX
+                ? model.meshes[i].boneCount : BODY_BONE_NORMAL_MATRIX_MAX;
+            if (skinningMode == SH_FFL_SKINNING_PALETTE)
+                ShaderForFFL_SetBonePalette(&gShaderForFFL, pBonePalette, boneCount);
+            else
+                ShaderForFFL_SetBoneNormalMatrices(&gShaderForFFL, pBoneNormalMatrices, boneCount);
+        }
+        ShaderForFFL_DrawMesh(&gShaderForFFL, model.meshes[i], material, matBodyScale);
+    }
+}
+
+// Number of times the body is drawn with each skinning mode by BenchmarkBodySkinning
+#define SKINNING_BENCHMARK_DRAW_COUNT 256
+
+// Time drawing the body with each skinning mode, in milliseconds per draw
+// of the whole body. glFinish is called around each run, so this
+// includes uploading the bones and the vertex shader itself.
+void BenchmarkBodySkinning(Model model, Matrix matBodyScale,
+    const float* pBoneNormalMatrices, const Vector4* pBonePalette,
+    Vector3 pantsColor, Vector3 bodyColor, double* pMsPerDraw)
+{
+    for (int mode = SH_FFL_SKINNING_MATRIX; mode < SH_FFL_SKINNING_MODE_MAX; mode++)
+    {
+        // Link the variants and warm up the driver before timing
+        DrawBodyModel(model, matBodyScale, mode, pBoneNormalMatrices, pBonePalette, pantsColor, bodyColor);
+        glFinish();
+
+        const double start = GetTime();
+        for (int i = 0; i < SKINNING_BENCHMARK_DRAW_COUNT; i++)
+            DrawBodyModel(model, matBodyScale, mode, pBoneNormalMatrices, pBonePalette, pantsColor, bodyColor);
+        glFinish();
+        pMsPerDraw[mode] = (GetTime() - start) * 1000.0 / SKINNING_BENCHMARK_DRAW_COUNT;
+    }
+    TraceLog(LOG_INFO, "Skinning benchmark (%d draws): matrix %.4f ms, palette %.4f ms per draw",
+        SKINNING_BENCHMARK_DRAW_COUNT, pMsPerDraw[SH_FFL_SKINNING_MATRIX], pMsPerDraw[SH_FFL_SKINNING_PALETTE]);
+}
+
+// Times decoding every frame of the bundled body animations with each kernel
+#define ANIMATION_BENCHMARK_PASS_COUNT 64
+
+// Time decoding the quantized animations of the bundled bodies, with the
+// scalar and the SIMD kernels, in frames decoded per second. A frame is
+// dequantizing its channels and normalizing its rotations, as sampling does.
+void BenchmarkAnimationDecode(double* pFramesPerSecond)
+{
+    const char* paths[] = {
+        "models/miibodymiddle female test.iqm",
+        "models/miibodymiddle male test.iqm"
+    };
+    IQMQuantizedAnimation* animations[2];
+    int animCounts[2] = { 0 };
+    int boneCount = 0;
+    int channelCount = 0;
+    for (int f = 0; f < 2; f++)
+    {
+        animations[f] = LoadModelAnimationsIQMQuantized(paths[f], &animCounts[f]);
+        for (int a = 0; animations[f] != NULL && a < animCounts[f]; a++)
+        {
+            boneCount = animations[f][a].boneCount > boneCount ? animations[f][a].boneCount : boneCount;
+            channelCount = animations[f][a].plan.channelCount > channelCount
+                ? animations[f][a].plan.channelCount : channelCount;
+        }
+    }
+    float* channels = (float*)RL_MALLOC((boneCount * IQM_POSE_CHANNELS + channelCount) * sizeof(float));
+    float* values = channels + boneCount * IQM_POSE_CHANNELS;
+
+    float sum = 0.0f; // keeps the decoding from being optimized out
+    for (int kernel = 0; kernel < 2; kernel++)
+    {
+        int frameCount = 0;
+        const double start = GetTime();
+        for (int pass = 0; pass < ANIMATION_BENCHMARK_PASS_COUNT; pass++)
+        {
+            for (int f = 0; f < 2; f++)
+            {
+                for (int a = 0; animations[f] != NULL && a < animCounts[f]; a++)
+                {
+                    const IQMQuantizedAnimation* pAnim = &animations[f][a];
+                    for (int frame = 0; frame < pAnim->frameCount; frame++)
+                    {
+                        const unsigned short* data = pAnim->frames + (size_t)frame * pAnim->plan.channelCount;
+                        if (kernel == 0)
+                        {
+                            DecodeIQMChannelsScalar(&pAnim->plan, data, channels, values);
+                            NormalizeIQMRotationsScalar(channels, pAnim->boneCount);
+                        }
+                        else
+                        {
+                            DecodeIQMChannels(&pAnim->plan, data, channels, values);
+                            NormalizeIQMRotations(channels, pAnim->boneCount);
+                        }
+                        sum += channels[frame % (pAnim->boneCount * IQM_POSE_CHANNELS)];
+                    }
+                    frameCount += pAnim->frameCount;
+                }
+            }
+        }
+        const double seconds = GetTime() - start;
+        pFramesPerSecond[kernel] = seconds > 0.0 ? frameCount / seconds : 0.0;
+    }
+    TraceLog(LOG_INFO, "Animation decode benchmark (%d passes, checksum %f): scalar %.0f, SIMD %.0f frames per second",
+        ANIMATION_BENCHMARK_PASS_COUNT, sum, pFramesPerSecond[0], pFramesPerSecond[1]);
+
+    RL_FREE(channels);
+    for (int f = 0; f < 2; f++)
+    {
+        if (animations[f] != NULL)
+            UnloadModelAnimationsIQMQuantized(animations[f], animCounts[f]);
+    }
+}
+
+// Synthetic animation library loaded by BenchmarkAnimationLoad: the first
+// animation of the bundled body, cut into clips of this many frames
+#define ANIMATION_LOAD_BENCHMARK_CLIP_COUNT 64
+#define ANIMATION_LOAD_BENCHMARK_CLIP_FRAMES 480
+#define ANIMATION_LOAD_BENCHMARK_PASS_COUNT 4
+#define ANIMATION_LOAD_BENCHMARK_THREAD_COUNT 4
+
+// Make an IQM file with clipCount animations of clipFrameCount frames each,
+// from a copy of fileData with its anims and frames sections replaced.
+// Frames are taken from the first animation of fileData, looping it.
+unsigned char* MakeIQMAnimationLibrary(const unsigned char* fileData, unsigned int dataSize,
+    int clipCount, int clipFrameCount, unsigned int* pLibrarySize)
+{
+    const IQMHeader* pHeader = (const IQMHeader*)fileData;
+    const IQMAnim* pSourceAnim = (const IQMAnim*)(fileData + pHeader->ofs_anims);
+    const size_t frameSize = pHeader->num_framechannels * sizeof(unsigned short);
+    const unsigned int frameCount = (unsigned int)clipCount * clipFrameCount;
+
+    const unsigned int animsOffset = (dataSize + 3) & ~3u;
+    const unsigned int framesOffset = animsOffset + clipCount * sizeof(IQMAnim);
+    *pLibrarySize = framesOffset + (unsigned int)(frameCount * frameSize);
+    unsigned char* pLibrary = (unsigned char*)RL_CALLOC(*pLibrarySize, 1);
+    memcpy(pLibrary, fileData, dataSize);
+
+    IQMHeader* pLibraryHeader = (IQMHeader*)pLibrary;
+    pLibraryHeader->dataSize = *pLibrarySize;
+    pLibraryHeader->num_anims = clipCount;
+    pLibraryHeader->ofs_anims = animsOffset;
+    pLibraryHeader->num_frames = frameCount;
+    pLibraryHeader->ofs_frames = framesOffset;
+
+    IQMAnim* pAnims = (IQMAnim*)(pLibrary + animsOffset);
+    for (int i = 0; i < clipCount; i++)
+    {
+        pAnims[i] = *pSourceAnim;
+        pAnims[i].first_frame = i * clipFrameCount;
+        pAnims[i].num_frames = clipFrameCount;
+    }
+    for (unsigned int i = 0; i < frameCount; i++)
+    {
+        memcpy(pLibrary + framesOffset + i * frameSize,
+            fileData + pHeader->ofs_frames + (pSourceAnim->first_frame + i % pSourceAnim->num_frames) * frameSize,
+            frameSize);
+    }
+    return pLibrary;
+}
+
+// Time loading a synthetic library of clips made from the bundled body animation,
+// decoding on one thread and on ANIMATION_LOAD_BENCHMARK_THREAD_COUNT threads,
+// in milliseconds per load. Both have to give the same frame poses.
+void BenchmarkAnimationLoad(double* pMsPerLoad)
+{
+    int fileSize = 0;
+    unsigned char* pFileData = LoadFileData("models/miibodymiddle female test.iqm", &fileSize);
+    if (pFileData == NULL)
+        return;
+    const IQMHeader* pHeader = CheckIQMAnimations(pFileData, (unsigned int)fileSize, "models/miibodymiddle female test.iqm");
+    if (pHeader == NULL || pHeader->num_anims == 0
+        || ((const IQMAnim*)(pFileData + pHeader->ofs_anims))->num_frames == 0)
+    {
+        UnloadFileData(pFileData);
+        return;
+    }
+    unsigned int librarySize = 0;
+    unsigned char* pLibrary = MakeIQMAnimationLibrary(pFileData, (unsigned int)fileSize,
+        ANIMATION_LOAD_BENCHMARK_CLIP_COUNT, ANIMATION_LOAD_BENCHMARK_CLIP_FRAMES, &librarySize);
+    UnloadFileData(pFileData);
+
+    // Loaded once first to compare against, which also warms up the allocator
+    const int cThreadCounts[2] = { 1, ANIMATION_LOAD_BENCHMARK_THREAD_COUNT };
+    int expectedCount = 0;
+    ModelAnimation* pExpected = LoadModelAnimationsIQMParentsFromMemory(pLibrary, librarySize, &expectedCount, 1);
+    bool isSame = true;
+    for (int i = 0; i < 2; i++)
+    {
+        const double start = GetTime();
+        for (int pass = 0; pass < ANIMATION_LOAD_BENCHMARK_PASS_COUNT; pass++)
+        {
+            int count = 0;
+            ModelAnimation* pAnimations = LoadModelAnimationsIQMParentsFromMemory(pLibrary, librarySize, &count, cThreadCounts[i]);
+            isSame = isSame && count == expectedCount;
+            for (int a = 0; isSame && a < count; a++)
+            {
+                const IQMFramePoses* pPoses = GetIQMFramePoses(&pAnimations[a]);
+                const IQMFramePoses* pExpectedPoses = GetIQMFramePoses(&pExpected[a]);
+                const size_t poseCount = (size_t)pPoses->frameCount * pPoses->boneCount;
+                isSame = memcmp(pPoses->translations, pExpectedPoses->translations, poseCount * sizeof(Vector3)) == 0
+                    && memcmp(pPoses->rotations, pExpectedPoses->rotations, poseCount * sizeof(Quaternion)) == 0
+                    && memcmp(pPoses->scales, pExpectedPoses->scales, poseCount * sizeof(Vector3)) == 0;
+            }
+            UnloadModelAnimationsIQMParents(pAnimations, count);
+        }
+        pMsPerLoad[i] = (GetTime() - start) * 1000.0 / ANIMATION_LOAD_BENCHMARK_PASS_COUNT;
+    }
+    TraceLog(isSame ? LOG_INFO : LOG_WARNING,
+        "Animation load benchmark (%d clips of %d frames): 1 thread %.2f ms, %d threads %.2f ms per load, frame poses %s",
+        ANIMATION_LOAD_BENCHMARK_CLIP_COUNT, ANIMATION_LOAD_BENCHMARK_CLIP_FRAMES, pMsPerLoad[0],
+        ANIMATION_LOAD_BENCHMARK_THREAD_COUNT, pMsPerLoad[1], isSame ? "match" : "DIFFER");
+
+    UnloadModelAnimationsIQMParents(pExpected, expectedCount);
+    RL_FREE(pLibrary);
+}
+
+void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, CharModelRenderState* pState, FFLExpression initialExpression, double now);
 
 #ifdef FFL_USE_TEXTURE_CALLBACK
 
 void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLTexture* pTexture)
 {
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    FFLDeferredTextureList* pDeferredTextures = FFLDeferredTextureList_GetCurrent();
+    if (pDeferredTextures != NULL)
+    {
+        // No GL context on the worker, created when the model is picked up
+        FFLDeferredTextureList_PushCreate(pDeferredTextures, pTextureInfo, pTexture);
+        return;
+    }
+#endif
     /*
         if (!pTextureInfo || !pTexture)
             return; // Invalid input
@@ -1599,11 +2599,9 @@ void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLText
     glGenTextures(1, &textureHandle);
     glBindTexture(GL_TEXTURE_2D, textureHandle);
 
-    // Configure texture parameters (wrap and filter modes)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Configure texture parameters (wrap and filter modes) once here,
+    // draws only bind a sampler (or change the wrap mode without sampler objects)
+    FFLGLSampler_SetTextureParams(FFL_GL_SAMPLER_CLAMP);
 
     // Determine OpenGL format based on FFLTextureInfo format
     GLenum internalFormat, format, type;
@@ -1692,6 +2690,17 @@ void TextureCallback_Create(void* v, const FFLTextureInfo* pTextureInfo, FFLText
 
 void TextureCallback_Delete(void* v, FFLTexture* pTexture)
 {
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    FFLDeferredTextureList* pDeferredTextures = FFLDeferredTextureList_GetCurrent();
+    if (pDeferredTextures != NULL)
+    {
+        // When building failed, or a model that was not picked up is deleted,
+        // the texture was not created yet
+        if (!FFLDeferredTextureList_PushDelete(pDeferredTextures, pTexture))
+            TraceLog(LOG_WARNING, "DeleteTexture: texture %p was not recorded in the deferred texture list", pTexture);
+        return;
+    }
+#endif
     /*
         if (!pTexture || !*pTexture)
             return; // Invalid input
@@ -1725,6 +2734,11 @@ void TextureCallback_CreateNull(void* v, const FFLTextureInfo* pTextureInfo, FFL
 
 FFLTextureCallback gTextureCallback;
 
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+// Builds the edited CharModel without stalling frames
+FFLCharModelBuilder gCharModelBuilder;
+#endif
+
 void SetNullTextureCallback()
 {
     gTextureCallback.useOriginalTileMode = false;
@@ -1750,8 +2764,14 @@ void UpdateBodyScale(Vector3* pBodyScale, Vector3* pBoneScales, float build, flo
         UpdateScaleForFFLBodyModel(&pBoneScales[i], i, pBodyScale);
 }
 
-extern bool _Z37FFLiCompareCharInfoWithAdditionalInfoPiiPK12FFLiCharInfoS2_PK17FFLAdditionalInfoS5_(int* pFlagOut, int flagIn, const FFLiCharInfo* pCharInfoA, const FFLiCharInfo* pCharInfoB, const FFLAdditionalInfo* pAdditionalInfoA, const FFLAdditionalInfo* pAdditionalInfoB);
-#define FFLiCompareCharInfoWithAdditionalInfo _Z37FFLiCompareCharInfoWithAdditionalInfoPiiPK12FFLiCharInfoS2_PK17FFLAdditionalInfoS5_
+// GuiSpinner for a field of the edited CharInfo, marks it dirty when it changes
+void GuiCharInfoSpinner(Rectangle bounds, const char* text, FFLCharInfoEdit* pEdit,
+    FFLCharInfoField field, int minValue, int maxValue)
+{
+    int value = FFLCharInfoEdit_Get(pEdit, field);
+    GuiSpinner(bounds, text, &value, minValue, maxValue, true);
+    FFLCharInfoEdit_Set(pEdit, field, value);
+}
 
 int main(void)
 {
@@ -1771,6 +2791,10 @@ int main(void)
 
     TraceLog(LOG_DEBUG, "Calling ShaderForFFL_Initialize(%p)", &gShaderForFFL);
     ShaderForFFL_Initialize(&gShaderForFFL);
+    // apply linear filtering to mask and faceline textures
+    FFLTextureAtlas_Initialize(&gCharModelTextureAtlas, TEXTURE_FILTER_BILINEAR);
+    FFLCharModelTextureCache_Initialize(&gCharModelTextureCache, &gCharModelTextureAtlas,
+        FFL_CHAR_MODEL_TEXTURE_CACHE_BUDGET_DEFAULT);
 
     gTextureCallback.useOriginalTileMode = false;
 #ifdef FFL_USE_TEXTURE_CALLBACK
@@ -1786,15 +2810,22 @@ int main(void)
     FFLSetNormalIsSnorm8_8_8_8(true);
 #endif
 
-    FFLCharModel charModel;
+    CharModelRenderState charModelState = { 0 }; // the CharModel and its textures
+    FFLCharModel* pCharModel = &charModelState.charModel;
     bool isFFLModelCreated = false;
     if (isFFLAvailable)
     {
-        TraceLog(LOG_DEBUG, "Creating FFLCharModel at %p", &charModel);
-        isFFLModelCreated = CreateCharModelFromStoreData(&charModel, (const void*)(&cBlancoStoreData)) == FFL_RESULT_OK;
+        TraceLog(LOG_DEBUG, "Creating FFLCharModel at %p", pCharModel);
+        isFFLModelCreated = CreateCharModelFromStoreData(pCharModel, (const void*)(&cBlancoStoreData)) == FFL_RESULT_OK;
         if (isFFLModelCreated)
-            InitCharModelTextures(&charModel); // does drawing
+        {
+            InitCharModelTextures(&charModelState); // does drawing
+            ShaderForFFL_BakeCharModel(&gShaderForFFL, pCharModel); // uploads shapes
+        }
     }
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    const bool isCharModelBuilderStarted = FFLCharModelBuilder_Initialize(&gCharModelBuilder);
+#endif
 
     // Set up the camera for the 3D cube
 #ifndef NO_MODELS_FOR_TEST
@@ -1826,23 +2857,22 @@ int main(void)
     if (acceModel.meshes == NULL)
         TraceLog(LOG_DEBUG, "Accessory model also failed to load.");
 
-    if (gShaderForFFL.shader.locs != NULL)
-    {
-        for (int j = 0; j < model.materialCount; j++)
-        {
-            model.materials[j].shader = gShaderForFFL.shader;
-        }
-        for (int j = 0; j < acceModel.materialCount; j++)
-        {
-            acceModel.materials[j].shader = gShaderForFFL.shader;
-        }
-    }
+    // The bind pose never changes, so its matrices are made once here
+    Matrix* inverseBindMatrices = LoadInverseBindMatrices(model);
+    const Matrix headBindMatrix = model.boneCount > VriableIconBodyBoneKind_Head
+        ? GetTransformMatrix(&model.bindPose[VriableIconBodyBoneKind_Head]) : MatrixIdentity();
+
+    // NOTE: material shaders are set to the variant selected before each draw
 
     // Load gltf model animations
     int animsCount = 0;
     unsigned int animIndex = 0;
     int animCurrentFrame = 0;
+#ifdef BODY_ANIMATION_QUANTIZED
+    IQMQuantizedAnimation* modelAnimations = LoadModelAnimationsIQMQuantized(modelPath, &animsCount);
+#else
     ModelAnimation* modelAnimations = LoadModelAnimationsIQMParents(modelPath, &animsCount);
+#endif
     if (modelAnimations == NULL)
         TraceLog(LOG_DEBUG, "modelAnimations == NULL, not updating animation or head matrices");
 
@@ -1854,7 +2884,7 @@ int main(void)
     // blinking logic
     bool isBlinking = false;
     double lastBlinkTime = GetTime();
-    FFLExpression initialExpression = FFLGetExpression(&charModel);
+    FFLExpression initialExpression = FFLGetExpression(pCharModel);
 
 #ifndef NO_MODELS_FOR_TEST
     // height and build
@@ -1867,7 +2897,7 @@ int main(void)
     float build, height;
     if (isFFLModelCreated)
     {
-        FFLGetPartsTransform(&partsTransform, &charModel);
+        FFLGetPartsTransform(&partsTransform, pCharModel);
         //acceMatrix = MatrixTranslate(partsTransform.hatTranslate.x, partsTransform.hatTranslate.y, partsTransform.hatTranslate.z);
         Matrix acceSideTranslate = MatrixTranslate(partsTransform.headSideTranslate.x, partsTransform.headSideTranslate.y, partsTransform.headSideTranslate.z);
         Matrix acceSideTranslateRight = MatrixTranslate(-partsTransform.headSideTranslate.x, partsTransform.headSideTranslate.y, partsTransform.headSideTranslate.z);
@@ -1879,7 +2909,7 @@ int main(void)
 
         int iHeight, iBuild;
         //iHeight = 1; iBuild = 1; // NOTE: FOR DEBUG
-        GetHeightAndBuildFromFFLCharModel(&charModel, &iHeight, &iBuild);
+        GetHeightAndBuildFromFFLCharModel(pCharModel, &iHeight, &iBuild);
         build = (float)iBuild;
         height = (float)iHeight;
     }
@@ -1895,6 +2925,24 @@ int main(void)
 #endif
 
     Vector3 boneScales[VriableIconBodyBoneKind_End];
+    // Normal matrix for each of model.meshes[].boneMatrices, as a mat3
+    float boneNormalMatrices[BODY_BONE_NORMAL_MATRIX_MAX * 9];
+    for (int i = 0; i < BODY_BONE_NORMAL_MATRIX_MAX; i++)
+        GetNormalMatrix3(MatrixIdentity(), &boneNormalMatrices[i * 9]);
+    // Same bone matrices as 3x4 rows, for SH_FFL_SKINNING_PALETTE
+    Vector4 bonePalette[BODY_BONE_NORMAL_MATRIX_MAX * 3];
+    {
+        const Matrix identity = MatrixIdentity();
+        for (int i = 0; i < BODY_BONE_NORMAL_MATRIX_MAX; i++)
+            GetBonePalette3x4(&identity, 1, &bonePalette[i * 3]);
+    }
+    // Toggled with K, B compares both modes
+    int bodySkinningMode = SH_FFL_SKINNING_PALETTE;
+    double skinningBenchmarkMs[SH_FFL_SKINNING_MODE_MAX] = { 0 };
+    // Frames per second decoding animations with the scalar and SIMD kernels, from N
+    double animationBenchmarkFps[2] = { 0 };
+    // Milliseconds loading an animation library on one and several threads, from L
+    double animationLoadBenchmarkMs[2] = { 0 };
     for (int i = VriableIconBodyBoneKind_AllRoot; i < VriableIconBodyBoneKind_End; i++)
         boneScales[i].x = boneScales[i].y = boneScales[i].z = 1.0f;
 
@@ -1903,10 +2951,14 @@ int main(void)
 
     float newBuild = build; float newHeight = height;
 
-    const FFLiCharInfo* pInfoCurrent = (const FFLiCharInfo*)&charModel;
+    const FFLiCharInfo* pInfoCurrent = (const FFLiCharInfo*)pCharModel;
 
-    FFLiCharInfo charInfo; // new charinfo
-    memcpy(&charInfo, pInfoCurrent, sizeof(FFLiCharInfo));
+    FFLCharInfoEdit charInfoEdit; // new charinfo, edited by the UI
+    FFLCharInfoEdit_Initialize(&charInfoEdit, pInfoCurrent);
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    // Fields edited since the current CharModel, until one built with them is swapped in
+    u64 builderDirtyMask = 0;
+#endif
 
 
     // Main game loop
@@ -1920,26 +2972,54 @@ int main(void)
         // Update
         //----------------------------------------------------------------------------------
 
-        // Compare current CharInfo with the previous one
-        int comparisonFlag = 0;
-        if (FFLiCompareCharInfoWithAdditionalInfo(
-            &comparisonFlag,
-            1 << 0,// FFLI_COMPARE_CHAR_INFO_FLAG_PARTS,
-            &charInfo, // new charinfo
-            // current charinfo:
-            pInfoCurrent, // NOTE: charinfo is at 0 offset
-            NULL, NULL // do not care about additional info
-        ))
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+        // Swap in a CharModel that finished building, this may draw
+        FFLCharModel builtCharModel;
+        FFLResult buildResult;
+        if (isCharModelBuilderStarted && FFLCharModelBuilder_Poll(&gCharModelBuilder, &gTextureCallback, &builtCharModel, &buildResult))
         {
-            TraceLog(LOG_INFO, "updating charmodel");
-            UpdateCharModel(&charModel, &charInfo);
-            // Update previous CharInfo to current CharInfo
-            memcpy(&charInfo, pInfoCurrent, sizeof(FFLiCharInfo));
+            // Edits made after the model was requested are still in the mask,
+            // so it is only cleared once nothing newer is being built
+            const bool isBusy = FFLCharModelBuilder_IsBusy(&gCharModelBuilder);
+            if (buildResult == FFL_RESULT_OK)
+                SwapCharModel(&charModelState, &builtCharModel, GetCharInfoEditFlags(builderDirtyMask));
+            else
+            {
+                TraceLog(LOG_ERROR, "FFLInitCharModelCPUStep failed with result: %d", buildResult);
+                // Go back to the current CharInfo, unless it was edited again
+                if (!isBusy)
+                    FFLCharInfoEdit_Initialize(&charInfoEdit, pInfoCurrent);
+            }
+            if (!isBusy)
+                builderDirtyMask = 0;
+        }
+#endif
+
+        // Fields the UI changed last frame
+        const u64 charInfoDirtyMask = FFLCharInfoEdit_Consume(&charInfoEdit);
+        if (charInfoDirtyMask != 0)
+        {
+            TraceLog(LOG_INFO, "updating charmodel, changed fields: 0x%llx", (unsigned long long)charInfoDirtyMask);
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+            if (isCharModelBuilderStarted)
+            {
+                // Swapped in by FFLCharModelBuilder_Poll above, edits until then are coalesced
+                builderDirtyMask |= charInfoDirtyMask;
+                FFLCharModelBuilder_Request(&gCharModelBuilder, &charInfoEdit.charInfo,
+                    (const FFLCharModelDesc*)&((FFLiCharModel*)pCharModel)->charModelDesc);
+            }
+            else
+#endif
+            {
+                // Go back to the current CharInfo if it failed
+                if (!UpdateCharModel(&charModelState, &charInfoEdit.charInfo, GetCharInfoEditFlags(charInfoDirtyMask)))
+                    FFLCharInfoEdit_Initialize(&charInfoEdit, pInfoCurrent);
+            }
 
             /*
             int iHeight, iBuild;
             //iHeight = 1; iBuild = 1; // NOTE: FOR DEBUG
-            GetHeightAndBuildFromFFLCharModel(&charModel, &iHeight, &iBuild);
+            GetHeightAndBuildFromFFLCharModel(pCharModel, &iHeight, &iBuild);
             build = (float)iBuild; height = (float)iHeight;
             UpdateBodyScale(&modelFFLBodyScale, boneScales, build, height);
             */
@@ -1965,34 +3045,35 @@ int main(void)
 
 #ifndef NO_MODELS_FOR_TEST
         // Update model animation
-        ModelAnimation anim;
         Matrix headBoneMatrix;
         Matrix headModelMatrix;
         Vector3 bodyColor = { 0.094f, 0.094f, 0.078f }; // default
 
         if (modelAnimations != NULL)
         {
-            anim = modelAnimations[animIndex];
+#ifdef BODY_ANIMATION_QUANTIZED
+            const IQMQuantizedAnimation* pAnim = &modelAnimations[animIndex];
+            animCurrentFrame = (animCurrentFrame + 1) % pAnim->frameCount;
+            UpdateModelQuantizedAnimationBonesScaling(model, inverseBindMatrices, pAnim, (float)animCurrentFrame,
+                boneScales, boneNormalMatrices);
+#else
+            ModelAnimation anim = modelAnimations[animIndex];
             animCurrentFrame = (animCurrentFrame + 1) % anim.frameCount;
-            UpdateModelAnimationBonesScaling(model, anim, animCurrentFrame, boneScales);
+            UpdateModelAnimationBonesScaling(model, inverseBindMatrices, anim, animCurrentFrame, boneScales, boneNormalMatrices);
+#endif
+            GetBonePalette3x4(model.meshes[0].boneMatrices,
+                model.meshes[0].boneCount < BODY_BONE_NORMAL_MATRIX_MAX ? model.meshes[0].boneCount : BODY_BONE_NORMAL_MATRIX_MAX,
+                bonePalette);
             //UpdateModelAnimation(model, anim, animCurrentFrame);
 
-            {
-                Transform *bindTransform = &model.bindPose[VriableIconBodyBoneKind_Head];
-                Matrix bindMatrix = MatrixMultiply(MatrixMultiply(
-                    MatrixScale(bindTransform->scale.x, bindTransform->scale.y, bindTransform->scale.z),
-                    QuaternionToMatrix(bindTransform->rotation)),
-                    MatrixTranslate(bindTransform->translation.x, bindTransform->translation.y, bindTransform->translation.z));
-
-                headBoneMatrix = MatrixMultiply(bindMatrix,
-                    model.meshes[0].boneMatrices[VriableIconBodyBoneKind_Head]);
-            }
+            headBoneMatrix = MatrixMultiply(headBindMatrix,
+                model.meshes[0].boneMatrices[VriableIconBodyBoneKind_Head]);
             // decompose the head bone matrix to JUST translation
             headBoneMatrix = MatrixTranslate(headBoneMatrix.m12, headBoneMatrix.m13, headBoneMatrix.m14);
             headModelMatrix = MatrixMultiply(headBoneMatrix, matBodyScale);
 
             // get favorite color and reintrepret as Vector3
-            const FFLColor favColor = FFLGetFavoriteColor(((FFLiCharInfo*)&charModel)->favoriteColor);
+            const FFLColor favColor = FFLGetFavoriteColor(((FFLiCharInfo*)pCharModel)->favoriteColor);
             bodyColor = *(Vector3*)&favColor; // copy values, first three floats
         }
         else
@@ -2004,6 +3085,10 @@ int main(void)
         //----------------------------------------------------------------------------------
         const Vector3 pantsColor = { 0.439f, 0.125f, 0.063f };
 #endif
+        // May draw a mask that was not used yet, so not between BeginDrawing and EndDrawing
+        if (isFFLModelCreated)
+            UpdateCharModelBlink(&isBlinking, &lastBlinkTime, &charModelState, initialExpression, now);
+
         // Draw
         //----------------------------------------------------------------------------------
         BeginDrawing();
@@ -2025,27 +3110,22 @@ int main(void)
         {
 
             ShaderForFFL_Bind(&gShaderForFFL, false);
-            const int one = 1;
-            SetShaderValue(gShaderForFFL.shader, gLocationOfShaderForFFLSkinningEnable, &one, SHADER_UNIFORM_INT);
 
-            for (int i = 0; i < model.meshCount; i++) // will be 0 if failed to load
-            {
-                const int zero = 0;
-                SetShaderValue(gShaderForFFL.shader, gShaderForFFL.pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE], &zero, SHADER_UNIFORM_INT);
-                if ((i % 2) == 0) // pants
-                {
-                    ShaderForFFL_SetMaterial(&gShaderForFFL, &cMaterialParam[MATERIAL_PARAM_PANTS]);
-                    SetShaderValue(gShaderForFFL.shader, gShaderForFFL.pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &pantsColor, SHADER_UNIFORM_VEC3);
-                }
-                else
-                {
-                    ShaderForFFL_SetMaterial(&gShaderForFFL, &cMaterialParam[MATERIAL_PARAM_BODY]);
-                    SetShaderValue(gShaderForFFL.shader, gShaderForFFL.pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &bodyColor, SHADER_UNIFORM_VEC3);
-                }
-                DrawMesh(model.meshes[i], model.materials[model.meshMaterial[i]], matBodyScale);
-            }
-
-            EndShaderMode(); // unbind the shader if not drawing ffl model
+            if (IsKeyPressed(KEY_K))
+                bodySkinningMode = bodySkinningMode == SH_FFL_SKINNING_PALETTE
+                    ? SH_FFL_SKINNING_MATRIX : SH_FFL_SKINNING_PALETTE;
+            if (IsKeyPressed(KEY_B))
+                BenchmarkBodySkinning(model, matBodyScale, boneNormalMatrices, bonePalette,
+                    pantsColor, bodyColor, skinningBenchmarkMs);
+            if (IsKeyPressed(KEY_N))
+                BenchmarkAnimationDecode(animationBenchmarkFps);
+            if (IsKeyPressed(KEY_L))
+                BenchmarkAnimationLoad(animationLoadBenchmarkMs);
+
+            DrawBodyModel(model, matBodyScale, bodySkinningMode,
+                boneNormalMatrices, bonePalette, pantsColor, bodyColor);
+
+            ShaderForFFL_Unbind(&gShaderForFFL); // unbind the shader if not drawing ffl model
             // Draw custom OpenGL object after Raylib's 3D drawing
             rlDrawRenderBatchActive(); // Flush Raylib's internal buffers
         }
@@ -2064,30 +3144,29 @@ int main(void)
             Matrix matProjection = rlGetMatrixProjection();
             rlPopMatrix(); // Restore the previous matrix
 
-            UpdateCharModelBlink(&isBlinking, &lastBlinkTime, &charModel, initialExpression, now);
-
             ShaderForFFL_Bind(&gShaderForFFL, false);
             ShaderForFFL_SetViewUniform(&gShaderForFFL,
                 &matModel,
                 &matView, &matProjection);
-            FFLDrawOpa(&charModel);
-            FFLDrawXlu(&charModel);
+            ShaderForFFL_SetCharModel(&gShaderForFFL, pCharModel);
+            FFLDrawOpa(pCharModel);
+            FFLDrawXlu(pCharModel);
 #ifndef NO_MODELS_FOR_TEST
             Matrix matAcceModel = MatrixMultiply(acceMatrix, matModel);
             Matrix matAcceModelRight = MatrixMultiply(acceMatrixRight, matModel);
 
             for (int i = 0; i < acceModel.meshCount; i++) // will be 0 if failed to load
             {
-                const int zero = 0;
                 const Vector3 hatColor = { 0.50, 0.0, 0.50 }; //{ 0.58, 0.29, 0.0 };
-                SetShaderValue(gShaderForFFL.shader, gShaderForFFL.pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_MODE], &zero, SHADER_UNIFORM_INT);
-                ShaderForFFL_SetMaterial(&gShaderForFFL, &cMaterialParam[MATERIAL_PARAM_BODY]);
-                SetShaderValue(gShaderForFFL.shader, gShaderForFFL.pixelUniformLocation[SH_FFL_PIXEL_UNIFORM_CONST1], &hatColor, SHADER_UNIFORM_VEC3);
+                Material material = acceModel.materials[0];
+                material.shader = ShaderForFFL_SelectVariant(&gShaderForFFL, FFL_MODULATE_MODE_CONSTANT, MATERIAL_PARAM_BODY, SH_FFL_SKINNING_NONE);
+                ShaderForFFL_SetPixelUniform(&gShaderForFFL, SH_FFL_PIXEL_UNIFORM_CONST1, &hatColor, SHADER_UNIFORM_VEC3);
 
-                DrawMesh(acceModel.meshes[0], acceModel.materials[0], matAcceModel);
-                DrawMesh(acceModel.meshes[0], acceModel.materials[0], matAcceModelRight);
+                ShaderForFFL_DrawMesh(&gShaderForFFL, acceModel.meshes[0], material, matAcceModel);
+                ShaderForFFL_DrawMesh(&gShaderForFFL, acceModel.meshes[0], material, matAcceModelRight);
             }
 #endif
+            ShaderForFFL_Unbind(&gShaderForFFL);
         }
 
         EndMode3D();
@@ -2095,6 +3174,28 @@ int main(void)
         // Display FPS100ms
         DrawFPS(10, 10);
 
+        // Buffer objects created vs. reused this frame
+        FFLGLBufferCacheStats bufferStats = ShaderForFFL_ResetBufferStats(&gShaderForFFL);
+        DrawText(TextFormat("Buffers created: %d, avoided: %d", bufferStats.created, bufferStats.reused),
+            10, 35, 10, DARKGRAY);
+        // Same for GL state changes
+        FFLGLStateStats stateStats = ShaderForFFL_ResetStateStats(&gShaderForFFL);
+        DrawText(TextFormat("GL state calls issued: %d, skipped: %d", stateStats.issued, stateStats.skipped),
+            10, 50, 10, DARKGRAY);
+#ifndef NO_MODELS_FOR_TEST
+        // Skinning mode and the last benchmark result
+        DrawText(TextFormat("Skinning (K): %s, benchmark (B): matrix %.3f ms, palette %.3f ms",
+            bodySkinningMode == SH_FFL_SKINNING_PALETTE ? "3x4 palette" : "matrix",
+            skinningBenchmarkMs[SH_FFL_SKINNING_MATRIX], skinningBenchmarkMs[SH_FFL_SKINNING_PALETTE]),
+            10, 65, 10, DARKGRAY);
+        DrawText(TextFormat("Animation decode benchmark (N): scalar %.0f, SIMD %.0f frames/s",
+            animationBenchmarkFps[0], animationBenchmarkFps[1]),
+            10, 80, 10, DARKGRAY);
+        DrawText(TextFormat("Animation load benchmark (L): 1 thread %.2f ms, %d threads %.2f ms",
+            animationLoadBenchmarkMs[0], ANIMATION_LOAD_BENCHMARK_THREAD_COUNT, animationLoadBenchmarkMs[1]),
+            10, 95, 10, DARKGRAY);
+#endif
+
 
         // UI Panel with scroll.
         int width = 280;
@@ -2119,246 +3220,246 @@ int main(void)
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Face");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Faceline Type ", &charInfo.parts.faceType, 0,
-                    FFL_FACE_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Faceline Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_FACE_TYPE,
+                    0, FFL_FACE_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Faceline Color ", &charInfo.parts.facelineColor, 0,
-                    FFL_FACELINE_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Faceline Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_FACELINE_COLOR,
+                    0, FFL_FACELINE_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Face Wrinkle ", &charInfo.parts.faceLine, 0,
-                    FFL_FACE_LINE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Face Wrinkle ", &charInfoEdit, FFL_CHAR_INFO_FIELD_FACE_LINE,
+                    0, FFL_FACE_LINE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Face Make  ", &charInfo.parts.faceMakeup, 0,
-                    FFL_FACE_MAKE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Face Make  ", &charInfoEdit, FFL_CHAR_INFO_FIELD_FACE_MAKEUP,
+                    0, FFL_FACE_MAKE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Hair.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Hair");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Hair Type ", &charInfo.parts.hairType, 0,
-                    FFL_HAIR_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Hair Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_HAIR_TYPE,
+                    0, FFL_HAIR_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Hair Color ", &charInfo.parts.hairColor, 0,
-                    FFL_HAIR_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Hair Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_HAIR_COLOR,
+                    0, FFL_HAIR_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Hair Flip ", &charInfo.parts.hairDir,
-                    0, FFL_HAIR_DIR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Hair Flip ", &charInfoEdit, FFL_CHAR_INFO_FIELD_HAIR_DIR,
+                    0, FFL_HAIR_DIR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Eyes.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Eyes");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Type ", &charInfo.parts.eyeType, 0,
-                    FFL_EYE_TYPE_DATA_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_TYPE,
+                    0, FFL_EYE_TYPE_DATA_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Color ", &charInfo.parts.eyeColor, 0,
-                    FFL_EYE_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_COLOR,
+                    0, FFL_EYE_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Scale ", &charInfo.parts.eyeScale, 0,
-                    FFL_EYE_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_SCALE,
+                    0, FFL_EYE_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Aspect ", &charInfo.parts.eyeScaleY, 0,
-                    FFL_EYE_SCALE_Y_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Aspect ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_SCALE_Y,
+                    0, FFL_EYE_SCALE_Y_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Rotation ", &charInfo.parts.eyeRotate, 0,
-                    FFL_EYE_ROTATE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Rotation ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_ROTATE,
+                    0, FFL_EYE_ROTATE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye X ", &charInfo.parts.eyeSpacingX, 0,
-                    FFL_EYE_SPACING_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye X ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_SPACING_X,
+                    0, FFL_EYE_SPACING_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eye Y ", &charInfo.parts.eyePositionY, 0,
-                    FFL_EYE_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eye Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYE_POSITION_Y,
+                    0, FFL_EYE_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Eyebrows.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Eyebrows");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Type ", &charInfo.parts.eyebrowType, 0,
-                    FFL_EYEBROW_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_TYPE,
+                    0, FFL_EYEBROW_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Color ", &charInfo.parts.eyebrowColor, 0,
-                    FFL_EYEBROW_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_COLOR,
+                    0, FFL_EYEBROW_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Scale ", &charInfo.parts.eyebrowScale, 0,
-                    FFL_EYEBROW_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_SCALE,
+                    0, FFL_EYEBROW_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Aspect ", &charInfo.parts.eyebrowScaleY, 0,
-                    FFL_EYEBROW_SCALE_Y_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Aspect ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_SCALE_Y,
+                    0, FFL_EYEBROW_SCALE_Y_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Rotation ", &charInfo.parts.eyebrowRotate, 0,
-                    FFL_EYEBROW_ROTATE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Rotation ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_ROTATE,
+                    0, FFL_EYEBROW_ROTATE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow X ", &charInfo.parts.eyebrowSpacingX, 0,
-                    FFL_EYEBROW_SPACING_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow X ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_SPACING_X,
+                    0, FFL_EYEBROW_SPACING_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Eyebrow Y ", &charInfo.parts.eyebrowPositionY,
-                    FFL_EYEBROW_POS_MIN,
-                    FFL_EYEBROW_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Eyebrow Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_EYEBROW_POSITION_Y,
+                    FFL_EYEBROW_POS_MIN, FFL_EYEBROW_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Nose.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Nose");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Nose Type ", &charInfo.parts.noseType, 0,
-                    FFL_NOSE_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Nose Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_NOSE_TYPE,
+                    0, FFL_NOSE_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Nose Scale ", &charInfo.parts.noseScale, 0,
-                    FFL_NOSE_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Nose Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_NOSE_SCALE,
+                    0, FFL_NOSE_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Nose Y ", &charInfo.parts.nosePositionY, 0,
-                    FFL_NOSE_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Nose Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_NOSE_POSITION_Y,
+                    0, FFL_NOSE_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Mouth.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Mouth");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mouth Type ", &charInfo.parts.mouthType, 0,
-                    FFL_MOUTH_TYPE_DATA_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mouth Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOUTH_TYPE,
+                    0, FFL_MOUTH_TYPE_DATA_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mouth Color ", &charInfo.parts.mouthColor, 0,
-                    FFL_MOUTH_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mouth Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOUTH_COLOR,
+                    0, FFL_MOUTH_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mouth Scale ", &charInfo.parts.mouthScale, 0,
-                    FFL_MOUTH_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mouth Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOUTH_SCALE,
+                    0, FFL_MOUTH_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mouth Aspect ", &charInfo.parts.mouthScaleY, 0,
-                    FFL_MOUTH_SCALE_Y_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mouth Aspect ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOUTH_SCALE_Y,
+                    0, FFL_MOUTH_SCALE_Y_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mouth Y ", &charInfo.parts.mouthPositionY, 0,
-                    FFL_MOUTH_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mouth Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOUTH_POSITION_Y,
+                    0, FFL_MOUTH_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Mustache and Beard.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Mustache/Beard");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mustache Type ", &charInfo.parts.mustacheType, 0,
-                    FFL_MUSTACHE_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mustache Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MUSTACHE_TYPE,
+                    0, FFL_MUSTACHE_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Beard Type ", &charInfo.parts.beardType, 0,
-                    FFL_BEARD_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Beard Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_BEARD_TYPE,
+                    0, FFL_BEARD_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Beard Color ", &charInfo.parts.beardColor, 0,
-                    FFL_BEARD_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Beard Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_BEARD_COLOR,
+                    0, FFL_BEARD_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mustache Scale ", &charInfo.parts.mustacheScale, 0,
-                    FFL_MUSTACHE_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mustache Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MUSTACHE_SCALE,
+                    0, FFL_MUSTACHE_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mustache Y ", &charInfo.parts.mustachePositionY, 0,
-                    FFL_MUSTACHE_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mustache Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MUSTACHE_POSITION_Y,
+                    0, FFL_MUSTACHE_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Glasses.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Glasses");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Glass Type ", &charInfo.parts.glassType, 0, 19, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Glass Type ", &charInfoEdit, FFL_CHAR_INFO_FIELD_GLASS_TYPE,
+                    0, 19);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Glass Color ", &charInfo.parts.glassColor, 0,
-                    FFL_GLASS_COLOR_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Glass Color ", &charInfoEdit, FFL_CHAR_INFO_FIELD_GLASS_COLOR,
+                    0, FFL_GLASS_COLOR_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Glass Scale ", &charInfo.parts.glassScale, 0,
-                    FFL_GLASS_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Glass Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_GLASS_SCALE,
+                    0, FFL_GLASS_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Glass Y ", &charInfo.parts.glassPositionY, 0,
-                    FFL_GLASS_POS_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Glass Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_GLASS_POSITION_Y,
+                    0, FFL_GLASS_POS_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         // Mole.
         GuiLabel((Rectangle){uiX, uiY, uiWidth, uiHeight}, "Mole");
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mole Existence ", &charInfo.parts.moleType, 0,
-                    FFL_MOLE_TYPE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mole Existence ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOLE_TYPE,
+                    0, FFL_MOLE_TYPE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mole Scale ", &charInfo.parts.moleScale, 0,
-                    FFL_MOLE_SCALE_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mole Scale ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOLE_SCALE,
+                    0, FFL_MOLE_SCALE_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mole X ", &charInfo.parts.molePositionX, 0,
-                    FFL_MOLE_POS_X_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mole X ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOLE_POSITION_X,
+                    0, FFL_MOLE_POS_X_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
-        GuiSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
-                    "Mole Y ", &charInfo.parts.molePositionY, 0,
-                    FFL_MOLE_POS_Y_MAX - 1, true);
+        GuiCharInfoSpinner((Rectangle){uiX, uiY, uiWidth, uiHeight},
+                    "Mole Y ", &charInfoEdit, FFL_CHAR_INFO_FIELD_MOLE_POSITION_Y,
+                    0, FFL_MOLE_POS_Y_MAX - 1);
         uiY += uiHeight + uiSpacing;
 
         //GuiSlider((Rectangle){ 100, 100, 200, 20 },
@@ -2390,27 +3491,41 @@ int main(void)
     //--------------------------------------------------------------------------------------
 
     UnloadShader(cubeShader); // Unload default shader
-    UnloadShader(gShaderForFFL.shader); // Unload shader for FFL
 #ifndef NO_MODELS_FOR_TEST
     if (model.meshes != NULL)
         UnloadModel(model);
+    RL_FREE(inverseBindMatrices);
     if (modelAnimations != NULL)
-        UnloadModelAnimations(modelAnimations, animsCount);
+    {
+#ifdef BODY_ANIMATION_QUANTIZED
+        UnloadModelAnimationsIQMQuantized(modelAnimations, animsCount);
+#else
+        UnloadModelAnimationsIQMParents(modelAnimations, animsCount);
+#endif
+    }
     if (acceModel.meshes != NULL)
         UnloadModel(acceModel);
 #endif
 
+#ifdef FFL_CHAR_MODEL_BUILDER_USE_THREAD
+    // Before deleting CharModels, since the worker may be building one
+    if (isCharModelBuilderStarted)
+        FFLCharModelBuilder_Finalize(&gCharModelBuilder);
+#endif
+
     if (isFFLModelCreated)
     {
-        TraceLog(LOG_DEBUG, "FFLDeleteCharModel(%p)", &charModel);
-        FFLDeleteCharModel(&charModel);
+        TraceLog(LOG_DEBUG, "FFLDeleteCharModel(%p)", pCharModel);
+        ShaderForFFL_InvalidateCharModel(&gShaderForFFL, pCharModel);
+        UnloadCharModelTextures(&charModelState);
+        DeleteCharModelMaskDrawParams(pCharModel);
         // FFLCharModel destruction must happen before FFLExit, and before GL context is closed
+        FFLDeleteCharModel(pCharModel);
     }
 
-    // assuming that raylib checks if it is loaded or not
-    UnloadRenderTexture(gFacelineRenderTexture);
-    for (int i = 0; i < FFL_EXPRESSION_LIMIT; i++)
-        UnloadRenderTexture(gMaskRenderTextures[i]);
+    FFLCharModelTextureCache_Destroy(&gCharModelTextureCache); // after every CharModelRenderState is unloaded
+    FFLTextureAtlas_Destroy(&gCharModelTextureAtlas);
+    ShaderForFFL_Finalize(&gShaderForFFL); // Unload shader and buffers for FFL
 
     CloseWindow(); // Close window and OpenGL context
     //--------------------------------------------------------------------------------------
@@ -2424,15 +3539,14 @@ int main(void)
 const float cBlinkInterval = 8.0f; // 8 secs
 const float cBlinkDuration = 0.08f; // 80ms
 
-void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel* pCharModel, FFLExpression initialExpression, double now)
+void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, CharModelRenderState* pState, FFLExpression initialExpression, double now)
 {
     //double now = GetTime();
     double timeSinceLastBlink = now - *lastBlinkTime;
 
     // Check if it's time to blink (every 3 seconds = 3000 ms)
     if (!*isBlinking && timeSinceLastBlink >= cBlinkInterval) {
-        // FFLSetExpression(pCharModel, FFL_EXPRESSION_BLINK);
-        SetCharModelExpression(pCharModel, FFL_EXPRESSION_BLINK);
+        SetCharModelExpression(pState, FFL_EXPRESSION_BLINK);
         *isBlinking = true;
         TraceLog(LOG_TRACE, "expression: %d", FFL_EXPRESSION_BLINK);
         *lastBlinkTime = now; // Reset the blink time
@@ -2440,7 +3554,7 @@ void UpdateCharModelBlink(bool* isBlinking, double* lastBlinkTime, FFLCharModel*
 
     // Check if the blink should stop after 100ms
     if (*isBlinking && (now - *lastBlinkTime) >= cBlinkDuration) {
-        SetCharModelExpression(pCharModel, initialExpression); // back to previous
+        SetCharModelExpression(pState, initialExpression); // back to previous
         TraceLog(LOG_TRACE, "expression: %d", initialExpression);
         *isBlinking = false;
     }
@@ -2451,8 +3565,8 @@ void ExitFFL()
     TraceLog(LOG_DEBUG, "Calling FFLExit");
     FFLExit();
 
-    if (gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] > 0)
-        free(gResourceDesc.pData[FFL_RESOURCE_TYPE_HIGH]);
+    FFLResourceFile_Unload(&gResourceFileHigh);
+    gResourceDesc.size[FFL_RESOURCE_TYPE_HIGH] = 0;
     if (gResourceDesc.size[FFL_RESOURCE_TYPE_MIDDLE] > 0)
         free(gResourceDesc.pData[FFL_RESOURCE_TYPE_MIDDLE]);
 }
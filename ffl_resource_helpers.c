@@ -0,0 +1,142 @@
+//
+// Loading FFLResHigh.dat (or any FFL resource) for FFLInitRes.
+//
+// Include this after <nn/ffl.h> and raylib.h.
+//
+// Where mmap is available the file is mapped read-only instead of
+// read into a buffer: pages are only read from disk when FFL touches
+// them, and every process using the same file shares the page cache
+// instead of each keeping its own copy. Elsewhere (Windows, Emscripten,
+// whose mmap copies the file anyway) it is read into memory.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    #define FFL_RESOURCE_USE_MMAP
+    #include <sys/mman.h> // mmap, munmap, madvise
+    #include <sys/stat.h> // fstat
+    #include <fcntl.h> // open
+    #include <unistd.h> // close
+#endif
+
+typedef struct FFLResourceFile
+{
+    void* pData; // NULL if not loaded
+    u32 size;
+    bool isMapped; // unmap instead of free
+} FFLResourceFile;
+
+#ifdef FFL_RESOURCE_USE_MMAP
+static FFLResult FFLResourceFile_Map(FFLResourceFile* self, const char* path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        TraceLog(LOG_ERROR, "Error: Cannot open file %s", path);
+        return FFL_RESULT_FS_ERROR;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        TraceLog(LOG_ERROR, "Invalid file size for %s", path);
+        close(fd);
+        return FFL_RESULT_FS_ERROR;
+    }
+
+    void* pData = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (pData == MAP_FAILED)
+    {
+        TraceLog(LOG_WARNING, "Cannot map file %s", path);
+        return FFL_RESULT_ERROR; // can still be read
+    }
+    // FFL only reads the parts and textures it needs,
+    // so reading ahead would mostly load unused data
+    madvise(pData, (size_t)st.st_size, MADV_RANDOM);
+
+    self->pData = pData;
+    self->size = (u32)st.st_size;
+    self->isMapped = true;
+    TraceLog(LOG_DEBUG, "Mapped %s (%u bytes)", path, self->size);
+    return FFL_RESULT_OK;
+}
+#endif
+
+// Read the whole file into memory, used without mmap
+// or if the file system does not support it
+static FFLResult FFLResourceFile_Read(FFLResourceFile* self, const char* path)
+{
+    // Open the file in binary mode
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        TraceLog(LOG_ERROR, "Error: Cannot open file %s", path);
+        return FFL_RESULT_FS_ERROR;
+    }
+    // Seek to the end to determine file size
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET); // Go back to the start of the file
+    if (fileSize <= 0)
+    {
+        TraceLog(LOG_ERROR, "Invalid file size for %s", path);
+        fclose(file);
+        return FFL_RESULT_FS_ERROR;
+    }
+
+    void* fileData = malloc((size_t)fileSize);
+    if (fileData == NULL)
+    {
+        TraceLog(LOG_ERROR, "Cannot allocate memory for resource buffer");
+        fclose(file);
+        return FFL_RESULT_ERROR;
+    }
+    const size_t bytesRead = fread(fileData, 1, (size_t)fileSize, file);
+    fclose(file);
+    if (bytesRead != (size_t)fileSize)
+    {
+        TraceLog(LOG_ERROR, "Cannot read file %s", path);
+        free(fileData);
+        return FFL_RESULT_FS_ERROR;
+    }
+
+    self->pData = fileData;
+    self->size = (u32)fileSize;
+    self->isMapped = false;
+    TraceLog(LOG_DEBUG, "Read %s (%u bytes)", path, self->size);
+    return FFL_RESULT_OK;
+}
+
+// Load a resource file, the data stays valid until FFLResourceFile_Unload
+// and is read-only when mapped. FFLResourceFile is cleared on failure.
+FFLResult FFLResourceFile_Load(FFLResourceFile* self, const char* path)
+{
+    self->pData = NULL;
+    self->size = 0;
+    self->isMapped = false;
+#ifdef FFL_RESOURCE_USE_MMAP
+    const FFLResult result = FFLResourceFile_Map(self, path);
+    if (result != FFL_RESULT_ERROR)
+        return result;
+#endif
+    return FFLResourceFile_Read(self, path);
+}
+
+// Call after FFLExit, since FFL reads from the data until then
+void FFLResourceFile_Unload(FFLResourceFile* self)
+{
+    if (self->pData == NULL)
+        return;
+#ifdef FFL_RESOURCE_USE_MMAP
+    if (self->isMapped)
+        munmap(self->pData, self->size);
+    else
+#endif
+        free(self->pData);
+    self->pData = NULL;
+    self->size = 0;
+    self->isMapped = false;
+}
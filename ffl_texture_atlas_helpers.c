@@ -0,0 +1,319 @@
+//
+// Texture atlas for the faceline and mask textures of each CharModel.
+//
+// Include this after the OpenGL headers, raylib.h, rlgl.h
+// and ffl_gl_state_helpers.c.
+//
+// Every faceline and mask would otherwise be its own render texture,
+// so drawing many Miis means as many framebuffers, and a texture bind
+// for each of them. Instead they are packed into a few large render
+// textures (pages) with a shelf packer: regions are placed left to right
+// on a shelf as tall as the first region on it, and a new shelf is
+// opened above the last one when no shelf has room. Faceline and mask
+// sizes only depend on the resolution, so shelves fill up well.
+//
+// Regions are drawn into by limiting the viewport and scissor to them,
+// and sampled through a texture coordinate scale and offset, see
+// FFLTextureAtlasRegion.texCoordTransform. The sampler's wrap mode only
+// applies at the edges of the whole page, so the shader wraps texture
+// coordinates within the region itself, see FFLTextureAtlasWrap. This
+// matters for the faceline: it is half as wide as the face and relies
+// on GL_MIRRORED_REPEAT for the other half.
+//
+// A freed region is kept on its page and given to the next region of
+// the same size, which is the common case since masks are freed and
+// drawn again as they are evicted. Each page also counts its regions
+// and is emptied once all of them are freed.
+//
+
+#include <string.h>
+
+#define FFL_TEXTURE_ATLAS_PAGE_SIZE_MAX 4096
+// Page size when fragment shaders only have mediump, which
+// resolves about 1/2048 near 1.0: half a texel at this size
+#define FFL_TEXTURE_ATLAS_PAGE_SIZE_MEDIUMP 1024
+// Pixels around each region, filled with its clear color,
+// so that bilinear filtering does not bleed between regions
+#define FFL_TEXTURE_ATLAS_PADDING 2
+
+typedef struct FFLTextureAtlasShelf
+{
+    int y;
+    int height;
+    int usedWidth;
+} FFLTextureAtlasShelf;
+
+// A freed region, in pixels with padding
+typedef struct FFLTextureAtlasFreeSlot
+{
+    int x;
+    int y;
+    int width;
+    int height;
+} FFLTextureAtlasFreeSlot;
+
+typedef struct FFLTextureAtlasPage
+{
+    RenderTexture renderTexture;
+    FFLTextureAtlasShelf* shelves;
+    int shelfCount;
+    int shelfCapacity;
+    int usedHeight; // top of the last shelf
+    int regionCount; // emptied when this reaches 0
+    FFLTextureAtlasFreeSlot* freeSlots;
+    int freeSlotCount;
+    int freeSlotCapacity;
+} FFLTextureAtlasPage;
+
+typedef struct FFLTextureAtlasRegion
+{
+    GLuint texture; // texture of the page, 0 if the region is not allocated
+    int page;
+    int x; // in pixels, without padding
+    int y;
+    int width;
+    int height;
+    // Scale in xy and offset in zw, from texture coordinates
+    // of the whole texture to those of this region
+    Vector4 texCoordTransform;
+    // Minimum in xy and maximum in zw that texture coordinates are
+    // clamped to, inset by half a texel so that filtering stays inside
+    Vector4 texCoordBounds;
+} FFLTextureAtlasRegion;
+
+// How the shader wraps texture coordinates before texCoordTransform,
+// u_texcoord_wrap in the shader
+typedef enum FFLTextureAtlasWrap
+{
+    FFL_TEXTURE_ATLAS_WRAP_NONE = 0, // not in an atlas, left to the sampler
+    FFL_TEXTURE_ATLAS_WRAP_CLAMP, // GL_CLAMP_TO_EDGE within the region
+    FFL_TEXTURE_ATLAS_WRAP_MIRROR, // GL_MIRRORED_REPEAT within the region
+} FFLTextureAtlasWrap;
+
+// Wrap that gives the same result as sampler, for pRegion or NULL
+static FFLTextureAtlasWrap FFLTextureAtlasWrap_FromSampler(const FFLTextureAtlasRegion* pRegion, FFLGLSampler sampler)
+{
+    if (pRegion == NULL)
+        return FFL_TEXTURE_ATLAS_WRAP_NONE;
+    return sampler == FFL_GL_SAMPLER_MIRROR
+        ? FFL_TEXTURE_ATLAS_WRAP_MIRROR : FFL_TEXTURE_ATLAS_WRAP_CLAMP;
+}
+
+typedef struct FFLTextureAtlas
+{
+    FFLTextureAtlasPage* pages;
+    int pageCount;
+    int pageSize;
+    int filter; // TextureFilter of every page
+    bool isRegionOpen; // between BeginRegion and EndRegion
+} FFLTextureAtlas;
+
+// Scale and offset that leave texture coordinates unchanged,
+// for textures that are not in an atlas
+const Vector4 cFFLTextureAtlasIdentityTransform = { 1.0f, 1.0f, 0.0f, 0.0f };
+
+// Needs a GL context. Pages are created when they are needed.
+void FFLTextureAtlas_Initialize(FFLTextureAtlas* self, int filter)
+{
+    memset(self, 0, sizeof(FFLTextureAtlas));
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    self->pageSize = maxTextureSize < FFL_TEXTURE_ATLAS_PAGE_SIZE_MAX
+        ? maxTextureSize : FFL_TEXTURE_ATLAS_PAGE_SIZE_MAX;
+#ifdef GRAPHICS_API_OPENGL_ES2
+    // Texture coordinates are highp in the shader only where it is supported
+    GLint range[2];
+    GLint precision = 0;
+    glGetShaderPrecisionFormat(GL_FRAGMENT_SHADER, GL_HIGH_FLOAT, range, &precision);
+    if (precision == 0 && self->pageSize > FFL_TEXTURE_ATLAS_PAGE_SIZE_MEDIUMP)
+        self->pageSize = FFL_TEXTURE_ATLAS_PAGE_SIZE_MEDIUMP;
+#endif
+    self->filter = filter;
+    TraceLog(LOG_DEBUG, "Texture atlas page size: %d", self->pageSize);
+}
+
+static FFLTextureAtlasPage* FFLTextureAtlas_AddPage(FFLTextureAtlas* self)
+{
+    self->pages = (FFLTextureAtlasPage*)RL_REALLOC(self->pages,
+        (self->pageCount + 1) * sizeof(FFLTextureAtlasPage));
+    FFLTextureAtlasPage* pPage = &self->pages[self->pageCount++];
+    memset(pPage, 0, sizeof(FFLTextureAtlasPage));
+
+    pPage->renderTexture = LoadRenderTexture(self->pageSize, self->pageSize);
+    SetTextureFilter(pPage->renderTexture.texture, self->filter);
+    // Clear once so that padding nothing was drawn to is transparent
+    BeginTextureMode(pPage->renderTexture);
+    ClearBackground(BLANK);
+    EndTextureMode();
+
+    TraceLog(LOG_DEBUG, "Created texture atlas page %d, texture ID %d",
+        self->pageCount - 1, pPage->renderTexture.texture.id);
+    return pPage;
+}
+
+// Place a padded region on a page, returns false if it does not fit
+static bool FFLTextureAtlasPage_Place(FFLTextureAtlasPage* self, int pageSize,
+    int paddedWidth, int paddedHeight, int* pX, int* pY)
+{
+    // Reuse a freed region of exactly the same size
+    for (int i = 0; i < self->freeSlotCount; i++)
+    {
+        const FFLTextureAtlasFreeSlot* pSlot = &self->freeSlots[i];
+        if (pSlot->width == paddedWidth && pSlot->height == paddedHeight)
+        {
+            *pX = pSlot->x;
+            *pY = pSlot->y;
+            self->freeSlots[i] = self->freeSlots[--self->freeSlotCount];
+            return true;
+        }
+    }
+
+    // Use the lowest shelf that is tall enough and has room left
+    for (int i = 0; i < self->shelfCount; i++)
+    {
+        FFLTextureAtlasShelf* pShelf = &self->shelves[i];
+        if (pShelf->height >= paddedHeight && pageSize - pShelf->usedWidth >= paddedWidth)
+        {
+            *pX = pShelf->usedWidth;
+            *pY = pShelf->y;
+            pShelf->usedWidth += paddedWidth;
+            return true;
+        }
+    }
+
+    // Open a new shelf above the last one
+    if (pageSize - self->usedHeight < paddedHeight || pageSize < paddedWidth)
+        return false;
+    if (self->shelfCount == self->shelfCapacity)
+    {
+        self->shelfCapacity = self->shelfCapacity ? self->shelfCapacity * 2 : 8;
+        self->shelves = (FFLTextureAtlasShelf*)RL_REALLOC(self->shelves,
+            self->shelfCapacity * sizeof(FFLTextureAtlasShelf));
+    }
+    FFLTextureAtlasShelf* pShelf = &self->shelves[self->shelfCount++];
+    pShelf->y = self->usedHeight;
+    pShelf->height = paddedHeight;
+    pShelf->usedWidth = paddedWidth;
+    self->usedHeight += paddedHeight;
+
+    *pX = 0;
+    *pY = pShelf->y;
+    return true;
+}
+
+// Allocate a region of width by height pixels, on a new page if none has room
+bool FFLTextureAtlas_Allocate(FFLTextureAtlas* self, int width, int height, FFLTextureAtlasRegion* pRegion)
+{
+    memset(pRegion, 0, sizeof(FFLTextureAtlasRegion));
+    const int paddedWidth = width + FFL_TEXTURE_ATLAS_PADDING * 2;
+    const int paddedHeight = height + FFL_TEXTURE_ATLAS_PADDING * 2;
+    if (paddedWidth > self->pageSize || paddedHeight > self->pageSize)
+    {
+        TraceLog(LOG_ERROR, "Texture atlas region %dx%d is larger than a page", width, height);
+        return false;
+    }
+
+    int page = 0;
+    int x, y;
+    for (; page < self->pageCount; page++)
+    {
+        if (FFLTextureAtlasPage_Place(&self->pages[page], self->pageSize, paddedWidth, paddedHeight, &x, &y))
+            break;
+    }
+    if (page == self->pageCount)
+    {
+        FFLTextureAtlas_AddPage(self);
+        const bool isPlaced = FFLTextureAtlasPage_Place(&self->pages[page], self->pageSize, paddedWidth, paddedHeight, &x, &y);
+        assert(isPlaced); // a new page always has room
+        (void)isPlaced;
+    }
+
+    FFLTextureAtlasPage* pPage = &self->pages[page];
+    pPage->regionCount++;
+
+    const float pageSize = (float)self->pageSize;
+    pRegion->texture = pPage->renderTexture.texture.id;
+    pRegion->page = page;
+    pRegion->x = x + FFL_TEXTURE_ATLAS_PADDING;
+    pRegion->y = y + FFL_TEXTURE_ATLAS_PADDING;
+    pRegion->width = width;
+    pRegion->height = height;
+    pRegion->texCoordTransform = (Vector4){
+        (float)width / pageSize, (float)height / pageSize,
+        (float)pRegion->x / pageSize, (float)pRegion->y / pageSize
+    };
+    pRegion->texCoordBounds = (Vector4){
+        ((float)pRegion->x + 0.5f) / pageSize, ((float)pRegion->y + 0.5f) / pageSize,
+        ((float)(pRegion->x + width) - 0.5f) / pageSize, ((float)(pRegion->y + height) - 0.5f) / pageSize
+    };
+    return true;
+}
+
+// Free a region, its page is emptied when it was the last one on it
+void FFLTextureAtlas_Free(FFLTextureAtlas* self, FFLTextureAtlasRegion* pRegion)
+{
+    if (pRegion->texture == 0)
+        return;
+    assert(pRegion->page < self->pageCount);
+    FFLTextureAtlasPage* pPage = &self->pages[pRegion->page];
+    assert(pPage->regionCount > 0);
+    if (--pPage->regionCount == 0)
+    {
+        pPage->shelfCount = 0;
+        pPage->usedHeight = 0;
+        pPage->freeSlotCount = 0;
+    }
+    else
+    {
+        if (pPage->freeSlotCount == pPage->freeSlotCapacity)
+        {
+            pPage->freeSlotCapacity = pPage->freeSlotCapacity ? pPage->freeSlotCapacity * 2 : 8;
+            pPage->freeSlots = (FFLTextureAtlasFreeSlot*)RL_REALLOC(pPage->freeSlots,
+                pPage->freeSlotCapacity * sizeof(FFLTextureAtlasFreeSlot));
+        }
+        pPage->freeSlots[pPage->freeSlotCount++] = (FFLTextureAtlasFreeSlot){
+            pRegion->x - FFL_TEXTURE_ATLAS_PADDING, pRegion->y - FFL_TEXTURE_ATLAS_PADDING,
+            pRegion->width + FFL_TEXTURE_ATLAS_PADDING * 2, pRegion->height + FFL_TEXTURE_ATLAS_PADDING * 2
+        };
+    }
+    memset(pRegion, 0, sizeof(FFLTextureAtlasRegion));
+}
+
+// Draw into a region until FFLTextureAtlas_EndRegion, the padded
+// region is cleared to color. This calls BeginTextureMode.
+void FFLTextureAtlas_BeginRegion(FFLTextureAtlas* self, const FFLTextureAtlasRegion* pRegion, Color clearColor)
+{
+    assert(!self->isRegionOpen); // regions can not be nested
+    self->isRegionOpen = true;
+    BeginTextureMode(self->pages[pRegion->page].renderTexture);
+    // Clear the padding too, with the same color as the region
+    rlEnableScissorTest();
+    rlScissor(pRegion->x - FFL_TEXTURE_ATLAS_PADDING, pRegion->y - FFL_TEXTURE_ATLAS_PADDING,
+        pRegion->width + FFL_TEXTURE_ATLAS_PADDING * 2, pRegion->height + FFL_TEXTURE_ATLAS_PADDING * 2);
+    ClearBackground(clearColor);
+    // Only draw inside of the region
+    rlScissor(pRegion->x, pRegion->y, pRegion->width, pRegion->height);
+    rlViewport(pRegion->x, pRegion->y, pRegion->width, pRegion->height);
+}
+
+void FFLTextureAtlas_EndRegion(FFLTextureAtlas* self)
+{
+    assert(self->isRegionOpen);
+    self->isRegionOpen = false;
+    rlDisableScissorTest();
+    EndTextureMode();
+}
+
+// Unload every page, the atlas can be used again afterwards
+void FFLTextureAtlas_Destroy(FFLTextureAtlas* self)
+{
+    for (int i = 0; i < self->pageCount; i++)
+    {
+        UnloadRenderTexture(self->pages[i].renderTexture);
+        RL_FREE(self->pages[i].shelves);
+        RL_FREE(self->pages[i].freeSlots);
+    }
+    RL_FREE(self->pages);
+    self->pages = NULL;
+    self->pageCount = 0;
+}